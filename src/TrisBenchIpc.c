@@ -0,0 +1,414 @@
+/************************************
+ * VR487434 - Lorenzo Di Berardino
+ * VR486588 - Filippo Milani
+ * 09/05/2024
+ ************************************/
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/ipc.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "utils/data.h"
+#include "utils/globals.h"
+#include "utils/semaphores/semaphores.h"
+#include "utils/shared_memory/shared_memory.h"
+
+// Directions of the ping-pong
+#define PING 0
+#define PONG 1
+
+// State shared by the two processes of the ping-pong
+typedef struct {
+    atomic_int futex_words[2];
+    atomic_int spin_words[2];
+    pthread_mutex_t mutex;
+    pthread_cond_t conds[2];
+    int cond_flags[2];
+} bench_shared_t;
+
+typedef struct {
+    const char* name;
+    void (*setup)();
+    void (*signal)(int);
+    void (*wait)(int);
+    void (*teardown)();
+} ipc_primitive_t;
+
+void setup_semaphores();
+void signal_semaphores(int);
+void wait_semaphores(int);
+void teardown_semaphores();
+void setup_futex();
+void signal_futex(int);
+void wait_futex(int);
+void setup_eventfd();
+void signal_eventfd(int);
+void wait_eventfd(int);
+void setup_pipe();
+void setup_socket();
+void signal_fd(int);
+void wait_fd(int);
+void teardown_fds();
+void setup_condvar();
+void signal_condvar(int);
+void wait_condvar(int);
+void teardown_condvar();
+void setup_spin();
+void signal_spin(int);
+void wait_spin(int);
+void no_teardown();
+void init_shared_memory();
+void dispose_memory();
+void run(const ipc_primitive_t*, int);
+int compare_samples(const void*, const void*);
+uint64_t now_ns();
+long context_switches(int);
+
+// Shared memory
+bench_shared_t* shared = NULL;
+int shared_id = -1;
+
+// Semaphores
+int sem_id = -1;
+
+// Descriptors of the fd based primitives, one pair per direction
+int fds[2][2] = { { -1, -1 }, { -1, -1 } };
+int eventfds[2] = { -1, -1 };
+
+ipc_primitive_t primitives[] = {
+    { "semafori SysV", setup_semaphores, signal_semaphores, wait_semaphores, teardown_semaphores },
+    { "futex", setup_futex, signal_futex, wait_futex, no_teardown },
+    { "eventfd", setup_eventfd, signal_eventfd, wait_eventfd, teardown_fds },
+    { "pipe", setup_pipe, signal_fd, wait_fd, teardown_fds },
+    { "socket unix", setup_socket, signal_fd, wait_fd, teardown_fds },
+    { "condvar pthread", setup_condvar, signal_condvar, wait_condvar, teardown_condvar },
+    { "spin", setup_spin, signal_spin, wait_spin, no_teardown },
+};
+
+int main(int argc, char* argv[])
+{
+    int iterations = BENCH_DEFAULT_ITERATIONS;
+
+    if (argc > 2) {
+        printf(USAGE_ERROR_BENCH, argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    if (argc == 2) {
+        char* str_ptr;
+        iterations = strtol(argv[1], &str_ptr, 10);
+        if (*str_ptr != '\0' || iterations <= 0)
+            errexit(ITERATIONS_INVALID_ERROR);
+    }
+
+    init_shared_memory();
+
+    printf(BENCH_HEADER_MESSAGE, iterations);
+    for (size_t i = 0; i < sizeof(primitives) / sizeof(primitives[0]); i++)
+        run(&primitives[i], iterations);
+
+    return EXIT_SUCCESS;
+}
+
+// ------------------ INITIALIZERS -------------------
+
+/// @brief Create the shared memory through the same functions used by the game
+void init_shared_memory()
+{
+    shared_id = get_and_init_shared_memory(sizeof(bench_shared_t), IPC_PRIVATE);
+    shared = (bench_shared_t*)attach_shared_memory(shared_id);
+
+    if (atexit(dispose_memory))
+        errexit(INITIALIZATION_ERROR);
+}
+
+void dispose_memory()
+{
+    dispose_shared_memory(shared_id);
+    detach_shared_memory(shared);
+}
+
+// ------------------ BENCHMARK -------------------
+
+/// @brief Run the ping-pong of a primitive between this process and a child
+/// @param primitive The primitive to measure
+/// @param iterations The number of round trips to measure
+void run(const ipc_primitive_t* primitive, int iterations)
+{
+    int warmup = iterations / 10;
+    uint64_t* samples = malloc(iterations * sizeof(uint64_t));
+    if (samples == NULL)
+        errexit(INITIALIZATION_ERROR);
+
+    primitive->setup();
+    long switches = context_switches(RUSAGE_SELF) + context_switches(RUSAGE_CHILDREN);
+
+    pid_t pid = fork();
+    if (pid < 0)
+        errexit(FORK_ERROR);
+
+    if (pid == 0) {
+        // The child answers every ping with a pong
+        for (int i = 0; i < warmup + iterations; i++) {
+            primitive->wait(PING);
+            primitive->signal(PONG);
+        }
+
+        // Skip the atexit handlers of the parent
+        _exit(EXIT_SUCCESS);
+    }
+
+    for (int i = 0; i < warmup + iterations; i++) {
+        uint64_t start = now_ns();
+        primitive->signal(PING);
+        primitive->wait(PONG);
+
+        if (i >= warmup)
+            samples[i - warmup] = now_ns() - start;
+    }
+
+    waitpid(pid, NULL, 0);
+    switches = context_switches(RUSAGE_SELF) + context_switches(RUSAGE_CHILDREN) - switches;
+    primitive->teardown();
+
+    qsort(samples, iterations, sizeof(uint64_t), compare_samples);
+    printf(BENCH_ROW_MESSAGE, primitive->name,
+        samples[0] / 1000.0,
+        samples[iterations / 2] / 1000.0,
+        samples[(int)(iterations * 0.99)] / 1000.0,
+        samples[iterations - 1] / 1000.0,
+        (double)switches / (warmup + iterations));
+    fflush(stdout);
+
+    free(samples);
+}
+
+int compare_samples(const void* a, const void* b)
+{
+    uint64_t x = *(const uint64_t*)a, y = *(const uint64_t*)b;
+    return (x > y) - (x < y);
+}
+
+uint64_t now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/// @brief Voluntary and involuntary context switches of this process or its children
+long context_switches(int who)
+{
+    struct rusage usage;
+    getrusage(who, &usage);
+    return usage.ru_nvcsw + usage.ru_nivcsw;
+}
+
+void no_teardown()
+{
+}
+
+// ------------------ SYSV SEMAPHORES -------------------
+
+/// @brief The same semaphore functions of the game, on a private set
+/// (in order not to interfere with a running server)
+void setup_semaphores()
+{
+    short unsigned values[2] = { 0, 0 };
+
+    sem_id = get_private_semaphores(2);
+    set_semaphores(sem_id, 2, values);
+}
+
+void signal_semaphores(int direction)
+{
+    signal_semaphore(sem_id, direction, 1);
+}
+
+void wait_semaphores(int direction)
+{
+    wait_semaphore(sem_id, direction, 1);
+}
+
+void teardown_semaphores()
+{
+    dispose_semaphore(sem_id);
+}
+
+// ------------------ FUTEX -------------------
+
+void setup_futex()
+{
+    atomic_store(&shared->futex_words[PING], 0);
+    atomic_store(&shared->futex_words[PONG], 0);
+}
+
+void signal_futex(int direction)
+{
+    atomic_store(&shared->futex_words[direction], 1);
+    futex_wake(&shared->futex_words[direction], 1);
+}
+
+void wait_futex(int direction)
+{
+    while (atomic_exchange(&shared->futex_words[direction], 0) == 0)
+        futex_wait(&shared->futex_words[direction], 0, NULL);
+}
+
+// ------------------ FILE DESCRIPTORS -------------------
+
+void setup_eventfd()
+{
+    for (int i = 0; i < 2; i++) {
+        if ((eventfds[i] = eventfd(0, 0)) < 0)
+            errexit(INITIALIZATION_ERROR);
+        fds[i][0] = fds[i][1] = eventfds[i];
+    }
+}
+
+void signal_eventfd(int direction)
+{
+    uint64_t value = 1;
+    if (write(fds[direction][1], &value, sizeof(value)) < 0)
+        errexit(BENCH_IO_ERROR);
+}
+
+void wait_eventfd(int direction)
+{
+    uint64_t value;
+    if (read(fds[direction][0], &value, sizeof(value)) < 0)
+        errexit(BENCH_IO_ERROR);
+}
+
+void setup_pipe()
+{
+    for (int i = 0; i < 2; i++) {
+        if (pipe(fds[i]) < 0)
+            errexit(INITIALIZATION_ERROR);
+    }
+}
+
+void setup_socket()
+{
+    int pair[2];
+
+    // One socket per side: each direction goes from one end to the other
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, pair) < 0)
+        errexit(INITIALIZATION_ERROR);
+
+    fds[PING][1] = fds[PONG][0] = pair[0];
+    fds[PING][0] = fds[PONG][1] = pair[1];
+}
+
+void signal_fd(int direction)
+{
+    char byte = 0;
+    if (write(fds[direction][1], &byte, 1) < 0)
+        errexit(BENCH_IO_ERROR);
+}
+
+void wait_fd(int direction)
+{
+    char byte;
+    if (read(fds[direction][0], &byte, 1) < 0)
+        errexit(BENCH_IO_ERROR);
+}
+
+void teardown_fds()
+{
+    for (int i = 0; i < 2; i++) {
+        for (int j = 0; j < 2; j++) {
+            // The socket and the eventfd share descriptors between directions
+            if (fds[i][j] >= 0 && fcntl(fds[i][j], F_GETFD) >= 0)
+                close(fds[i][j]);
+            fds[i][j] = -1;
+        }
+    }
+}
+
+// ------------------ PTHREAD CONDVAR -------------------
+
+void setup_condvar()
+{
+    pthread_mutexattr_t mutex_attr;
+    pthread_condattr_t cond_attr;
+
+    pthread_mutexattr_init(&mutex_attr);
+    pthread_mutexattr_setpshared(&mutex_attr, PTHREAD_PROCESS_SHARED);
+    pthread_mutex_init(&shared->mutex, &mutex_attr);
+
+    pthread_condattr_init(&cond_attr);
+    pthread_condattr_setpshared(&cond_attr, PTHREAD_PROCESS_SHARED);
+    for (int i = 0; i < 2; i++) {
+        pthread_cond_init(&shared->conds[i], &cond_attr);
+        shared->cond_flags[i] = 0;
+    }
+
+    pthread_mutexattr_destroy(&mutex_attr);
+    pthread_condattr_destroy(&cond_attr);
+}
+
+void signal_condvar(int direction)
+{
+    pthread_mutex_lock(&shared->mutex);
+    shared->cond_flags[direction] = 1;
+    pthread_cond_signal(&shared->conds[direction]);
+    pthread_mutex_unlock(&shared->mutex);
+}
+
+void wait_condvar(int direction)
+{
+    pthread_mutex_lock(&shared->mutex);
+    while (shared->cond_flags[direction] == 0)
+        pthread_cond_wait(&shared->conds[direction], &shared->mutex);
+    shared->cond_flags[direction] = 0;
+    pthread_mutex_unlock(&shared->mutex);
+}
+
+void teardown_condvar()
+{
+    for (int i = 0; i < 2; i++)
+        pthread_cond_destroy(&shared->conds[i]);
+    pthread_mutex_destroy(&shared->mutex);
+}
+
+// ------------------ SPIN -------------------
+
+void setup_spin()
+{
+    atomic_store(&shared->spin_words[PING], 0);
+    atomic_store(&shared->spin_words[PONG], 0);
+}
+
+void signal_spin(int direction)
+{
+    atomic_store_explicit(&shared->spin_words[direction], 1, memory_order_release);
+}
+
+void wait_spin(int direction)
+{
+    int spins = 0;
+
+    while (atomic_load_explicit(&shared->spin_words[direction], memory_order_acquire) == 0) {
+        // On a single core the other side cannot run while this one spins
+        if (++spins % BENCH_SPIN_YIELD_INTERVAL == 0)
+            sched_yield();
+    }
+
+    atomic_store_explicit(&shared->spin_words[direction], 0, memory_order_relaxed);
+}
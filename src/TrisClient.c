@@ -5,25 +5,56 @@
  ************************************/
 
 #include <errno.h>
+#include <ctype.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <poll.h>
+#include <pthread.h>
 #include <signal.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
 #include <termios.h>
 #include <time.h>
 #include <unistd.h>
 
 #include "utils/data.h"
 #include "utils/globals.h"
+#include "utils/ai_pool/ai_pool.h"
+#include "utils/bot/bot.h"
+#include "utils/directory/directory.h"
+#include "utils/engine/engine.h"
+#include "utils/events/events.h"
+#include "utils/lobby/lobby.h"
+#include "utils/matchmaking/matchmaking.h"
+#include "utils/registry/registry.h"
+#include "utils/render/render.h"
 #include "utils/semaphores/semaphores.h"
 #include "utils/shared_memory/shared_memory.h"
 
+int parse_options(int, char*[]);
 void init();
+void attach_lobby();
 void init_shared_memory();
+tris_game_t* find_game();
+void leave_queue(uint64_t);
 void init_semaphores();
 void init_signals();
+void init_heartbeat();
+void init_input();
+void* heartbeat_handler(void*);
+void stop_heartbeat();
 void ask_for_input();
+void ask_engine_move();
+void init_engine();
+void read_move(char*);
+bool take_word(char*);
+void fill_input();
+void handle_tick();
+void handle_notifications();
 void wait_for_opponent();
 void notify_player_ready();
 void notify_move();
@@ -32,6 +63,7 @@ void quit_handler(int);
 void check_results(int);
 void server_quit_handler(int);
 void wait_for_move();
+void wait_game_semaphore(int);
 void print_move_screen();
 void init_timeout();
 void reset_timeout();
@@ -39,10 +71,48 @@ void timeout_handler(int);
 void show_input();
 void init_terminal_settings();
 void dispose_memory();
+void play_session();
+void play_game();
+void serve_ai_pool();
+void init_pool_signals();
+bool join_pool_game(uint64_t);
+void leave_pool_game();
+void end_game(int);
+void print_results();
+void watch_game();
+void print_snapshot(tris_snapshot_t*);
+void spectator_quit_handler(int);
+void notify_quit();
+void record_moves();
+bool is_game_recycled();
+void play_bot();
+void resume_game();
+void print_resume_token();
+void hangup_handler(int);
 
 // Shared memory
+tris_lobby_t* lobby = NULL;
 tris_game_t* game = NULL;
-int game_id = -1;
+int lobby_id = -1;
+
+// Slot of the game in the lobby: the handle is given to the AI by the server,
+// the generation tells if the slot has been given to another game
+uint64_t slot_handle = NO_HANDLE;
+unsigned generation = 0;
+
+// Shard of the server: the least loaded one, unless given
+int shard = NO_SHARD;
+
+// Slot of the game watched by a spectator
+int watch_slot = NO_WATCH;
+
+// Token of the slot of a player who lost its client, to resume its game
+const char* resume_token = NULL;
+
+// Cell of a warm AI client in the pool of the server: at the end of a game, the
+// client goes back to the pool instead of exiting
+int pool_cell = NO_POOL_CELL;
+bool pool_game_over = false;
 
 // Semaphores
 int sem_id = -1;
@@ -54,6 +124,7 @@ sigset_t set;
 bool first_CTRLC_pressed = false;
 bool started = false;
 bool active_player = false;
+bool waiting_for_rematch = false;
 
 char* username = NULL;
 
@@ -61,25 +132,74 @@ int player_index = -1;
 int cycles = 0;
 int autoplay = NONE;
 
+// Command line of the external engine that plays the moves, if any
+const char* engine_command = NULL;
+
+// Number of games played at once by a bot, which has no game of its own
+int bot_games = NO_BOT;
+
+// Cells of the board whose moves have been recorded as events
+unsigned recorded_marks = 0;
+
 // Terminal settings
 struct termios with_echo, without_echo;
 bool output_customizable = true;
-pthread_t spinner_tid = 0, timeout_tid = 0;
+
+// Input of the moves: stdin is read into a buffer as it becomes readable, while
+// the timer of the timeout and the signals of the server are waited for too
+char input_buffer[INPUT_BUFFER_LEN];
+int input_len = 0;
+bool input_closed = false;
+int timer_fd = -1;
+int notification_fd = -1;
+sigset_t notifications;
+int timeout_left = 0;
+
+// Liveness
+pthread_t heartbeat_tid = 0;
+pthread_mutex_t heartbeat_mutex = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t heartbeat_cond = PTHREAD_COND_INITIALIZER;
+bool heartbeat_stopped = false;
 
 int main(int argc, char* argv[])
 {
+    // The positional arguments follow the options (program name included)
+    int first_arg = parse_options(argc, argv);
+    int n_args = argc - first_arg + 1;
+    char** args = argv + first_arg - 1;
+
+    // A spectator has no username: it only watches a game
+    if (watch_slot != NO_WATCH) {
+        if (n_args != 1 || bot_games != NO_BOT) {
+            printf(USAGE_ERROR_CLIENT, argv[0]);
+            exit(EXIT_FAILURE);
+        }
+
+        watch_game();
+    }
+
+    // A player who lost its client takes back its game, with the same username
+    if (resume_token != NULL) {
+        if (n_args != 1 || bot_games != NO_BOT) {
+            printf(USAGE_ERROR_CLIENT, argv[0]);
+            exit(EXIT_FAILURE);
+        }
+
+        resume_game();
+    }
+
     // Check if the number of arguments is correct
-    if (argc != N_ARGS_CLIENT + 1 && argc != N_ARGS_CLIENT) {
+    if (n_args != N_ARGS_CLIENT + 1 && n_args != N_ARGS_CLIENT) {
         printf(USAGE_ERROR_CLIENT, argv[0]);
         exit(EXIT_FAILURE);
     }
 
     // if user wants to play against the AI,
     // check if the AI level is correct
-    if (argc == N_ARGS_CLIENT + 1) {
-        int check_easy = strcmp(argv[2], EASY_AI_CHAR);
-        int check_medium = strcmp(argv[2], MEDIUM_AI_CHAR);
-        int check_impossible = strcmp(argv[2], IMPOSSIBLE_AI_CHAR);
+    if (n_args == N_ARGS_CLIENT + 1) {
+        int check_easy = strcmp(args[2], EASY_AI_CHAR);
+        int check_medium = strcmp(args[2], MEDIUM_AI_CHAR);
+        int check_impossible = strcmp(args[2], IMPOSSIBLE_AI_CHAR);
 
         if (check_easy != 0 && check_medium != 0 && check_impossible != 0) {
             printf(USAGE_ERROR_CLIENT, argv[0]);
@@ -95,10 +215,14 @@ int main(int argc, char* argv[])
     }
 
     // Check if the username length is correct
-    username = argv[1];
+    username = args[1];
     if (strlen(username) > USERNAME_MAX_LEN)
         errexit(USERNAME_TOO_LONG_ERROR);
 
+    // The games of a bot are played under its username, followed by their number
+    if (bot_games != NO_BOT && strlen(username) + 1 + digits(bot_games - 1) > USERNAME_MAX_LEN)
+        errexit(USERNAME_TOO_LONG_ERROR);
+
     if (strlen(username) < USERNAME_MIN_LEN)
         errexit(USERNAME_TOO_SHORT_ERROR);
 
@@ -106,18 +230,262 @@ int main(int argc, char* argv[])
     if (active_player && autoplay != NONE && strcmp(username, AI_USERNAME) == 0)
         errexit(AI_USERNAME_ERROR);
 
+    // A warm AI client plays the games given by the server, one after the other
+    if (pool_cell != NO_POOL_CELL)
+        serve_ai_pool();
+
+    // A bot plays its games all at once
+    if (bot_games != NO_BOT)
+        play_bot();
+
     // Initialize the client
     init();
+    play_session();
+
+    return EXIT_SUCCESS;
+}
+
+/// @brief Plays the game of this client (in a rematch session, the games are
+/// played one after the other, until a player leaves)
+void play_session()
+{
+    do {
+        // After the initialization (or the previous game), the client is ready to
+        // play; a resumed game has already started
+        if (!started) {
+            notify_player_ready();
+
+            // Wait for the opponent to be ready
+            wait_for_opponent();
+        }
+
+        // A warm AI client that is done with its game goes back to the pool
+        if (pool_game_over)
+            return;
+
+        play_game();
+        if (pool_game_over)
+            return;
+
+        // Reached only at the end of a game of a rematch session
+        print_results();
+        print_and_flush(REMATCH_MESSAGE);
+        started = false;
+        waiting_for_rematch = true;
+    } while (1);
+}
+
+/// @brief Plays the games given by the server to a warm AI client of its pool.
+/// The client is initialized once; then it waits for a game, plays it, and goes
+/// back to the pool: the end of a game returns here, instead of exiting
+void serve_ai_pool()
+{
+    sigset_t all, pending;
+    sigfillset(&all);
+    sigprocmask(SIG_SETMASK, &all, NULL);
+
+    attach_lobby();
+    init_heartbeat();
+    init_pool_signals();
+    srand(time(NULL));
+
+    while (1) {
+        uint64_t handle = wait_for_ai_game(lobby, pool_cell);
+
+        if (handle != NO_HANDLE) {
+            // The signals left by the previous game are discarded
+            struct signalfd_siginfo info;
+            while (read(notification_fd, &info, sizeof(info)) == sizeof(info))
+                ;
+
+            if (join_pool_game(handle)) {
+                play_session();
+                leave_pool_game();
+            }
+        }
+
+        // The pool goes away with its server, which started it (a server that is
+        // gone may still be a zombie: the client is given to another parent)
+        sigpending(&pending);
+        if (sigismember(&pending, SIGTERM) || getppid() != lobby->server_pid)
+            exit(EXIT_SUCCESS);
+    }
+}
+
+/// @brief Plays the games of a bot, each one under its own username, until the
+/// bot is asked to quit or the server is gone (see play_bot_games). The signals
+/// stay blocked: the bot looks for them between two waits
+void play_bot()
+{
+    sigset_t all;
+    sigfillset(&all);
+    sigprocmask(SIG_SETMASK, &all, NULL);
+
+    print_welcome_message_client(username);
+    print_loading_message();
+
+    if (engine_command != NULL)
+        init_engine();
+
+    attach_lobby();
+
+    // The server needs the path of the client to start the AI
+    if (autoplay != NONE)
+        publish_client_path(lobby);
+
+    srand(time(NULL));
+    print_loading_complete_message();
+
+    exit(play_bot_games(lobby, username, autoplay, bot_games, engine_command != NULL));
+}
+
+/// @brief Takes back the game of a player whose client was lost, with the token
+/// of its slot, and plays it from where it was left. The server gives the turn
+/// back to the player before the slot is ready again
+void resume_game()
+{
+    static char resumed_username[USERNAME_MAX_LEN + 1];
+    int token_shard, index, length = 0;
+    uint64_t handle, token;
+
+    if (sscanf(resume_token, RESUME_TOKEN_SCAN_FORMAT, &token_shard, &handle, &index, &token, &length) != 4
+        || resume_token[length] != '\0' || token_shard < 0 || token_shard >= MAX_SHARDS)
+        errexit(RESUME_ERROR);
+
+    // The signals stay blocked until the slot is ready, as in join_game
+    sigset_t mask;
+    sigfillset(&mask);
+    sigprocmask(SIG_BLOCK, &mask, NULL);
+
+    shard = token_shard;
+    attach_lobby();
+
+    if ((game = rejoin_game(lobby, handle, index, token, &player_index)) == NULL)
+        errexit(RESUME_ERROR);
+
+    strncpy(resumed_username, get_player_username(lobby, game, player_index), USERNAME_MAX_LEN);
+    username = resumed_username;
+    autoplay = game->autoplay;
+    active_player = autoplay != NONE;
+    generation = atomic_load(&game->generation);
+
+    print_welcome_message_client(username);
+    print_loading_message();
+
+    if (engine_command != NULL)
+        init_engine();
+
+    init_heartbeat();
+    init_semaphores();
+
+    // Wait for the server to give the turn back (the timeout tells if it is gone)
+    int state;
+    while ((state = atomic_load(&game->players[player_index].state)) == SLOT_RESUMED) {
+        struct timespec poll = { 0, HEARTBEAT_INTERVAL_MS * 1000000L };
+        futex_wait(&game->players[player_index].state, SLOT_RESUMED, &poll);
+
+        if (kill(lobby->server_pid, 0) < 0 && errno == ESRCH)
+            errexit(NO_SERVER_FOUND_ERROR);
+    }
+
+    // The game ended while the player was coming back
+    if (state != SLOT_READY)
+        errexit(RESUME_ERROR);
+
+    init_signals();
+    init_input();
+    init_terminal_settings();
+    emit_join(get_game_index(lobby, game), player_index, username);
+    srand(time(NULL));
+
+    print_loading_complete_message();
+    print_and_flush(RESUMED_MESSAGE);
+    print_resume_token();
+
+    started = true;
+    play_session();
+}
+
+/// @brief Prints the token a human player can resume its game with, if the
+/// server keeps the slots of the players who lost their client
+void print_resume_token()
+{
+    tris_player_t* player = &game->players[player_index];
+
+    if (is_headless() || lobby->resume_grace == 0 || player->token == NO_TOKEN)
+        return;
+
+    char token[RESUME_TOKEN_LEN];
+    snprintf(token, sizeof(token), RESUME_TOKEN_FORMAT, shard,
+        get_game_handle(lobby, get_game_index(lobby, game)), player_index, player->token);
+    printf(RESUME_TOKEN_MESSAGE, token);
+}
+
+/// @brief Joins the game given by the server to a warm AI client
+/// @return True if the game has been joined, false if it is gone
+bool join_pool_game(uint64_t handle)
+{
+    int index;
+    tris_game_t* joined = join_game(lobby, handle, username, &index);
+    if (joined == NULL)
+        return false;
+
+    // The heartbeat thread reads the game
+    pthread_mutex_lock(&heartbeat_mutex);
+    game = joined;
+    player_index = index;
+    generation = atomic_load(&game->generation);
+    pthread_mutex_unlock(&heartbeat_mutex);
+
+    autoplay = game->autoplay;
+    sem_id = game->sem_id;
+    started = false;
+    emit_join(get_game_index(lobby, game), player_index, username);
+    waiting_for_rematch = false;
+    pool_game_over = false;
+    first_CTRLC_pressed = false;
+    cycles = 0;
+
+    return true;
+}
+
+/// @brief Leaves the game of a warm AI client, if any, so that its slot is freed
+/// right away (a leaving client would be found dead by the reaper instead)
+void leave_pool_game()
+{
+    pthread_mutex_lock(&heartbeat_mutex);
+
+    if (game != NULL && !is_game_recycled())
+        request_quit(lobby, game, player_index);
+    game = NULL;
+
+    pthread_mutex_unlock(&heartbeat_mutex);
+}
+
+/// @brief Ends the game of this client: the client exits, unless it is a warm AI
+/// client, which returns from its game to the pool (see wait_game_semaphore)
+void end_game(int status)
+{
+    if (pool_cell != NO_POOL_CELL) {
+        pool_game_over = true;
+        return;
+    }
+
+    exit(status);
+}
 
-    // After the initialization, the client is ready to play
-    notify_player_ready();
+/// @brief Plays a game, until the server wakes up this player with the result
+/// (in a rematch session; otherwise, the client exits on the result signal)
+void play_game()
+{
+    recorded_marks = 0;
 
-    // Wait for the opponent to be ready
-    wait_for_opponent();
+    if (engine_command != NULL)
+        new_engine_game();
 
-    if (player_index != INITIAL_TURN) {
+    if (player_index != game->first_turn) {
         print_move_screen();
-        printf(OPPONENT_TURN_MESSAGE, game->usernames[player_index == PLAYER_ONE ? PLAYER_TWO : PLAYER_ONE]);
+        printf(OPPONENT_TURN_MESSAGE, get_player_username(lobby, game, player_index == PLAYER_ONE ? PLAYER_TWO : PLAYER_ONE));
         print_and_flush(HIDE_CARET);
     }
 
@@ -127,32 +495,210 @@ int main(int argc, char* argv[])
         first_CTRLC_pressed = false;
 
         wait_for_move();
+        if (pool_game_over)
+            return;
+
         print_and_flush(SHOW_CARET);
+        record_moves();
+
+        if (game->result != NOT_FINISHED)
+            return;
+
+        waiting_for_rematch = false;
 
         // Prints before the move
         print_move_screen();
 
-        // If user is ``human'' ask for input
-        if (autoplay == NONE || active_player)
+        // If user is ``human'' ask for input (or the engine, which plays for it)
+        if (engine_command != NULL && (autoplay == NONE || active_player))
+            ask_engine_move();
+        else if (autoplay == NONE || active_player)
             ask_for_input();
         else // Otherwise, choose the next move
             chooseNextMove(game->matrix, autoplay, player_index, cycles);
 
-        stop_timeout_print(timeout_tid);
         notify_move();
 
         // Prints after the move
         print_move_screen();
 
-        printf(OPPONENT_TURN_MESSAGE, game->usernames[player_index == PLAYER_ONE ? PLAYER_TWO : PLAYER_ONE]);
+        printf(OPPONENT_TURN_MESSAGE, get_player_username(lobby, game, player_index == PLAYER_ONE ? PLAYER_TWO : PLAYER_ONE));
 
         set_input(&without_echo);
         print_and_flush(HIDE_CARET);
-
-        stop_timeout_print(timeout_tid);
     } while (1);
+}
 
-    return EXIT_SUCCESS;
+/// @brief Watches a game as a spectator: the board is drawn again whenever the
+/// server publishes a new snapshot. A spectator takes no slot and no semaphore,
+/// and never writes to the shared memory
+void watch_game()
+{
+    print_header_client();
+    printf(CREDITS);
+    print_loading_message();
+
+    init_shared_memory();
+    init_terminal_settings();
+
+    if (signal(SIGINT, spectator_quit_handler) == SIG_ERR
+        || signal(SIGTERM, spectator_quit_handler) == SIG_ERR
+        || signal(SIGHUP, spectator_quit_handler) == SIG_ERR)
+        errexit(INITIALIZATION_ERROR);
+
+    print_loading_complete_message();
+
+    tris_snapshot_t snapshot;
+    int seen = -1;
+
+    while (1) {
+        int sequence = read_snapshot(game, &snapshot);
+        if (sequence != seen) {
+            print_snapshot(&snapshot);
+            seen = sequence;
+        }
+
+        // The timeout tells if the server is gone
+        struct timespec poll = { 0, HEARTBEAT_INTERVAL_MS * 1000000L };
+        futex_wait(&game->snapshot.sequence, sequence, &poll);
+
+        if (kill(lobby->server_pid, 0) < 0 && errno == ESRCH)
+            server_quit_handler(0);
+    }
+}
+
+/// @brief Prints the game as seen by a spectator
+void print_snapshot(tris_snapshot_t* snapshot)
+{
+    // A spectator may quit while the frame is drawn
+    sigset_t all, old_set;
+    sigfillset(&all);
+    sigprocmask(SIG_BLOCK, &all, &old_set);
+
+    FILE* frame = begin_frame();
+    print_art_client(frame);
+    fprintf(frame, SPECTATOR_HEADER_MESSAGE, watch_slot);
+
+    const char* usernames[] = { "", get_username(lobby, snapshot->user_ids[PLAYER_ONE]),
+        get_username(lobby, snapshot->user_ids[PLAYER_TWO]) };
+    bool waiting = snapshot->turn == 0 && snapshot->result == NOT_FINISHED;
+
+    if (!waiting)
+        fprintf(frame, SPECTATOR_PLAYERS_MESSAGE, usernames[PLAYER_ONE], game->symbols[0], usernames[PLAYER_TWO], game->symbols[1]);
+
+    print_board(frame, snapshot->matrix, game->symbols[0], game->symbols[1]);
+
+    switch (snapshot->result) {
+    case NOT_FINISHED:
+        if (waiting)
+            fprintf(frame, SPECTATOR_WAITING_MESSAGE);
+        else
+            fprintf(frame, SPECTATOR_TURN_MESSAGE, usernames[snapshot->turn]);
+        break;
+    case DRAW:
+        fprintf(frame, DRAW_MESSAGE);
+        break;
+    case PLAYER_ONE_WIN:
+    case PLAYER_TWO_WIN:
+        fprintf(frame, WINS_PLAYER_MESSAGE, snapshot->result == PLAYER_ONE ? PLAYER_ONE_COLOR : PLAYER_TWO_COLOR,
+            snapshot->result, usernames[snapshot->result]);
+        break;
+    default:
+        fprintf(frame, SPECTATOR_QUIT_MESSAGE);
+    }
+
+    end_frame();
+    print_and_flush(HIDE_CARET);
+
+    sigprocmask(SIG_SETMASK, &old_set, NULL);
+}
+
+/// @brief Handles the exit of a spectator, who has nothing to tell the server
+void spectator_quit_handler(int sig)
+{
+    print_and_flush(CLOSING_MESSAGE);
+    exit(EXIT_SUCCESS);
+}
+
+/// @brief Parse the options passed to the client
+/// @param argc The number of arguments
+/// @param argv The arguments
+/// @return The index of the first positional argument
+int parse_options(int argc, char* argv[])
+{
+    static struct option options[] = {
+        // Used by the server to start the AI in a given slot
+        { "slot", required_argument, NULL, 's' },
+        { "shard", required_argument, NULL, 'd' },
+        { "pool", required_argument, NULL, 'p' },
+        { "watch", required_argument, NULL, 'w' },
+        { "headless", no_argument, NULL, 'h' },
+        { "events", required_argument, NULL, 'e' },
+        { "engine", required_argument, NULL, 'E' },
+        { "games", required_argument, NULL, 'g' },
+        { "resume", required_argument, NULL, 'R' },
+        { NULL, 0, NULL, 0 }
+    };
+
+    bool headless = false;
+    const char* events_path = NULL;
+    char* str_ptr;
+    int opt;
+
+    // Errors are reported with the usage message
+    opterr = 0;
+
+    while ((opt = getopt_long(argc, argv, "", options, NULL)) != -1) {
+        switch (opt) {
+        case 's':
+            slot_handle = strtoull(optarg, &str_ptr, 10);
+            if (*str_ptr != '\0')
+                errexit(STALE_HANDLE_ERROR);
+            break;
+        case 'd':
+            shard = strtol(optarg, &str_ptr, 10);
+            if (*str_ptr != '\0' || shard < 0 || shard >= MAX_SHARDS)
+                errexit(SHARD_INVALID_ERROR);
+            break;
+        case 'p':
+            pool_cell = strtol(optarg, &str_ptr, 10);
+            if (*str_ptr != '\0' || pool_cell < 0 || pool_cell >= MAX_AI_POOL)
+                errexit(INITIALIZATION_ERROR);
+            break;
+        case 'w':
+            watch_slot = strtol(optarg, &str_ptr, 10);
+            if (*str_ptr != '\0' || watch_slot < 0)
+                errexit(WATCH_INVALID_ERROR);
+            break;
+        case 'h':
+            headless = true;
+            break;
+        case 'e':
+            headless = true;
+            events_path = optarg;
+            break;
+        case 'E':
+            engine_command = optarg;
+            break;
+        case 'g':
+            bot_games = strtol(optarg, &str_ptr, 10);
+            if (*str_ptr != '\0' || bot_games < 1 || bot_games > MAX_BOT_GAMES)
+                errexit(BOT_GAMES_INVALID_ERROR);
+            break;
+        case 'R':
+            resume_token = optarg;
+            break;
+        default:
+            printf(USAGE_ERROR_CLIENT, argv[0]);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    // From here on, the errors are events too
+    if (headless)
+        open_events(events_path);
+
+    return optind;
 }
 
 /// @brief Initializes the client
@@ -162,67 +708,196 @@ void init()
     print_welcome_message_client(username);
     print_loading_message();
 
+    // The engine is ready before the player takes a game
+    if (engine_command != NULL)
+        init_engine();
+
     // Initialize IPCs and terminal settings
     init_shared_memory();
+    init_heartbeat();
     init_semaphores();
     init_signals();
+    init_input();
     init_terminal_settings();
+    emit_join(get_game_index(lobby, game), player_index, username);
 
     // Set the seed for the random number generator (used by the AI)
     srand(time(NULL));
 
     // Print the loading complete message
     print_loading_complete_message();
+    print_resume_token();
 }
 
-/// @brief Initializes the shared memory
-void init_shared_memory()
+/// @brief Attaches the shared memory of the server
+void attach_lobby()
 {
-    // Get the shared memory without creating it
-    game_id = get_shared_memory(GAME_SIZE, GAME_ID);
+    // Pick the least loaded server, unless a shard was given
+    if (shard == NO_SHARD) {
+        tris_directory_t* directory = open_directory(false);
+        if (directory == NULL)
+            errexit(NO_SERVER_FOUND_ERROR);
+
+        shard = find_least_loaded_shard(directory);
+        close_directory(directory);
+
+        if (shard == NO_SHARD)
+            errexit(NO_SERVER_FOUND_ERROR);
+    }
+
+    set_shared_memory_shard(shard);
+
+    // A spectator cannot write to the lobby it watches
+    if (watch_slot != NO_WATCH)
+        set_shared_memory_read_only();
+
+    // Get the shared memory without creating it, whatever backend the server uses
+    lobby_id = find_shared_memory(LOBBY_HEADER_SIZE, SHARD_KEY(GAME_ID, shard));
 
     // If the shared memory getter returns -1, then no server is running
-    if (game_id < 0)
+    if (lobby_id < 0)
         errexit(NO_SERVER_FOUND_ERROR);
 
     // Otherwise, attach the shared memory
-    game = (tris_game_t*)attach_shared_memory(game_id);
+    lobby = (tris_lobby_t*)attach_shared_memory(lobby_id);
 
 #if DEBUG
-    printf(SHARED_MEMORY_OBTAINED_SUCCESS, game_id);
+    printf(SHARED_MEMORY_OBTAINED_SUCCESS, lobby_id);
 #endif
 
-    // Join the game by setting the player PID and username
-    if ((player_index = record_join(game, username, autoplay)) == TOO_MANY_PLAYERS_ERROR_CODE)
+    // Register the dispose_memory function to be called at exit
+    if (atexit(dispose_memory))
+        errexit(INITIALIZATION_ERROR);
+}
+
+/// @brief Initializes the shared memory
+void init_shared_memory()
+{
+    attach_lobby();
+
+    // A spectator only reads the game in a slot; a player joins a game of the
+    // lobby (or the one given by the server) by setting its PID and username
+    if (watch_slot != NO_WATCH) {
+        if (watch_slot >= lobby->n_slots)
+            errexit(WATCH_INVALID_ERROR);
+        game = get_game_at(lobby, watch_slot);
+    } else if (slot_handle != NO_HANDLE)
+        game = join_game(lobby, slot_handle, username, &player_index);
+    else
+        game = find_game();
+
+    // A spectator has no player index
+    if (watch_slot != NO_WATCH)
+        player_index = SERVER;
+
+    if (player_index == TOO_MANY_PLAYERS_ERROR_CODE)
         errexit(TOO_MANY_PLAYERS_ERROR);
     else if (player_index == SAME_USERNAME_ERROR_CODE)
         errexit(SAME_USERNAME_ERROR);
     else if (player_index == AUTOPLAY_NOT_ALLOWED_ERROR_CODE)
         errexit(AUTOPLAY_NOT_ALLOWED_ERROR);
+    else if (player_index == STALE_HANDLE_ERROR_CODE)
+        errexit(STALE_HANDLE_ERROR);
+    else if (player_index == QUEUE_FULL_ERROR_CODE)
+        errexit(QUEUE_FULL_ERROR);
 
     // Set the local autoplay flag
     autoplay = game->autoplay;
+    generation = atomic_load(&game->generation);
 
 #if DEBUG
-    printf(SERVER_FOUND_SUCCESS, game->pids[SERVER]);
+    printf(SERVER_FOUND_SUCCESS, lobby->server_pid);
 #endif
+}
 
-    // Register the dispose_memory function to be called at exit
-    if (atexit(dispose_memory))
-        errexit(INITIALIZATION_ERROR);
+/// @brief Asks the matcher of the server for a game, and waits in the queue until
+/// the player is placed in one. The signals stay blocked, as in join_game, and
+/// are only looked for while waiting: the player can leave the queue at any time
+/// @return The game, or NULL on error (stored in player_index)
+tris_game_t* find_game()
+{
+    sigset_t mask, pending;
+    sigfillset(&mask);
+    sigprocmask(SIG_BLOCK, &mask, NULL);
+
+    // The server needs the path of the client to start the AI
+    if (autoplay != NONE)
+        publish_client_path(lobby);
+
+    uint64_t ticket = enqueue_join_request(lobby, username, autoplay);
+    if (ticket == NO_TICKET) {
+        player_index = QUEUE_FULL_ERROR_CODE;
+        return NULL;
+    }
+
+    uint64_t handle = NO_HANDLE;
+    bool queued = false;
+
+    while ((player_index = wait_for_match(lobby, ticket, &handle)) == MATCH_PENDING_CODE) {
+        // Not placed right away: every game is in use
+        if (!queued) {
+            print_and_flush(WAITING_IN_QUEUE_MESSAGE);
+            start_loading_spinner();
+            queued = true;
+        }
+
+        sigpending(&pending);
+        if (sigismember(&pending, SIGINT) || sigismember(&pending, SIGTERM) || sigismember(&pending, SIGHUP)) {
+            stop_loading_spinner();
+            leave_queue(ticket);
+            print_and_flush(CLOSING_MESSAGE);
+            exit(EXIT_SUCCESS);
+        }
+
+        if (kill(lobby->server_pid, 0) < 0 && errno == ESRCH) {
+            stop_loading_spinner();
+            leave_queue(ticket);
+            errexit(NO_SERVER_FOUND_ERROR);
+        }
+    }
+
+    if (queued) {
+        stop_loading_spinner();
+        print_and_flush(NEWLINE);
+    }
+
+    if (player_index < 0)
+        return NULL;
+
+    tris_game_t* placed = get_game_by_handle(lobby, handle);
+    if (placed == NULL)
+        player_index = STALE_HANDLE_ERROR_CODE;
+
+    return placed;
+}
+
+/// @brief Withdraws the request of the player from the queue, leaving the game
+/// the player has been placed in if the matcher was faster
+void leave_queue(uint64_t ticket)
+{
+    uint64_t handle;
+
+    if (cancel_join_request(lobby, ticket))
+        return;
+
+    int index = wait_for_match(lobby, ticket, &handle);
+    tris_game_t* placed = index >= 0 ? get_game_by_handle(lobby, handle) : NULL;
+
+    if (placed != NULL)
+        request_quit(lobby, placed, index);
 }
 
 /// @brief Disposes the shared memory
 void dispose_memory()
 {
-    detach_shared_memory(game);
+    detach_shared_memory(lobby);
 }
 
 /// @brief Initializes the semaphores
 void init_semaphores()
 {
-    // Get the semaphores
-    sem_id = get_semaphores(N_SEM);
+    // Get the semaphores published by the server
+    sem_id = game->sem_id;
 }
 
 /// @brief Initializes the signals
@@ -242,14 +917,111 @@ void init_signals()
     if (signal(SIGINT, exit_handler) == SIG_ERR
         || signal(SIGUSR1, server_quit_handler) == SIG_ERR
         || signal(SIGUSR2, check_results) == SIG_ERR
-        || signal(SIGHUP, quit_handler) == SIG_ERR
-        || signal(SIGTERM, exit_handler) == SIG_ERR)
+        || signal(SIGHUP, hangup_handler) == SIG_ERR
+        || signal(SIGTERM, exit_handler) == SIG_ERR
+        || signal(SIGALRM, timeout_handler) == SIG_ERR)
+        errexit(INITIALIZATION_ERROR);
+}
+
+/// @brief Initializes the descriptors waited for with stdin while asking for a
+/// move: the timer of the timeout, and the signals that can end the turn (only
+/// read from their descriptor while they are blocked, that is while asking)
+void init_input()
+{
+    sigemptyset(&notifications);
+    sigaddset(&notifications, SIGINT);
+    sigaddset(&notifications, SIGUSR1);
+    sigaddset(&notifications, SIGUSR2);
+    sigaddset(&notifications, SIGHUP);
+    sigaddset(&notifications, SIGTERM);
+    sigaddset(&notifications, SIGALRM);
+
+    if ((notification_fd = signalfd(-1, &notifications, SFD_NONBLOCK | SFD_CLOEXEC)) < 0
+        || (timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC)) < 0)
+        errexit(INITIALIZATION_ERROR);
+}
+
+/// @brief Initializes the signals of the games of a warm AI client. They stay
+/// blocked, and are read from their descriptor between two waits (see
+/// wait_game_semaphore): a game always ends by returning to the pool, never from
+/// inside a handler. The other signals are looked for between two games
+void init_pool_signals()
+{
+    sigemptyset(&notifications);
+    sigaddset(&notifications, SIGUSR1);
+    sigaddset(&notifications, SIGUSR2);
+    sigaddset(&notifications, SIGALRM);
+
+    if (signal(SIGUSR1, server_quit_handler) == SIG_ERR
+        || signal(SIGUSR2, check_results) == SIG_ERR
+        || signal(SIGALRM, timeout_handler) == SIG_ERR
+        || (notification_fd = signalfd(-1, &notifications, SFD_NONBLOCK | SFD_CLOEXEC)) < 0)
         errexit(INITIALIZATION_ERROR);
 }
 
+/// @brief Starts the external engine, which is stopped at exit
+void init_engine()
+{
+    start_engine(engine_command);
+
+    if (atexit(stop_engine))
+        errexit(INITIALIZATION_ERROR);
+}
+
+/// @brief Starts publishing the heartbeats, so that the server can tell if this
+/// client is still alive
+void init_heartbeat()
+{
+    // Signals are still blocked after the join, so the thread never handles them
+    if (pthread_create(&heartbeat_tid, NULL, heartbeat_handler, NULL) != 0)
+        errexit(INITIALIZATION_ERROR);
+
+    // Registered after dispose_memory, so that the thread stops before the detach
+    if (atexit(stop_heartbeat))
+        errexit(INITIALIZATION_ERROR);
+}
+
+/// @brief Wake up the heartbeat thread and wait for it to stop
+void stop_heartbeat()
+{
+    pthread_mutex_lock(&heartbeat_mutex);
+    heartbeat_stopped = true;
+    pthread_cond_signal(&heartbeat_cond);
+    pthread_mutex_unlock(&heartbeat_mutex);
+
+    pthread_join(heartbeat_tid, NULL);
+}
+
+/// @brief Thread that periodically publishes the heartbeat of the player
+void* heartbeat_handler(void* arg)
+{
+    pthread_mutex_lock(&heartbeat_mutex);
+
+    while (!heartbeat_stopped) {
+        // Once the game is over, the slot belongs to another game (a warm AI
+        // client has no game between two)
+        if (game != NULL && !is_game_recycled())
+            atomic_store_explicit(&game->players[player_index].heartbeat, monotonic_ms(), memory_order_relaxed);
+
+        struct timespec deadline;
+        deadline_after_ms(&deadline, HEARTBEAT_INTERVAL_MS);
+
+        while (!heartbeat_stopped && pthread_cond_timedwait(&heartbeat_cond, &heartbeat_mutex, &deadline) == 0)
+            ;
+    }
+
+    pthread_mutex_unlock(&heartbeat_mutex);
+
+    return NULL;
+}
+
 /// @brief Initializes the terminal settings
 void init_terminal_settings()
 {
+    // Without a terminal, there is nothing to set
+    if (is_headless())
+        return;
+
 #if PRETTY
     // Initialize the terminal settings: if possible, set the terminal to raw mode
     if ((output_customizable = init_output_settings(&with_echo, &without_echo))) {
@@ -262,6 +1034,14 @@ void init_terminal_settings()
         }
     }
 #endif
+
+#if DEBUG
+    // Register the print_render_stats function to be called at exit
+    if (atexit(print_render_stats)) {
+        print_error(INITIALIZATION_ERROR);
+        exit(EXIT_FAILURE);
+    }
+#endif
 }
 
 /// @brief Sets the terminal to show the input
@@ -282,8 +1062,12 @@ void show_input()
 /// @brief Notifies the server that the player is ready
 void notify_player_ready()
 {
+    // The first game of the slot, or the next one once the result has been read
+    int round = atomic_load(&game->round);
+    atomic_store(&game->players[player_index].ready_round, game->result == NOT_FINISHED ? round : round + 1);
+
     // Tell the server a user arrived
-    signal_semaphore(sem_id, WAIT_FOR_PLAYERS, 1);
+    notify_session(lobby, game);
 }
 
 /// @brief Notifies the server that the player made a move
@@ -291,38 +1075,62 @@ void notify_move()
 {
     // Tell the server a user made a move
     cycles++;
-    signal_semaphore(sem_id, WAIT_FOR_MOVE, 1);
+    notify_session(lobby, game);
+    record_moves();
 }
 
-/// @brief Waits for the opponent to be ready
-void wait_for_opponent()
+/// @brief Record the moves on the board since the last look at it, as events:
+/// the opponent's, once woken up, and the player's own, once made
+void record_moves()
 {
-    // If the game is in autoplay mode, the opponent "always" is ready
-    if (autoplay != NONE)
+    if (!is_headless())
         return;
 
-    // Show the waiting message
-    print_and_flush(game->usernames[player_index - 1]);
-    print_and_flush(WAITING_FOR_OPPONENT_MESSAGE);
-    print_and_flush(HIDE_CARET);
-    start_loading_spinner(&spinner_tid);
+    for (int i = 0; i < MATRIX_SIZE; i++) {
+        if (game->matrix[i] == 0 || (recorded_marks & (1u << i)))
+            continue;
+
+        recorded_marks |= 1u << i;
+        emit_move(get_game_index(lobby, game), game->matrix[i], i);
+    }
+}
+
+/// @brief Waits for the opponent to be ready
+void wait_for_opponent()
+{
+    // If the game is in autoplay mode, the opponent "always" is ready: the
+    // wait is silent, it only tells that the game has started
+    if (autoplay == NONE) {
+        // Show the waiting message
+        print_and_flush(get_player_username(lobby, game, player_index - 1));
+        print_and_flush(WAITING_FOR_OPPONENT_MESSAGE);
+        print_and_flush(HIDE_CARET);
+        start_loading_spinner();
+    }
 
     // Wait for the opponent to be ready. If stopped by signal, retry
     do {
         errno = 0;
-        wait_semaphore(sem_id, WAIT_FOR_OPPONENT_READY, 1);
+        wait_game_semaphore(game->sem_base + WAIT_FOR_OPPONENT_READY);
 
         // If the semaphore is removed bofore starting the game
         // it means the server quitted, so the client exits too
         if (errno == EIDRM)
             server_quit_handler(0);
-    } while (errno == EINTR);
+    } while (errno == EINTR && !pool_game_over);
+
+    if (pool_game_over)
+        return;
+
+    started = true;
+
+    if (autoplay != NONE)
+        return;
 
     // When the opponent is ready, stop the spinner and print the message
-    stop_loading_spinner(&spinner_tid);
+    stop_loading_spinner();
     print_and_flush(OPPONENT_READY_MESSAGE);
     print_and_flush(SHOW_CARET);
-    started = true;
 }
 
 /// @brief Waits for the opponent to make a move
@@ -331,7 +1139,13 @@ void wait_for_move()
     // Wait for the opponent to make a move
     do {
         errno = 0;
-        wait_semaphore(sem_id, PLAYER_ONE_TURN + player_index - 1, 1);
+        wait_game_semaphore(game->sem_base + PLAYER_ONE_TURN + player_index - 1);
+        if (pool_game_over)
+            return;
+
+        // A game is never woken up by the next one in the same slot
+        if (is_game_recycled())
+            server_quit_handler(0);
 
         // If the semaphore is removed, could mean that the server quitted,
         // or that the game is finished and server got executed before the handler
@@ -342,35 +1156,76 @@ void wait_for_move()
             else
                 check_results(0);
         }
-    } while (errno == EINTR);
+    } while (errno == EINTR && !pool_game_over);
 
     // Flush the input buffer to prevent buffer overflow
     ignore_previous_input();
 }
 
-/// @brief Handles the timeout expiration
+/// @brief Waits on a semaphore of the game. A warm AI client keeps the signals
+/// of its game blocked: as a bot does, it only tries the semaphore, and waits on
+/// the snapshot of the game, which the server publishes after every change (the
+/// end of the game included). The signals are handled between two waits
+/// @param sem_num The semaphore, in the semaphore set of the server
+void wait_game_semaphore(int sem_num)
+{
+    if (pool_cell == NO_POOL_CELL) {
+        wait_semaphore(sem_id, sem_num, 1);
+        return;
+    }
+
+    while (1) {
+        int sequence = atomic_load(&game->snapshot.sequence);
+
+        if (try_wait_semaphore(sem_id, sem_num, 1)) {
+            errno = 0;
+            return;
+        }
+
+        if (errno == EIDRM || errno == EINVAL) {
+            errno = EIDRM;
+            return;
+        }
+
+        handle_notifications();
+        if (pool_game_over)
+            return;
+
+        // The timeout tells if the server is gone
+        struct timespec poll = { 0, HEARTBEAT_INTERVAL_MS * 1000000L };
+        futex_wait(&game->snapshot.sequence, sequence, &poll);
+
+        if (kill(lobby->server_pid, 0) < 0 && errno == ESRCH) {
+            server_quit_handler(0);
+            return;
+        }
+    }
+}
+
+/// @brief Handles the timeout expiration, of the client or of the clock kept by
+/// the server (which sends SIGALRM)
 void timeout_handler(int sig)
 {
     // If the timeout expires, the player loses. This is achieved by simulating a quit signal
     print_move_screen();
     printf(TIMEOUT_LOSS_MESSAGE);
     quit_handler(sig);
-    exit(EXIT_FAILURE);
+    end_game(EXIT_FAILURE);
 }
 
-/// @brief Initializes the timeout based on the game settings
+/// @brief Initializes the timeout based on the game settings: the timer ticks
+/// every second, for the countdown
 void init_timeout()
 {
     // If the timeout is set to 0, do nothing
     if (game->timeout == 0)
         return;
 
-    // Set the timeout handler
-    alarm(game->timeout);
-    signal(SIGALRM, timeout_handler);
+    timeout_left = game->timeout;
+    show_countdown(timeout_left, game->timeout);
 
-    // Start the timeout print
-    start_timeout_print(&timeout_tid, &game->timeout);
+    struct itimerspec spec = { { 1, 0 }, { 1, 0 } };
+    timerfd_settime(timer_fd, 0, &spec, NULL);
 }
 
 /// @brief Stops the timeout
@@ -380,8 +1235,8 @@ void reset_timeout()
     if (game->timeout == 0)
         return;
 
-    // Reset the timeout
-    alarm(0);
+    struct itimerspec spec = { { 0, 0 }, { 0, 0 } };
+    timerfd_settime(timer_fd, 0, &spec, NULL);
 }
 
 /// @brief Asks the player for a move
@@ -397,17 +1252,17 @@ void ask_for_input()
     print_spaces((digits(game->timeout) + 2) * (game->timeout != 0));
 #endif
 
-    printf(INPUT_A_MOVE_MESSAGE);
+    print_and_flush(INPUT_A_MOVE_MESSAGE);
+
+    // The signals are read from their descriptor until the move is made
+    sigset_t old_set;
+    sigprocmask(SIG_BLOCK, &notifications, &old_set);
 
     // Initialize the timeout
     init_timeout();
 
     // Read the move (only the first characters are considered)
-    if (scanf("%" STR(MOVE_INPUT_LEN) "s", input) == EOF) {
-        quit_handler(0);
-        print_and_flush(NEWLINE);
-        errexit(EOF_ERROR);
-    }
+    read_move(input);
     ignore_previous_input();
 
     move_t move;
@@ -422,13 +1277,12 @@ void ask_for_input()
 #endif
 
         print_error(INVALID_MOVE_ERROR);
-        
+
+        // The errors pile up below the board: the next frame is drawn as a whole
+        invalidate_frame();
+
         ignore_previous_input();
-        if (scanf("%" STR(MOVE_INPUT_LEN) "s", input) == EOF) {
-            quit_handler(0);
-            print_and_flush(NEWLINE);
-            errexit(EOF_ERROR);
-        }
+        read_move(input);
     }
 
     ignore_previous_input();
@@ -438,26 +1292,165 @@ void ask_for_input()
 
     // Reset the timeout after move is made
     reset_timeout();
+    sigprocmask(SIG_SETMASK, &old_set, NULL);
+}
+
+/// @brief Asks the external engine for the move of the player. An engine that
+/// gives no valid move in time makes the player quit
+void ask_engine_move()
+{
+    // With the clocks of the server, the engine spends the share of the time left
+    // to the player; otherwise it is given a fixed time, within the timeout
+    long long movetime = get_move_budget(game, player_index);
+    if (game->clock_ms == 0 && movetime > ENGINE_MOVETIME_MS)
+        movetime = ENGINE_MOVETIME_MS;
+
+    int cell = ask_engine(game->matrix, player_index, movetime > 1 ? (int)movetime : 1);
+    if (cell < 0) {
+        quit_handler(0);
+        errexit(ENGINE_MOVE_ERROR);
+    }
+
+    game->matrix[cell] = player_index;
+}
+
+/// @brief Waits for the next word typed by the player, as scanf would read it.
+/// Whichever comes first is handled right away: some input, a second of the
+/// timeout, or a signal (the server ending the game, or the player quitting)
+/// @param input Where to store the word, of at most MOVE_INPUT_LEN characters
+void read_move(char* input)
+{
+    while (!take_word(input)) {
+        if (input_closed) {
+            quit_handler(0);
+            print_and_flush(NEWLINE);
+            errexit(EOF_ERROR);
+        }
+
+        struct pollfd fds[] = {
+            { .fd = STDIN_FILENO, .events = POLLIN },
+            { .fd = timer_fd, .events = POLLIN },
+            { .fd = notification_fd, .events = POLLIN },
+        };
+
+        if (poll(fds, 3, -1) < 0)
+            continue;
+
+        if (fds[2].revents & POLLIN)
+            handle_notifications();
+        if (fds[1].revents & POLLIN)
+            handle_tick();
+        if (fds[0].revents & (POLLIN | POLLHUP))
+            fill_input();
+    }
+}
+
+/// @brief Takes the next word out of the input buffer, skipping the blanks
+/// before it. A word is whole once followed by a blank, at the end of the input,
+/// or when it is as long as the longest move read
+/// @return False if no whole word has been typed yet
+bool take_word(char* input)
+{
+    int start = 0;
+    while (start < input_len && isspace((unsigned char)input_buffer[start]))
+        start++;
+
+    int end = start;
+    while (end < input_len && end - start < MOVE_INPUT_LEN && !isspace((unsigned char)input_buffer[end]))
+        end++;
+
+    bool whole = end < input_len || end - start == MOVE_INPUT_LEN || (input_closed && end > start);
+    if (!whole)
+        end = start;
+    else {
+        memcpy(input, input_buffer + start, end - start);
+        input[end - start] = '\0';
+    }
+
+    // The blanks (and the word) are dropped, the rest is kept for the next moves
+    input_len -= end;
+    memmove(input_buffer, input_buffer + end, input_len);
+
+    return whole;
+}
+
+/// @brief Reads what is available on stdin into the input buffer
+void fill_input()
+{
+    ssize_t n = read(STDIN_FILENO, input_buffer + input_len, sizeof(input_buffer) - input_len);
+
+    if (n == 0)
+        input_closed = true;
+    else if (n > 0)
+        input_len += n;
+}
+
+/// @brief Counts down the seconds of the timeout: when it expires, the player loses
+void handle_tick()
+{
+    uint64_t ticks;
+    if (read(timer_fd, &ticks, sizeof(ticks)) != sizeof(ticks))
+        return;
+
+    timeout_left -= ticks;
+    if (timeout_left <= 0)
+        timeout_handler(SIGALRM);
+
+    show_countdown(timeout_left, game->timeout);
 }
 
-/// @brief Prints the board before and after a move
+/// @brief Handles the signals received while asking for a move, with the handlers
+/// registered for them: they run as any other function, not as signal handlers
+void handle_notifications()
+{
+    struct signalfd_siginfo info;
+
+    while (!pool_game_over && read(notification_fd, &info, sizeof(info)) == sizeof(info)) {
+        struct sigaction action;
+        sigaction(info.ssi_signo, NULL, &action);
+
+        if (action.sa_handler != SIG_DFL && action.sa_handler != SIG_IGN)
+            action.sa_handler(info.ssi_signo);
+    }
+}
+
+/// @brief Prints the board before and after a move, as a frame: only what
+/// changed since the last one is drawn again
 void print_move_screen()
 {
-    clear_screen_client();
+    if (is_headless())
+        return;
+
+    // The handlers of the signals draw the last frame: none runs while this
+    // one is drawn, with its stream still open
+    sigset_t all, old_set;
+    sigfillset(&all);
+    sigprocmask(SIG_BLOCK, &all, &old_set);
+
+    FILE* frame = begin_frame();
+    print_art_client(frame);
 
     // Print the game symbols
-    print_symbol(game->symbols[player_index - 1], player_index, username);
+    print_symbol(frame, game->symbols[player_index - 1], player_index, username);
 
     // Print the timeout
-    print_timeout(game->timeout);
+    print_timeout(frame, game->timeout);
 
     // Print the board
-    print_board(game->matrix, game->symbols[0], game->symbols[1]);
+    print_board(frame, game->matrix, game->symbols[0], game->symbols[1]);
+    end_frame();
+
+    sigprocmask(SIG_SETMASK, &old_set, NULL);
 }
 
-/// @brief Checks the results of the game
-void check_results(int sig)
+/// @brief Prints the result of the game
+void print_results()
 {
+    record_moves();
+
+    int winner = game->result == QUIT ? player_index : game->result;
+    emit_result(get_game_index(lobby, game), game->result, winner == DRAW ? 0 : winner);
+
     print_move_screen();
 
     // Check the result of the game
@@ -469,8 +1462,19 @@ void check_results(int sig)
         print_and_flush(YOU_LOST_MESSAGE);
     else
         print_and_flush(YOU_WON_MESSAGE);
+}
 
-    exit(EXIT_SUCCESS);
+/// @brief Checks the results of the game
+void check_results(int sig)
+{
+    print_results();
+
+    // Leave the slot, so that the lobby can give it to another game
+    // (a single game server does not wait for it)
+    if (lobby->n_slots > 1 && !is_game_recycled())
+        request_quit(lobby, game, player_index);
+
+    end_game(EXIT_SUCCESS);
 }
 
 /// @brief Handles the player controlled exit
@@ -480,12 +1484,12 @@ void exit_handler(int sig)
         return;
 
     if (!started)
-        stop_loading_spinner(&spinner_tid);
+        stop_loading_spinner();
 
-    // If the user presses CTRL+C twice, the client exits
-    if (first_CTRLC_pressed) {
-        if (active_player || autoplay == NONE)
-            kill(game->pids[SERVER], player_index == 1 ? SIGUSR1 : SIGUSR2);
+    // If the user presses CTRL+C twice (once, without a terminal), the client exits
+    if (first_CTRLC_pressed || is_headless()) {
+        emit_quit(get_game_index(lobby, game), player_index, EVENT_REASON_QUIT);
+        notify_quit();
 
         print_and_flush(CLOSING_MESSAGE);
         exit(EXIT_SUCCESS);
@@ -503,16 +1507,56 @@ void exit_handler(int sig)
 /// @brief Handles the player sudden quit
 void quit_handler(int sig)
 {
+    emit_quit(get_game_index(lobby, game), player_index, sig == SIGALRM ? EVENT_REASON_TIMEOUT : EVENT_REASON_QUIT);
+
     // Tell the server that the user quit
-    if (active_player || autoplay == NONE)
-        kill(game->pids[SERVER], player_index == 1 ? SIGUSR1 : SIGUSR2);
+    notify_quit();
+}
+
+/// @brief Handles the loss of the terminal. During a game, the slot of a human
+/// player is kept by the server: the player resumes the game with its token
+void hangup_handler(int sig)
+{
+    if (started && (autoplay == NONE || active_player) && lobby->resume_grace > 0
+        && game->players[player_index].token != NO_TOKEN && !is_game_recycled()) {
+        request_detach(lobby, game, player_index);
+        exit(EXIT_SUCCESS);
+    }
+
+    quit_handler(sig);
+}
+
+/// @brief Tell the server that this player quitted, through its slot
+void notify_quit()
+{
+    if ((active_player || autoplay == NONE) && !is_game_recycled())
+        request_quit(lobby, game, player_index);
+}
+
+/// @brief Check if the slot of this game has been given to another game
+bool is_game_recycled()
+{
+    return atomic_load(&game->generation) != generation;
 }
 
 /// @brief Handles the server quit
 void server_quit_handler(int sig)
 {
+    stop_loading_spinner();
+
+    // Between two games of a rematch session, the opponent left (its slot is
+    // already free, unlike when the server quits): the session ends
+    int opponent = PLAYER_ONE + PLAYER_TWO - player_index;
+    if (waiting_for_rematch && atomic_load(&game->players[opponent].state) != SLOT_READY) {
+        emit_quit(get_game_index(lobby, game), opponent, EVENT_REASON_LEFT);
+        print_and_flush(OPPONENT_LEFT_SESSION_MESSAGE);
+        notify_quit();
+        end_game(EXIT_SUCCESS);
+        return;
+    }
+
     // If the server quits, the client displays a message and exits
-    stop_loading_spinner(&spinner_tid);
+    emit_quit(get_game_index(lobby, game), SERVER, EVENT_REASON_SERVER);
     print_and_flush(SERVER_QUIT_MESSAGE);
-    exit(EXIT_FAILURE);
+    end_game(EXIT_FAILURE);
 }
\ No newline at end of file
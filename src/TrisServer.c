@@ -4,7 +4,14 @@
  * 09/05/2024
  ************************************/
 
+#define _GNU_SOURCE
+
 #include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <pthread.h>
+#include <getopt.h>
 #include <signal.h>
 #include <stdbool.h>
 #include <stdio.h>
@@ -13,131 +20,429 @@
 #include <unistd.h>
 #include <termios.h>
 #include <string.h>
+#include <sys/mman.h>
 
 #include "utils/data.h"
 #include "utils/globals.h"
+#include "utils/ai_pool/ai_pool.h"
+#include "utils/clocks/clocks.h"
+#include "utils/directory/directory.h"
+#include "utils/events/events.h"
+#include "utils/frontend/frontend.h"
+#include "utils/lobby/lobby.h"
+#include "utils/matchmaking/matchmaking.h"
+#include "utils/placement/placement.h"
+#include "utils/registry/registry.h"
+#include "utils/render/render.h"
+#include "utils/scheduler/scheduler.h"
 #include "utils/shared_memory/shared_memory.h"
 #include "utils/semaphores/semaphores.h"
 
-void parse_args(int, char*[]);
+// State of the game in a slot, as seen by the server (every field is hashed by
+// get_session_layout, for the upgrades)
+typedef struct {
+    tris_game_t* game;
+    int index;
+    int sem_base;
+    int turn;
+    int moves;
+    int players_count;
+    int round;
+    bool joined[PID_ARRAY_LEN];
+    bool detached[PID_ARRAY_LEN];
+    bool occupied;
+    bool ai_started;
+    bool started;
+    int phase;
+    int exit_status;
+    int node;
+    long long clock_left[PID_ARRAY_LEN];
+    long long turn_started_at;
+    int flagged;
+    unsigned marks;
+} session_t;
+
+// A thread running the sessions that have been woken up. When pinned, it counts
+// the sessions run on the node of their memory and those stolen from other nodes
+typedef struct {
+    work_deque_t deque;
+    int id;
+    pthread_t tid;
+    int cpu;
+    int node;
+    atomic_ullong local_runs;
+    atomic_ullong remote_runs;
+} worker_t;
+
+// State handed over to the new image of the server on an upgrade, followed by
+// the sessions, the requests held by the matcher and the players of the front-end
+typedef struct {
+    uint32_t magic;
+    uint32_t session_layout;
+    int n_slots;
+    int backend;
+    int lobby_id;
+    int handoff_socket;
+    int frontend_socket;
+    int sem_id;
+    int shard;
+    uint64_t open_handle;
+    int n_held;
+} upgrade_header_t;
+
+int parse_options(int, char*[]);
+void parse_args(char*[]);
 void init();
+void take_over_server();
+uint32_t get_session_layout();
 void init_terminal();
+void init_directory();
 void init_shared_memory();
 void init_semaphores();
 void init_signals();
-void wait_for_players();
+void init_reaper();
+void init_sessions();
+bool recover_session(session_t*);
+void dismiss_players(session_t*);
+void resume_sessions();
+void restart_sessions();
+void init_workers();
+void place_sessions();
+void init_ai_pool_workers();
+void start_ai_worker(int);
+void check_ai_pool();
+void* reaper_handler(void*);
+void* matcher_handler(void*);
+bool serve_ticket(uint64_t);
+void match_ticket(uint64_t, tris_ticket_t*);
+uint64_t find_ai_game(tris_ticket_t*, uint32_t, int*);
+uint64_t find_human_game(tris_ticket_t*, uint32_t, int*);
+tris_game_t* get_open_game(uint64_t);
+void reopen_game(session_t*);
+void* worker_handler(void*);
+int find_work(worker_t*);
+void run_task(worker_t*, int);
+void run_session(session_t*);
+void reset_session(session_t*);
+void give_back_slot(session_t*);
+void check_players(session_t*);
+void start_game(session_t*);
+void check_move(session_t*);
+void check_result(session_t*);
+void reset_move_clocks(session_t*);
+void run_move_clock(session_t*);
+void stop_move_clock(session_t*, long long);
+void publish_move_clock(session_t*, int, long long);
+long long get_move_time(session_t*, bool);
+bool is_out_of_time(session_t*, long long);
+int take_new_mark(session_t*);
+void flag_player(session_t*);
+void finish_game(session_t*, int);
+void wait_for_rematch(session_t*);
+void check_rematch(session_t*);
+void start_rematch(session_t*);
+void check_players_left(session_t*);
+void check_detached(session_t*);
+void release_detached(session_t*);
+void resume_turn(session_t*, int);
+const char* start_ai(session_t*);
+const char* exec_client(const char*, const char*, pid_t*);
+bool check_quits(session_t*);
+void free_player(session_t*, int);
 void dispose_memory();
 void dispose_semaphores();
-void notify_opponent_ready();
-void notify_player_who_won_for_quit(int);
-void notify_name_ended();
-void notify_server_quit();
+void dispose_directory();
+void stop_threads();
+void upgrade_server();
+int save_upgrade_state();
+void notify_player(session_t*, int, int);
+void notify_opponent_ready(session_t*);
+void notify_player_who_won_for_quit(session_t*, int);
+void notify_name_ended(session_t*);
+void notify_result(session_t*);
+void notify_server_quit(session_t*);
+void notify_spectators(session_t*);
 void exit_handler(int);
-void player_quit_handler(int);
-void wait_for_move();
-void notify_next_move();
+void print_waiting_for_move(session_t*);
+void print_move_received(session_t*);
+void notify_next_move(session_t*);
 void print_game_settings();
+void print_matchmaking_stats();
+void print_placement_stats();
 void quit_handler(int);
+void upgrade_handler(int);
 void show_input();
-void print_result();
+void print_result(session_t*);
+int count_moves(int*);
 
 // Shared memory
-tris_game_t* game = NULL;
-int game_id = -1;
+tris_lobby_t* lobby = NULL;
+int lobby_id = -1;
+
+// Shard of the IPC namespace owned by this server
+tris_directory_t* directory = NULL;
+int shard = NO_SHARD;
 
 // Semaphores
 int sem_id = -1;
 
+// Game settings, copied in every slot
+int timeout = 0;
+char symbols[SYMBOLS_ARRAY_LEN];
+
+// Move clocks kept by the server: the time of each player for a game, and the
+// time added after each move (no clocks if the time is 0)
+int clock_ms = 0;
+int clock_increment_ms = 0;
+
+// Rematch sessions: the players of a game play the next one in the same slot
+bool rematch = false;
+bool swap_turns = false;
+
+// Warm AI clients, waiting for the games against the AI
+int ai_pool_size = DEFAULT_AI_POOL;
+
+// Unix socket of the front-end, for the players outside the shared memory
+const char* socket_path = NULL;
+
+// Sessions, one per slot. The full output is kept only for a single game
+session_t* sessions = NULL;
+int recovered_sessions = 0;
+int n_slots = DEFAULT_LOBBY_SLOTS;
+bool single_game = true;
+atomic_bool closing = false;
+
+// Workers running the sessions, one per core
+worker_t* workers = NULL;
+int n_workers = 1;
+
+// Placement: the CPUs of the workers and of the AI clients (NULL lists if not
+// set), and the blocks of slots bound to the NUMA nodes of their workers
+const char* worker_cpus_list = NULL;
+const char* ai_cpus_list = NULL;
+cpu_set_t worker_cpus, ai_cpus;
+int bound_blocks = 0;
+int unbound_blocks = 0;
+
 // State variables
 bool first_CTRLC_pressed = false;
-bool started = false;
 
-int turn = INITIAL_TURN;
-int players_count = 0;
+// Recovery of the games of a crashed server, whose IPCs are taken over
+bool recovering = false;
+pid_t crashed_server_pid = 0;
+
+// Upgrade in place: the binary executed again (the path it had at startup) with
+// the same arguments, and the state handed over by the previous image, if any
+char server_path[PATH_MAX];
+char** server_argv = NULL;
+atomic_bool upgrade_requested = false;
+int upgrade_fd = NO_UPGRADE;
+bool upgraded = false;
 
 // Terminal settings
 struct termios with_echo, without_echo;
 bool output_customizable = true;
-pthread_t spinner_tid = 0;
 
-// TODO: handle if IPCs with the same key are already present
+// Liveness of the players
+int heartbeat_grace = DEFAULT_HEARTBEAT_GRACE_MS;
+int resume_grace = DEFAULT_RESUME_GRACE_MS;
+pthread_t reaper_tid = 0;
+pthread_mutex_t reaper_mutex = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t reaper_cond = PTHREAD_COND_INITIALIZER;
+
+// Matchmaking: the game of the human who is waiting for an opponent, and the
+// requests taken out of the queue that the matcher has not served yet
+pthread_t matcher_tid = 0;
+atomic_ullong open_handle = NO_HANDLE;
+uint64_t held_tickets[QUEUE_CAPACITY];
+int n_held = 0;
 
 int main(int argc, char* argv[])
 {
+    // Parse the options, which must be known before creating the IPCs
+    int first_arg = parse_options(argc, argv);
+
+    // An upgrade executes this binary again, even if it has been replaced since
+    ssize_t len = readlink(SELF_EXEC_PATH, server_path, sizeof(server_path) - 1);
+    server_path[len < 0 ? 0 : len] = '\0';
+    server_argv = argv;
+
     // Check arguments
-    if (argc != N_ARGS_SERVER + 1) {
+    if (argc - first_arg != N_ARGS_SERVER) {
         printf(USAGE_ERROR_SERVER, argv[0]);
         exit(EXIT_FAILURE);
     }
 
     // Initialization
     init();
-    parse_args(argc, argv);
+    parse_args(argv + first_arg);
 
     // Show game settings
     print_game_settings();
 
-    // Waiting for other players
-    wait_for_players();
+    // Open the slots to the players. The main thread is the first worker
+    init_sessions();
+    worker_handler(&workers[0]);
 
-    // If the server is here, it means that both players are connected...
-    notify_opponent_ready();
+    // Reached only while the server is exiting from another thread
+    pthread_exit(NULL);
+}
 
-    // ...and game can start
-    started = true;
-    printf(STARTS_PLAYER_MESSAGE,
-        INITIAL_TURN == PLAYER_ONE ? PLAYER_ONE_COLOR : PLAYER_TWO_COLOR, turn,
-        game->usernames[turn]);
+/// @brief Parse the options passed to the server
+/// @param argc The number of arguments
+/// @param argv The arguments
+/// @return The index of the first positional argument
+int parse_options(int argc, char* argv[])
+{
+    static struct option options[] = {
+        { "ipc", required_argument, NULL, 'i' },
+        { "huge-pages", no_argument, NULL, 'H' },
+        { "grace", required_argument, NULL, 'g' },
+        { "resume-grace", required_argument, NULL, 'R' },
+        { "lobby", required_argument, NULL, 'l' },
+        { "rematch", no_argument, NULL, 'r' },
+        { "swap", no_argument, NULL, 's' },
+        { "ai-pool", required_argument, NULL, 'a' },
+        { "socket", required_argument, NULL, 'S' },
+        { "cpus", required_argument, NULL, 'c' },
+        { "ai-cpus", required_argument, NULL, 'A' },
+        { "clock", required_argument, NULL, 'C' },
+        { "headless", no_argument, NULL, 'h' },
+        { "events", required_argument, NULL, 'e' },
+        { "upgrade", required_argument, NULL, 'U' },
+        { NULL, 0, NULL, 0 }
+    };
+
+    int backend = DEFAULT_IPC_BACKEND;
+    bool huge_pages = false;
+    bool headless = false;
+    const char* events_path = NULL;
+    char* str_ptr;
+    int opt;
+
+    // Errors are reported with the usage message
+    opterr = 0;
+
+    while ((opt = getopt_long(argc, argv, "", options, NULL)) != -1) {
+        switch (opt) {
+        case 'i':
+            if ((backend = parse_shared_memory_backend(optarg)) < 0)
+                errexit(IPC_BACKEND_INVALID_ERROR);
+            break;
+        case 'H':
+            huge_pages = true;
+            break;
+        case 'g':
+            heartbeat_grace = strtol(optarg, &str_ptr, 10);
+            if (*str_ptr != '\0' || heartbeat_grace < MINIMUM_HEARTBEAT_GRACE_MS)
+                errexit(HEARTBEAT_GRACE_INVALID_ERROR);
+            break;
+        case 'R':
+            resume_grace = strtol(optarg, &str_ptr, 10);
+            if (*str_ptr != '\0' || resume_grace < 0)
+                errexit(RESUME_GRACE_INVALID_ERROR);
+            break;
+        case 'l':
+            n_slots = strtol(optarg, &str_ptr, 10);
+            if (*str_ptr != '\0' || n_slots < 1 || n_slots > MAX_LOBBY_SLOTS)
+                errexit(LOBBY_SLOTS_INVALID_ERROR);
+            break;
+        case 'r':
+            rematch = true;
+            break;
+        case 's':
+            swap_turns = true;
+            break;
+        case 'a':
+            ai_pool_size = strtol(optarg, &str_ptr, 10);
+            if (*str_ptr != '\0' || ai_pool_size < 0 || ai_pool_size > MAX_AI_POOL)
+                errexit(AI_POOL_INVALID_ERROR);
+            break;
+        case 'S':
+            socket_path = optarg;
+            break;
+        case 'c':
+            if (parse_cpu_list(optarg, &worker_cpus) < 0)
+                errexit(CPU_LIST_INVALID_ERROR);
+            worker_cpus_list = optarg;
+            break;
+        case 'A':
+            if (parse_cpu_list(optarg, &ai_cpus) < 0)
+                errexit(CPU_LIST_INVALID_ERROR);
+            ai_cpus_list = optarg;
+            break;
+        case 'C':
+            clock_ms = strtol(optarg, &str_ptr, 10);
+            if (*str_ptr == '+')
+                clock_increment_ms = strtol(str_ptr + 1, &str_ptr, 10);
+            if (*str_ptr != '\0' || clock_ms < MINIMUM_CLOCK_MS || clock_increment_ms < 0)
+                errexit(CLOCK_INVALID_ERROR);
+            break;
+        case 'h':
+            headless = true;
+            break;
+        case 'e':
+            headless = true;
+            events_path = optarg;
+            break;
+        case 'U':
+            // Internal: passed by the previous image of the server on an upgrade
+            upgrade_fd = strtol(optarg, &str_ptr, 10);
+            if (*str_ptr != '\0' || upgrade_fd < 0)
+                errexit(UPGRADE_STATE_ERROR);
+            break;
+        default:
+            printf(USAGE_ERROR_SERVER, argv[0]);
+            exit(EXIT_FAILURE);
+        }
+    }
 
-    // Game loop
-    while ((game->result = is_game_ended(game->matrix)) == NOT_FINISHED) {
-#if DEBUG
-        print_board(game->matrix, game->symbols[0], game->symbols[1]);
-#else
-        printf(NEWLINE);
-#endif
-        // Wait for move
-        wait_for_move();
+    // From here on, the errors are events too
+    if (headless)
+        open_events(events_path);
 
-        // Notify the next player
-        notify_next_move();
-    }
+    if (huge_pages && backend == IPC_BACKEND_SYSV)
+        errexit(HUGE_PAGES_NOT_SUPPORTED_ERROR);
 
-    // If the game is ended (i.e. no more in the loop), print the result
-    print_result();
+    if (swap_turns && !rematch)
+        errexit(SWAP_WITHOUT_REMATCH_ERROR);
 
-    // Notify the player(s) still connected that the game is ended
-    notify_name_ended();
+    set_shared_memory_backend(backend, huge_pages);
+    single_game = n_slots == 1;
 
-    exit(EXIT_SUCCESS);
+    return optind;
 }
 
-/// @brief Parse the arguments passed to the server
-/// @param argc The number of arguments
-/// @param argv The arguments
-void parse_args(int argc, char* argv[])
+/// @brief Parse the positional arguments passed to the server
+/// @param args The positional arguments (timeout and symbols)
+void parse_args(char* args[])
 {
     // Parsing timeout
     char* str_ptr;
-    game->timeout = strtol(argv[1], &str_ptr, 10);
+    timeout = strtol(args[0], &str_ptr, 10);
     if (*str_ptr != '\0') {
         errexit(TIMEOUT_INVALID_CHAR_ERROR);
     }
 
     // Check if timeout is valid
-    if (game->timeout < MINIMUM_TIMEOUT && game->timeout != 0) {
+    if (timeout < MINIMUM_TIMEOUT && timeout != 0) {
         errexit(TIMEOUT_TOO_LOW_ERROR);
     }
+
+    // The clocks of the server replace the timeout of the clients
+    if (clock_ms > 0 && timeout != 0) {
+        errexit(CLOCK_WITH_TIMEOUT_ERROR);
+    }
     // Parsing symbols
-    if (strlen(argv[2]) != 1 || strlen(argv[3]) != 1) {
+    if (strlen(args[1]) != 1 || strlen(args[2]) != 1) {
         errexit(SYMBOLS_LENGTH_ERROR);
     }
 
-    game->symbols[0] = argv[2][0];
-    game->symbols[1] = argv[3][0];
+    symbols[0] = args[1][0];
+    symbols[1] = args[2][0];
 
     // Check if symbols are the same
-    if (game->symbols[0] == game->symbols[1]) {
+    if (symbols[0] == symbols[1]) {
         errexit(SYMBOLS_EQUAL_ERROR);
     }
 }
@@ -151,13 +456,28 @@ void init()
     print_welcome_message_server();
     print_loading_message();
 
-    // Check if another server is running
-    if (is_another_server_running(&game_id, &game)) {
-        errexit(SERVER_ALREADY_RUNNING_ERROR);
+    if (upgrade_fd != NO_UPGRADE) {
+        // An upgraded server keeps the shard and the IPCs of its previous image
+        take_over_server();
+    } else {
+        // Take a shard of the IPC namespace, so that servers run side by side
+        init_directory();
+
+        // Check if another server is running
+        if (is_another_server_running(&lobby_id, &lobby, LOBBY_SIZE(n_slots))) {
+            errexit(SERVER_ALREADY_RUNNING_ERROR);
+        }
+
+        // The games left by a crashed server are recovered, if its lobby is whole
+        if (lobby != NULL && is_lobby_recoverable(lobby, n_slots)) {
+            recovering = true;
+            crashed_server_pid = lobby->server_pid;
+        }
     }
 
-    // Terminal settings
-    init_terminal();
+    // Terminal settings (none without a terminal)
+    if (!is_headless())
+        init_terminal();
 
     // Data structures
     init_semaphores();
@@ -166,10 +486,123 @@ void init()
     // Signals
     init_signals();
 
+    // Players liveness
+    init_reaper();
+
     // Loading complete
     print_loading_complete_message();
 }
 
+/// @brief Register the server in the directory of the shards. The shard is only
+/// claimed here: the clients are sent to it once its IPCs are ready
+void init_directory()
+{
+    directory = open_directory(true);
+
+    if ((shard = register_shard(directory)) == NO_SHARD) {
+        close_directory(directory);
+        errexit(TOO_MANY_SHARDS_ERROR);
+    }
+
+    set_shared_memory_shard(shard);
+
+    // Registered first, so that the shard is given back after the IPCs are disposed
+    if (atexit(dispose_directory))
+        errexit(INITIALIZATION_ERROR);
+}
+
+/// @brief Take over the shard and the IPCs of the previous image of the server,
+/// from the state it handed over. Its sessions are taken as they are if this
+/// image lays them out the same way; otherwise, its games are recovered from the
+/// lobby, as those of a crashed server
+void take_over_server()
+{
+    upgrade_header_t header;
+
+    if (lseek(upgrade_fd, 0, SEEK_SET) < 0 || read(upgrade_fd, &header, sizeof(header)) != sizeof(header)
+        || header.magic != UPGRADE_STATE_MAGIC || header.n_slots != n_slots
+        || header.backend != get_shared_memory_backend() || header.shard < 0 || header.shard >= MAX_SHARDS
+        || header.n_held < 0 || header.n_held > QUEUE_CAPACITY)
+        errexit(UPGRADE_STATE_ERROR);
+
+    // The entry of the shard holds the pid of the previous image, which is this one
+    directory = open_directory(true);
+    shard = header.shard;
+    if (atomic_load(&directory->shards[shard].server_pid) != getpid())
+        errexit(UPGRADE_STATE_ERROR);
+
+    set_shared_memory_shard(shard);
+
+    if (atexit(dispose_directory))
+        errexit(INITIALIZATION_ERROR);
+
+    lobby_id = header.lobby_id;
+    adopt_shared_memory(lobby_id, header.handoff_socket);
+    lobby = (tris_lobby_t*)attach_shared_memory(lobby_id);
+
+    if (!is_lobby_recoverable(lobby, n_slots) || lobby->sem_id != header.sem_id)
+        errexit(UPGRADE_STATE_ERROR);
+
+    // The socket of the front-end is kept open by the previous image, with the
+    // messages sent meanwhile (it is closed if this image has no front-end)
+    int frontend_socket = header.frontend_socket;
+    if (frontend_socket >= 0 && socket_path == NULL) {
+        close(frontend_socket);
+        frontend_socket = -1;
+    }
+
+    size_t size = n_slots * sizeof(session_t);
+    if (header.session_layout != get_session_layout() || (sessions = malloc(size)) == NULL
+        || read(upgrade_fd, sessions, size) != (ssize_t)size
+        || read(upgrade_fd, held_tickets, header.n_held * sizeof(uint64_t)) != (ssize_t)(header.n_held * sizeof(uint64_t))) {
+        free(sessions);
+        sessions = NULL;
+        recovering = true;
+
+        // Without their sessions, the remote players are lost: their slots hold
+        // the pid of the server, as those of a crashed one
+        crashed_server_pid = getpid();
+        adopt_frontend(frontend_socket, -1);
+    } else {
+        upgraded = true;
+        atomic_store(&open_handle, header.open_handle);
+
+        // The remote players go on with the front-end; if they cannot, their
+        // requests are dropped with them
+        bool remotes_adopted = adopt_frontend(frontend_socket, upgrade_fd);
+        for (int i = 0; i < header.n_held; i++) {
+            if (!remotes_adopted && get_ticket(lobby, held_tickets[i])->pid == getpid())
+                release_ticket(lobby, held_tickets[i]);
+            else
+                held_tickets[n_held++] = held_tickets[i];
+        }
+    }
+
+    close(upgrade_fd);
+}
+
+/// @brief Hash the layout of the sessions: the version of their meaning, and the
+/// offset and the size of every field. The sessions handed over on an upgrade are
+/// read as they are only by an image that lays them out the same way
+uint32_t get_session_layout()
+{
+#define SESSION_FIELD(field) offsetof(session_t, field), sizeof(((session_t*)0)->field)
+    uint64_t fields[] = { UPGRADE_SESSION_VERSION, sizeof(session_t), SESSION_FIELD(game), SESSION_FIELD(index),
+        SESSION_FIELD(sem_base), SESSION_FIELD(turn), SESSION_FIELD(moves), SESSION_FIELD(players_count),
+        SESSION_FIELD(round), SESSION_FIELD(joined), SESSION_FIELD(detached), SESSION_FIELD(occupied),
+        SESSION_FIELD(ai_started), SESSION_FIELD(started), SESSION_FIELD(phase), SESSION_FIELD(exit_status),
+        SESSION_FIELD(node), SESSION_FIELD(clock_left), SESSION_FIELD(turn_started_at), SESSION_FIELD(flagged),
+        SESSION_FIELD(marks) };
+#undef SESSION_FIELD
+    const unsigned char* bytes = (const unsigned char*)fields;
+    uint32_t hash = 2166136261u;
+
+    for (size_t i = 0; i < sizeof(fields); i++)
+        hash = (hash ^ bytes[i]) * 16777619u;
+
+    return hash;
+}
+
 /// @brief Initialize the terminal settings
 void init_terminal()
 {
@@ -190,13 +623,16 @@ void init_terminal()
 /// @brief Initialize the shared memory
 void init_shared_memory()
 {
-    if (game_id == -1 || game == NULL) {
+    if (lobby_id == -1 || lobby == NULL) {
         // Get shared memory
-        game_id = get_and_init_shared_memory(GAME_SIZE, GAME_ID);
-        game = (tris_game_t*)attach_shared_memory(game_id);
+        lobby_id = get_and_init_shared_memory(LOBBY_SIZE(n_slots), SHARD_KEY(GAME_ID, shard));
+        lobby = (tris_lobby_t*)attach_shared_memory(lobby_id);
+    } else if (recovering && upgrade_fd == NO_UPGRADE) {
+        // The games of the crashed server are recovered: it is always told
+        printf(FOUND_CRASHED_SERVER_MESSAGE);
     }
 #if DEBUG
-    else {
+    else if (upgrade_fd == NO_UPGRADE) {
         printf(FOUND_CRASHED_SERVER_MESSAGE);
     }
 #endif
@@ -205,32 +641,61 @@ void init_shared_memory()
         errexit(INITIALIZATION_ERROR);
     }
 
-    // Initialize variables
-    game->result = NOT_FINISHED;
-    game->autoplay = NONE;
-    init_board(game->matrix);
-    init_pids(game->pids);
-    memset(game->client_path, 0, sizeof(game->client_path));
+#if DEBUG
+    printf(LOBBY_LAYOUT_SUCCESS, n_slots, LOBBY_SIZE(n_slots));
+    printf(SHARED_MEMORY_LAYOUT_SUCCESS, GAME_SIZE, (int)(GAME_SIZE / CACHE_LINE_SIZE));
+#endif
 
-    // Register the server pid at the very first position
-    set_pid_at(sem_id, game->pids, 0, getpid());
+    // The slots are given to the lobby once the settings are known (or once
+    // the games of the crashed server are recovered). After an upgrade, the
+    // lobby and its queue go on as the previous image left them
+    if (recovering)
+        recover_lobby(lobby);
+    else if (!upgraded)
+        init_lobby(lobby, n_slots, sem_id);
+
+    if (!upgraded)
+        init_queue(lobby);
+
+    // The clients tell their players how to resume a game only if they can
+    lobby->resume_grace = resume_grace;
 }
 
-/// @brief Dispose the shared memory
+/// @brief Initialize the semaphores, N_SEM for each slot
 void init_semaphores()
 {
-    sem_id = get_semaphores(N_SEM);
+    int n_sems = N_SEM * n_slots;
+
+    // The semaphores of a crashed server (or of the previous image) are taken
+    // over with its games, with the turns they hold; without them, its games
+    // cannot be recovered
+    if ((recovering || upgraded) && adopt_semaphores(lobby->sem_id, n_sems)) {
+        sem_id = lobby->sem_id;
+
+        if (atexit(dispose_semaphores))
+            errexit(INITIALIZATION_ERROR);
+        return;
+    }
+
+    if (upgraded)
+        errexit(UPGRADE_STATE_ERROR);
 
-    // Initialize semaphores
-    short unsigned values[N_SEM];
-    values[WAIT_FOR_PLAYERS] = 0;
-    values[WAIT_FOR_OPPONENT_READY] = 0;
-    values[PID_LOCK] = 1;
-    values[PLAYER_ONE_TURN] = INITIAL_TURN == PLAYER_ONE ? 1 : 0;
-    values[PLAYER_TWO_TURN] = INITIAL_TURN == PLAYER_TWO ? 1 : 0;
-    values[WAIT_FOR_MOVE] = 0;
+    recovering = false;
 
-    set_semaphores(sem_id, N_SEM, values);
+    // The SysV backend keeps the well-known key; the others use a private set,
+    // whose id is published in the shared memory
+    if (get_shared_memory_backend() == IPC_BACKEND_SYSV)
+        sem_id = get_semaphores(SHARD_KEY(SEM_ID, shard), n_sems);
+    else
+        sem_id = get_private_semaphores(n_sems);
+
+    // Every semaphore starts at zero: the first turn is given when a game starts
+    short unsigned* values = calloc(n_sems, sizeof(short unsigned));
+    if (values == NULL)
+        errexit(INITIALIZATION_ERROR);
+
+    set_semaphores(sem_id, n_sems, values);
+    free(values);
 
     if (atexit(dispose_semaphores)) {
         print_error(INITIALIZATION_ERROR);
@@ -241,21 +706,386 @@ void init_semaphores()
 /// @brief Initialize the signals
 void init_signals()
 {
+    // The players quit through their slot, so SIGUSR1 stays blocked. SIGUSR2
+    // asks for an upgrade
     sigset_t set;
     sigfillset(&set);
     sigdelset(&set, SIGINT);
     sigdelset(&set, SIGTERM);
     sigdelset(&set, SIGHUP);
-    sigdelset(&set, SIGUSR1);
     sigdelset(&set, SIGUSR2);
     sigprocmask(SIG_SETMASK, &set, NULL);
 
+    // The AI clients are reaped automatically
     if (signal(SIGINT, exit_handler) == SIG_ERR
         || signal(SIGTERM, exit_handler) == SIG_ERR
         || signal(SIGHUP, quit_handler) == SIG_ERR
-        || signal(SIGUSR1, player_quit_handler) == SIG_ERR
-        || signal(SIGUSR2, player_quit_handler) == SIG_ERR) {
+        || signal(SIGUSR2, upgrade_handler) == SIG_ERR
+        || signal(SIGCHLD, SIG_IGN) == SIG_ERR) {
+        errexit(INITIALIZATION_ERROR);
+    }
+}
+
+/// @brief Start the thread that detects the players who are gone without quitting
+void init_reaper()
+{
+    // The signals are handled by the main thread only
+    sigset_t set, old_set;
+    sigfillset(&set);
+    pthread_sigmask(SIG_SETMASK, &set, &old_set);
+
+    if (pthread_create(&reaper_tid, NULL, reaper_handler, NULL) != 0)
+        errexit(INITIALIZATION_ERROR);
+
+    pthread_sigmask(SIG_SETMASK, &old_set, NULL);
+}
+
+/// @brief Reset every slot, give it to the lobby and start the workers (all but
+/// the first one, the main thread) and the matcher
+void init_sessions()
+{
+    if (!upgraded && (sessions = calloc(n_slots, sizeof(session_t))) == NULL)
+        errexit(INITIALIZATION_ERROR);
+
+    // In reverse order, so that the first slot is the first one taken
+    for (int i = n_slots - 1; i >= 0; i--) {
+        sessions[i].game = get_game_at(lobby, i);
+        sessions[i].index = i;
+        sessions[i].sem_base = i * N_SEM;
+
+        // The sessions handed over by the previous image go on as they are
+        if (upgraded) {
+            recovered_sessions += sessions[i].occupied;
+            continue;
+        }
+
+        if (recovering && recover_session(&sessions[i])) {
+            recovered_sessions++;
+            continue;
+        }
+
+        if (recovering)
+            dismiss_players(&sessions[i]);
+        give_back_slot(&sessions[i]);
+    }
+
+    if (recovering)
+        printf(RECOVERED_GAMES_MESSAGE, recovered_sessions);
+    else if (upgraded)
+        printf(UPGRADED_GAMES_MESSAGE, recovered_sessions);
+
+    if (single_game && recovered_sessions == 0) {
+        print_and_flush(WAITING_FOR_PLAYERS_MESSAGE);
+
+        // Start the spinner
+        start_loading_spinner();
+    }
+
+    sigset_t set, old_set;
+    sigfillset(&set);
+    pthread_sigmask(SIG_SETMASK, &set, &old_set);
+
+    // Started before the workers, which notify it. Its socket is closed after
+    // the threads are stopped (but kept on an upgrade)
+    if (socket_path != NULL) {
+        if (atexit(dispose_frontend))
+            errexit(INITIALIZATION_ERROR);
+        start_frontend(lobby, lobby_id, socket_path, rematch, heartbeat_grace);
+    }
+
+    // Started before the workers, which arm them
+    if (clock_ms > 0)
+        start_clocks(lobby);
+
+    // The recovered games go on before the workers run their sessions
+    if (upgraded)
+        restart_sessions();
+    else
+        resume_sessions();
+
+    init_workers();
+
+    if (pthread_create(&matcher_tid, NULL, matcher_handler, NULL) != 0)
+        errexit(INITIALIZATION_ERROR);
+
+    pthread_sigmask(SIG_SETMASK, &old_set, NULL);
+
+    // Registered last, so that the threads stop before the IPCs are disposed
+    if (atexit(stop_threads))
+        errexit(INITIALIZATION_ERROR);
+
+    // The shard is ready for the clients
+    publish_shard(directory, shard, get_shared_memory_backend(), n_slots);
+
+    // The warm AI clients of the previous image are still waiting for their games
+    if (!upgraded)
+        init_ai_pool_workers();
+}
+
+/// @brief Take over the game left in the slot of a session by a crashed server,
+/// if it was being played and it can go on: the board must be one of a game
+/// (with the turns alternated), without a result, and at least one player must
+/// still be there. The turn is the one of the board, whatever the server saw
+/// @return True if the game has been recovered
+bool recover_session(session_t* session)
+{
+    tris_game_t* game = session->game;
+    int marks[PID_ARRAY_LEN] = { 0 };
+    bool alive = false;
+
+    if (game->sem_id != sem_id || game->sem_base != session->sem_base || game->result != NOT_FINISHED
+        || (game->first_turn != PLAYER_ONE && game->first_turn != PLAYER_TWO))
+        return false;
+
+    for (int i = 0; i < MATRIX_SIZE; i++) {
+        if (game->matrix[i] < 0 || game->matrix[i] > PLAYER_TWO)
+            return false;
+        marks[game->matrix[i]]++;
+    }
+
+    int first = game->first_turn;
+    int second = PLAYER_ONE + PLAYER_TWO - first;
+    if (marks[first] - marks[second] != 0 && marks[first] - marks[second] != 1)
+        return false;
+
+    // A player who lost its client keeps its slot (the reaper handles the ones
+    // found dead here); the remote players were lost with the crashed server
+    for (int i = PLAYER_ONE; i <= PLAYER_TWO; i++) {
+        int state = atomic_load(&game->players[i].state);
+        pid_t pid = game->players[i].pid;
+
+        if (state == SLOT_READY)
+            alive |= pid != 0 && pid != crashed_server_pid && !(kill(pid, 0) < 0 && errno == ESRCH);
+        else if (state != SLOT_DETACHED && state != SLOT_RESUMED)
+            return false;
+    }
+
+    // A game whose players still wait for the start is not recovered: nobody
+    // made a move yet, they can join another one
+    bool started = marks[first] > 0
+        || (get_semaphore_value(sem_id, session->sem_base + WAIT_FOR_OPPONENT_READY) == 0
+            && count_semaphore_waiters(sem_id, session->sem_base + WAIT_FOR_OPPONENT_READY) == 0);
+
+    if (!alive || !started)
+        return false;
+
+    // The player on turn is the one of the board, unless the last move ended
+    // the game: then it is the player who made it, for the result to be checked
+    session->moves = marks[first] + marks[second];
+    session->turn = marks[first] == marks[second] ? first : second;
+    if (is_game_ended(game->matrix) != NOT_FINISHED)
+        session->turn = PLAYER_ONE + PLAYER_TWO - session->turn;
+
+    session->marks = 0;
+    for (int i = 0; i < MATRIX_SIZE; i++)
+        session->marks |= (game->matrix[i] != 0) << i;
+
+    session->round = atomic_load(&game->round);
+    session->players_count = 2;
+    session->joined[PLAYER_ONE] = session->joined[PLAYER_TWO] = true;
+    session->detached[PLAYER_ONE] = session->detached[PLAYER_TWO] = false;
+    session->occupied = true;
+    session->ai_started = game->autoplay != NONE;
+    session->started = true;
+    session->phase = PHASE_PLAYING;
+    session->exit_status = EXIT_SUCCESS;
+    session->flagged = NONE;
+
+    add_shard_load(directory, shard, 1);
+
+    return true;
+}
+
+/// @brief Send away the players of a game of a crashed server that cannot be
+/// recovered, as if the server quitted, and forget their usernames
+void dismiss_players(session_t* session)
+{
+    tris_game_t* game = session->game;
+
+    for (int i = PLAYER_ONE; i <= PLAYER_TWO; i++) {
+        int state = atomic_load(&game->players[i].state);
+        pid_t pid = game->players[i].pid;
+
+        if (state == SLOT_FREE)
+            continue;
+
+        unregister_username(lobby, game->players[i].user_id);
+
+        if (state == SLOT_READY && pid != 0 && pid != crashed_server_pid)
+            kill(pid, SIGUSR1);
+    }
+}
+
+/// @brief Go on with the games recovered from a crashed server. The turn posted
+/// by the crashed server is kept; if it did not post it (the player on turn is
+/// still waiting for it), it is posted now. A game ended by a move the crashed
+/// server did not see is ended here. The clocks start again from the whole time
+void resume_sessions()
+{
+    for (int i = 0; i < n_slots && recovered_sessions > 0; i++) {
+        session_t* session = &sessions[i];
+        tris_game_t* game = session->game;
+
+        if (session->phase != PHASE_PLAYING)
+            continue;
+
+        if (single_game)
+            printf(GAME_RECOVERED_SERVER_MESSAGE, get_player_username(lobby, game, PLAYER_ONE),
+                get_player_username(lobby, game, PLAYER_TWO));
+        else
+            printf(LOBBY_GAME_RECOVERED_MESSAGE, session->index,
+                get_player_username(lobby, game, PLAYER_ONE), get_player_username(lobby, game, PLAYER_TWO));
+
+        reset_move_clocks(session);
+
+        if (is_game_ended(game->matrix) != NOT_FINISHED) {
+            check_result(session);
+            continue;
+        }
+
+        int turn_sem = session->sem_base + PLAYER_ONE_TURN + session->turn - 1;
+        if (get_semaphore_value(sem_id, turn_sem) == 0 && count_semaphore_waiters(sem_id, turn_sem) > 0)
+            signal_semaphore(sem_id, turn_sem, 1);
+
+        print_waiting_for_move(session);
+
+        // The moves made while no server was running are looked at
+        notify_session(lobby, game);
+    }
+
+    fflush(stdout);
+}
+
+/// @brief Go on with the sessions handed over by the previous image. The clocks
+/// of the games being played are armed again at their deadlines (the time of the
+/// upgrade is charged to the player on turn); the sessions woken up meanwhile
+/// are already in the ready ring
+void restart_sessions()
+{
+    for (int i = 0; i < n_slots && clock_ms > 0; i++) {
+        session_t* session = &sessions[i];
+
+        if (session->phase == PHASE_PLAYING)
+            arm_clock(i, session->turn_started_at + session->clock_left[session->turn]);
+    }
+}
+
+/// @brief Start the workers, one per core (or per CPU of --cpus, each pinned to
+/// its own) but no more than the slots (a single game is run by the main thread only)
+void init_workers()
+{
+    long n_cores = worker_cpus_list != NULL ? CPU_COUNT(&worker_cpus) : sysconf(_SC_NPROCESSORS_ONLN);
+    n_workers = n_cores < 1 ? 1 : (n_cores < n_slots ? n_cores : n_slots);
+
+    // Every deque starts on its own lines
+    if ((workers = aligned_alloc(CACHE_LINE_SIZE, n_workers * sizeof(worker_t))) == NULL)
+        errexit(INITIALIZATION_ERROR);
+    memset(workers, 0, n_workers * sizeof(worker_t));
+
+    for (int i = 0; i < n_workers; i++) {
+        workers[i].id = i;
+        workers[i].cpu = worker_cpus_list != NULL ? get_nth_cpu(&worker_cpus, i) : NO_CPU;
+        workers[i].node = workers[i].cpu != NO_CPU ? get_cpu_node(workers[i].cpu) : NO_NODE;
+        init_deque(&workers[i].deque, n_slots);
+    }
+
+    place_sessions();
+
+    pthread_attr_t attr;
+    if (pthread_attr_init(&attr) != 0)
         errexit(INITIALIZATION_ERROR);
+
+    workers[0].tid = pthread_self();
+    if (workers[0].cpu != NO_CPU) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(workers[0].cpu, &set);
+        pthread_setaffinity_np(workers[0].tid, sizeof(set), &set);
+    }
+
+    for (int i = 1; i < n_workers; i++) {
+        if (workers[i].cpu != NO_CPU && !set_thread_cpu(&attr, workers[i].cpu))
+            errexit(INITIALIZATION_ERROR);
+        if (pthread_create(&workers[i].tid, &attr, worker_handler, &workers[i]) != 0)
+            errexit(INITIALIZATION_ERROR);
+    }
+
+    pthread_attr_destroy(&attr);
+}
+
+/// @brief Give every slot a home worker, the one that pushes its session first,
+/// and prefer the NUMA node of that worker for the memory of the slot. The slots
+/// of a worker are contiguous, so they are bound in a single block of whole pages
+/// (a page shared with the block of the previous worker stays where it is)
+void place_sessions()
+{
+    for (int i = 0; i < n_slots; i++)
+        sessions[i].node = workers[(long)i * n_workers / n_slots].node;
+
+    if (worker_cpus_list == NULL)
+        return;
+
+    uintptr_t page_size = get_shared_memory_page_size();
+    uintptr_t arena_end = (uintptr_t)get_game_at(lobby, n_slots - 1) + sizeof(tris_game_t);
+    int first = 0;
+
+    for (int w = 0; w < n_workers; w++) {
+        int last = (int)(((long)(w + 1) * n_slots + n_workers - 1) / n_workers);
+        if (last > n_slots)
+            last = n_slots;
+
+        uintptr_t start = (uintptr_t)get_game_at(lobby, first) & ~(page_size - 1);
+        uintptr_t end = last == n_slots
+            ? (arena_end + page_size - 1) & ~(page_size - 1)
+            : (uintptr_t)get_game_at(lobby, last) & ~(page_size - 1);
+
+        if (w > 0 && first < n_slots && start < (uintptr_t)get_game_at(lobby, first))
+            start += page_size;
+
+        if (start < end) {
+            if (bind_to_node((void*)start, end - start, workers[w].node))
+                bound_blocks++;
+            else
+                unbound_blocks++;
+        }
+
+        first = last;
+    }
+}
+
+/// @brief Start the warm AI clients of the pool, which wait for the games against
+/// the AI already attached to the shared memory
+void init_ai_pool_workers()
+{
+    for (int i = 0; i < ai_pool_size; i++)
+        start_ai_worker(i);
+}
+
+/// @brief Start (again) the AI client of a cell of the pool. If it cannot be
+/// executed, the cell stays empty: the games use a new AI client instead
+void start_ai_worker(int index)
+{
+    char cell[12];
+    snprintf(cell, sizeof(cell), "%d", index);
+    pid_t pid;
+
+    if (!reset_ai_worker(lobby, index))
+        return;
+
+    if (exec_client(POOL_OPTION, cell, &pid) != NULL) {
+        atomic_store(&lobby->ai_pool[index].state, AI_WORKER_EMPTY);
+        return;
+    }
+
+    atomic_store(&lobby->ai_pool[index].pid, pid);
+}
+
+/// @brief Start again the AI clients of the pool that crashed
+void check_ai_pool()
+{
+    for (int i = 0; i < ai_pool_size; i++) {
+        if (is_ai_worker_lost(lobby, i))
+            start_ai_worker(i);
     }
 }
 
@@ -264,8 +1094,8 @@ void init_signals()
 /// @brief Dispose the shared memory
 void dispose_memory()
 {
-    dispose_shared_memory(game_id);
-    detach_shared_memory(game);
+    dispose_shared_memory(lobby_id);
+    detach_shared_memory(lobby);
 }
 
 void dispose_semaphores()
@@ -273,6 +1103,153 @@ void dispose_semaphores()
     dispose_semaphore(sem_id);
 }
 
+void dispose_directory()
+{
+    unregister_shard(directory, shard);
+    close_directory(directory);
+}
+
+/// @brief Stop the threads that use the shared memory: they are woken up and
+/// waited for (but the one that is exiting)
+void stop_threads()
+{
+    if (workers == NULL)
+        return;
+
+    pthread_mutex_lock(&reaper_mutex);
+    atomic_store(&closing, true);
+    pthread_cond_signal(&reaper_cond);
+    pthread_mutex_unlock(&reaper_mutex);
+
+    wake_matcher(lobby);
+    atomic_fetch_add(&lobby->ready_signal, 1);
+    futex_wake(&lobby->ready_signal, INT_MAX);
+
+    pthread_join(reaper_tid, NULL);
+    pthread_join(matcher_tid, NULL);
+
+    for (int i = 0; i < n_workers; i++) {
+        if (!pthread_equal(workers[i].tid, pthread_self()))
+            pthread_join(workers[i].tid, NULL);
+    }
+
+    // The sessions left in the deques go back to the ready ring, where the
+    // next image of the server finds them after an upgrade
+    for (int i = 0; i < n_workers; i++) {
+        int index;
+        while ((index = pop_work(&workers[i].deque)) != NO_WORK)
+            push_ready_session(lobby, index);
+
+        dispose_deque(&workers[i].deque);
+    }
+    free(workers);
+    workers = NULL;
+
+    stop_clocks();
+
+    // Stopped last, so that it sends what the other threads left for the remote players
+    stop_frontend();
+}
+
+// ------------------- UPGRADE --------------------
+
+/// @brief Upgrade the server in place: its threads are stopped, with every
+/// session left between two runs, the state kept only in this process is handed
+/// over in a memfd, and the binary of the server is executed again with the same
+/// arguments. The new image keeps the pid, the shard and the IPCs: meanwhile, the
+/// clients wait on their semaphores and futexes as if the server were slow
+void upgrade_server()
+{
+    atomic_store(&upgrade_requested, false);
+
+    // With nothing to execute, this image goes on
+    if (access(server_path, X_OK) < 0) {
+        print_error(UPGRADE_ERROR);
+        return;
+    }
+
+    stop_loading_spinner();
+    print_and_flush(UPGRADING_MESSAGE);
+    stop_threads();
+
+    char state_arg[12];
+    snprintf(state_arg, sizeof(state_arg), "%d", save_upgrade_state());
+
+    // The same arguments, but the state handed over by the previous upgrade
+    int argc = 0;
+    while (server_argv[argc] != NULL)
+        argc++;
+
+    char** argv = malloc((argc + 3) * sizeof(char*));
+    if (argv == NULL)
+        errexit(UPGRADE_ERROR);
+
+    int n = 0;
+    argv[n++] = server_argv[0];
+    argv[n++] = UPGRADE_OPTION;
+    argv[n++] = state_arg;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(server_argv[i], UPGRADE_OPTION) == 0)
+            i++;
+        else
+            argv[n++] = server_argv[i];
+    }
+    argv[n] = NULL;
+
+    // The signals wait for the handlers of the new image. The terminal and the
+    // standard output are left as the new image expects to find them
+    sigset_t set;
+    sigfillset(&set);
+    sigprocmask(SIG_SETMASK, &set, NULL);
+
+    if (!is_headless() && output_customizable)
+        set_input(&with_echo);
+    release_events();
+    fflush(stdout);
+
+    execv(server_path, argv);
+
+    // Reached only if execv fails: the games cannot go on without the threads
+    free(argv);
+    print_error(UPGRADE_ERROR);
+    quit_handler(SIGUSR2);
+}
+
+/// @brief Write the state kept only in this process to a memfd, inherited by the
+/// new image: the ids of the IPCs, the sessions, the requests held by the matcher
+/// and the remote players. The descriptors of the shared memory and the socket of
+/// the front-end are kept open across the exec
+/// @return The descriptor of the memfd
+int save_upgrade_state()
+{
+    upgrade_header_t header = {
+        .magic = UPGRADE_STATE_MAGIC,
+        .session_layout = get_session_layout(),
+        .n_slots = n_slots,
+        .backend = get_shared_memory_backend(),
+        .lobby_id = lobby_id,
+        .handoff_socket = keep_shared_memory_on_exec(lobby_id),
+        .frontend_socket = keep_frontend_on_exec(),
+        .sem_id = sem_id,
+        .shard = shard,
+        .open_handle = atomic_load(&open_handle),
+        .n_held = n_held,
+    };
+
+    size_t sessions_size = n_slots * sizeof(session_t);
+    size_t held_size = n_held * sizeof(uint64_t);
+
+    int fd = memfd_create(UPGRADE_STATE_NAME, 0);
+    if (fd < 0
+        || write(fd, &header, sizeof(header)) != sizeof(header)
+        || write(fd, sessions, sessions_size) != (ssize_t)sessions_size
+        || write(fd, held_tickets, held_size) != (ssize_t)held_size
+        || (header.frontend_socket >= 0 && !save_frontend_state(fd)))
+        errexit(UPGRADE_ERROR);
+
+    return fd;
+}
+
 // --------------- OUTPUT SETTINGS ----------------
 
 /// @brief Show input in the terminal
@@ -295,22 +1272,89 @@ void print_game_settings()
     print_and_flush(GAME_SETTINGS_MESSAGE);
 
     // Print timeout
-    if (game->timeout == 0) {
+    if (timeout == 0) {
         print_and_flush(INFINITE_TIMEOUT_SETTINGS_MESSAGE);
     } else {
-        printf(TIMEOUT_SETTINGS_MESSAGE, game->timeout);
+        printf(TIMEOUT_SETTINGS_MESSAGE, timeout);
     }
 
     // Print symbols
-    printf(PLAYER_ONE_SYMBOL_SETTINGS_MESSAGE, game->symbols[0]);
-    printf(PLAYER_TWO_SYMBOL_SETTINGS_MESSAGE, game->symbols[1]);
+    printf(PLAYER_ONE_SYMBOL_SETTINGS_MESSAGE, symbols[0]);
+    printf(PLAYER_TWO_SYMBOL_SETTINGS_MESSAGE, symbols[1]);
+
+    printf(HEARTBEAT_GRACE_SETTINGS_MESSAGE, heartbeat_grace);
+
+    if (resume_grace > 0)
+        printf(RESUME_GRACE_SETTINGS_MESSAGE, resume_grace);
+
+    if (!single_game)
+        printf(LOBBY_SLOTS_SETTINGS_MESSAGE, n_slots);
+
+    if (rematch)
+        printf(REMATCH_SETTINGS_MESSAGE, swap_turns ? SWAP_SETTINGS_MESSAGE : "");
+
+    if (ai_pool_size > 0)
+        printf(AI_POOL_SETTINGS_MESSAGE, ai_pool_size);
+
+    if (socket_path != NULL)
+        printf(SOCKET_SETTINGS_MESSAGE, socket_path);
+
+    if (clock_ms > 0)
+        printf(CLOCK_SETTINGS_MESSAGE, clock_ms, clock_increment_ms);
+
+    if (worker_cpus_list != NULL)
+        printf(WORKER_CPUS_SETTINGS_MESSAGE, worker_cpus_list);
+
+    if (ai_cpus_list != NULL)
+        printf(AI_CPUS_SETTINGS_MESSAGE, ai_cpus_list);
+
+    printf(SHARD_SETTINGS_MESSAGE, shard);
+
+    // Print the IPC backend
+    printf(IPC_BACKEND_SETTINGS_MESSAGE, get_shared_memory_backend_name(get_shared_memory_backend()));
+    if (are_huge_pages_enabled())
+        printf(HUGE_PAGES_SETTINGS_MESSAGE);
+    printf(NEWLINE);
+}
+
+/// @brief Print how the matchmaking went, in a lobby
+void print_matchmaking_stats()
+{
+    unsigned long long matches = atomic_load(&lobby->matches);
+
+    printf(MATCHMAKING_STATS_MESSAGE, matches,
+        matches == 0 ? 0.0 : (double)atomic_load(&lobby->total_wait_ms) / matches,
+        atomic_load(&lobby->max_wait_ms), get_queue_depth(lobby),
+        atomic_load(&lobby->rejected));
+}
+
+/// @brief Print where the workers ran and how much of the memory of the slots
+/// could be moved to their nodes
+void print_placement_stats()
+{
+    for (int i = 0; i < n_workers; i++)
+        printf(PLACEMENT_WORKER_STATS_MESSAGE, i, workers[i].cpu, workers[i].node,
+            atomic_load(&workers[i].local_runs), atomic_load(&workers[i].remote_runs));
+
+    printf(PLACEMENT_MEMORY_STATS_MESSAGE, bound_blocks, unbound_blocks);
 }
 
 /// @brief Print the result of the game
-void print_result()
+void print_result(session_t* session)
 {
+    tris_game_t* game = session->game;
+
+    if (!single_game) {
+        if (game->result == DRAW)
+            printf(LOBBY_GAME_DRAW_MESSAGE, session->index);
+        else
+            printf(LOBBY_GAME_WON_MESSAGE, session->index, get_player_username(lobby, game, game->result));
+
+        return;
+    }
+
     print_and_flush(FINAL_STATE_MESSAGE);
-    print_board(game->matrix, game->symbols[0], game->symbols[1]);
+    print_board(stdout, game->matrix, game->symbols[0], game->symbols[1]);
 
     // Print the result based on the variable game->result
     switch (game->result) {
@@ -321,7 +1365,7 @@ void print_result()
     case 2:
         printf(WINS_PLAYER_MESSAGE,
             game->result == PLAYER_ONE ? PLAYER_ONE_COLOR : PLAYER_TWO_COLOR,
-            game->result, game->usernames[game->result]);
+            game->result, get_player_username(lobby, game, game->result));
         break;
     }
 }
@@ -331,19 +1375,40 @@ void print_result()
 /// @brief Handle the quit
 void quit_handler(int sig)
 {
-    // If the server quits, tell the clients (if still connected)
+    // If the server quits, tell the clients of every game (if still connected)
     print_and_flush(CLOSING_MESSAGE);
-    notify_server_quit();
+
+    if (!single_game && lobby != NULL)
+        print_matchmaking_stats();
+
+    if (worker_cpus_list != NULL && workers != NULL)
+        print_placement_stats();
+
+    for (int i = 0; sessions != NULL && i < n_slots; i++)
+        notify_server_quit(&sessions[i]);
+
     exit(EXIT_SUCCESS);
 }
 
+/// @brief Handle the upgrade request: the main thread upgrades the server once
+/// it is between two sessions
+void upgrade_handler(int sig)
+{
+    atomic_store(&upgrade_requested, true);
+
+    // The futex wait of the main thread, restarted after the handler, returns at once
+    if (lobby != NULL)
+        atomic_fetch_add(&lobby->ready_signal, 1);
+}
+
 /// @brief Handle the exit signal
 void exit_handler(int sig)
 {
     // Stop the spinner if it's still running
-    stop_loading_spinner(&spinner_tid);
+    stop_loading_spinner();
 
-    if (first_CTRLC_pressed) {
+    // Without a terminal, nobody is there to press CTRL+C again
+    if (first_CTRLC_pressed || is_headless()) {
         quit_handler(sig);
     }
 
@@ -351,202 +1416,1114 @@ void exit_handler(int sig)
     print_and_flush(CTRLC_AGAIN_TO_QUIT_MESSAGE);
 }
 
-/// @brief Handle the player quit
-void player_quit_handler(int sig)
+/// @brief Thread that checks the heartbeats of the players of every game. A player
+/// whose process is dead, or who has not published a heartbeat within the grace
+/// period (killed, frozen, or detached from its terminal without SIGHUP), is
+/// detached: its slot is kept for the resume grace period, then it is treated as
+/// if it had quitted. The AI and the remote players are never detached
+void* reaper_handler(void* arg)
 {
-    int player_who_quitted = sig == SIGUSR1 ? PLAYER_ONE : PLAYER_TWO;
-    int player_who_stayed = PLAYER_ONE + PLAYER_TWO - player_who_quitted;
-    char* player_who_quitted_color = player_who_quitted == PLAYER_ONE ? PLAYER_ONE_COLOR : PLAYER_TWO_COLOR;
-    char* player_who_stayed_color = player_who_stayed == PLAYER_ONE ? PLAYER_ONE_COLOR : PLAYER_TWO_COLOR;
+    while (1) {
+        struct timespec deadline;
+        deadline_after_ms(&deadline, HEARTBEAT_INTERVAL_MS);
 
-    printf(A_PLAYER_QUIT_SERVER_MESSAGE, player_who_quitted_color,
-        player_who_quitted, game->usernames[player_who_quitted]);
-    fflush(stdout);
+        // Sleep until the next check, or until the server is closing
+        pthread_mutex_lock(&reaper_mutex);
+        while (!atomic_load(&closing) && pthread_cond_timedwait(&reaper_cond, &reaper_mutex, &deadline) == 0)
+            ;
+        pthread_mutex_unlock(&reaper_mutex);
 
-#if DEBUG
-    printf(WITH_PID_MESSAGE "\n", game->pids[player_who_quitted]);
-#endif
+        if (atomic_load(&closing))
+            return NULL;
 
-    // If a user quits, set its pid to 0
-    set_pid_at(sem_id, game->pids, player_who_quitted, 0);
+        long long now = monotonic_ms();
 
-    // ...and decrease the number of players
-    players_count--;
+        for (int s = 0; s < n_slots; s++) {
+            tris_game_t* game = get_game_at(lobby, s);
 
-    // If the game has already started, this means that the player who quitted loses
-    if (started) {
-        if(game->autoplay != NONE && player_who_quitted == PLAYER_TWO) {
-            notify_server_quit();
-            exit(EXIT_FAILURE);
+            for (int i = PLAYER_ONE; i <= PLAYER_TWO; i++) {
+                pid_t pid = game->players[i].pid;
+                int state = atomic_load(&game->players[i].state);
+
+                // The heartbeat of a detached slot is the time it was detached at
+                if (state == SLOT_DETACHED && now - atomic_load(&game->players[i].heartbeat) > resume_grace) {
+                    drop_detached(lobby, game, i);
+                    continue;
+                }
+
+                if (state != SLOT_READY || pid == 0)
+                    continue;
+
+                bool dead = kill(pid, 0) < 0 && errno == ESRCH;
+                bool silent = now - atomic_load(&game->players[i].heartbeat) > heartbeat_grace;
+
+                if (!dead && !silent)
+                    continue;
+
+                // Every player is reported only once, as its slot leaves the ready state
+                if (resume_grace > 0 && game->players[i].user_id != AI_USER && pid != getpid())
+                    request_detach(lobby, game, i);
+                else
+                    request_quit(lobby, game, i);
+            }
         }
 
-        game->result = QUIT;
-        printf("\n" WINS_PLAYER_MESSAGE, player_who_stayed_color,
-            player_who_stayed, game->usernames[player_who_stayed]);
+        check_ai_pool();
+    }
+
+    return NULL;
+}
 
-        // Notify the player who stayed that he won
-        notify_player_who_won_for_quit(player_who_stayed);
-        exit(EXIT_SUCCESS);
+/// @brief Thread that takes the requests out of the matchmaking queue, in batches,
+/// and places the players in the games. The requests that cannot be served yet
+/// (every slot is in use) are kept, in order, until a slot is given back
+void* matcher_handler(void* arg)
+{
+    while (1) {
+        int seen = atomic_load(&lobby->matcher_signal);
+
+        if (atomic_load(&closing))
+            return NULL;
+
+        // Forget the requests whose clients have read their game, then take
+        // the whole batch queued since the last pass
+        int kept = 0;
+        for (int i = 0; i < n_held; i++) {
+            if (is_ticket_held(lobby, held_tickets[i]))
+                held_tickets[kept++] = held_tickets[i];
+        }
+        n_held = kept;
+
+        uint64_t ticket;
+        while (n_held < QUEUE_CAPACITY && (ticket = dequeue_join_request(lobby)) != NO_TICKET)
+            held_tickets[n_held++] = ticket;
+
+        kept = 0;
+        for (int i = 0; i < n_held; i++) {
+            if (!serve_ticket(held_tickets[i]))
+                held_tickets[kept++] = held_tickets[i];
+        }
+        n_held = kept;
+
+        // The timeout gives back the cells of the clients that died in the queue
+        struct timespec poll = { 0, HEARTBEAT_INTERVAL_MS * 1000000L };
+        futex_wait(&lobby->matcher_signal, seen, &poll);
     }
+
+    return NULL;
 }
 
-// ----------------- GAME FUNCTIONS -----------------
+/// @brief Serve a request held by the matcher
+/// @return True if the matcher is done with its cell
+bool serve_ticket(uint64_t ticket)
+{
+    tris_ticket_t* cell = get_ticket(lobby, ticket);
+
+    if (!is_ticket_held(lobby, ticket))
+        return true;
 
-/// @brief Wait for the players to join
-void wait_for_players()
+    // A client that died in the queue never releases its cell
+    int state = atomic_load(&cell->state);
+    if (state == TICKET_CANCELLED || (kill(cell->pid, 0) < 0 && errno == ESRCH)) {
+        release_ticket(lobby, ticket);
+        return true;
+    }
+
+    // Kept until the client has read its game
+    if (state == TICKET_WAITING)
+        match_ticket(ticket, cell);
+
+    return false;
+}
+
+/// @brief Place the player of a request in a game, according to the requested
+/// mode. Its username is added to the registry first: it must not be in use
+void match_ticket(uint64_t ticket, tris_ticket_t* cell)
 {
-    print_and_flush(WAITING_FOR_PLAYERS_MESSAGE);
+    int player_index = SAME_USERNAME_ERROR_CODE;
+    uint64_t handle = NO_HANDLE;
+    uint32_t user = register_username(lobby, cell->username);
 
-    // Start the spinner
-    start_loading_spinner(&spinner_tid);
+    if (user != NO_USER) {
+        handle = cell->mode == NONE ? find_human_game(cell, user, &player_index) : find_ai_game(cell, user, &player_index);
 
-    int fork_ret = 0;
+        if (handle == NO_HANDLE)
+            unregister_username(lobby, user);
+    }
 
-    // Wait for players
-    while (players_count < 2) {
-        // If the server is in autoplay mode, start the client in another process
-        if (game->autoplay != NONE && players_count == 1) {
-            // Fork the process
-            if ((fork_ret = fork()) == 0) {
-                // Prevent the client from writing to the same stdout of the server
-                close(STDOUT_FILENO);
+    if (player_index == MATCH_PENDING_CODE)
+        return;
 
-                char* client_path;
+    // The requests of the remote players are queued by the front-end. The cell
+    // is read before it can be released
+    bool remote = cell->pid == getpid();
 
-                // Check if client set its path correctly;
-                // If not, try to use the default path
-                if(game->client_path[0] == '\0') {
-                    client_path = "./bin/TrisClient";
-                } else {
-                    client_path = game->client_path;
-                }
+    // If the client has just cancelled its request, it leaves the game it was placed in
+    if (!assign_ticket(lobby, ticket, handle, player_index) && handle != NO_HANDLE)
+        request_quit(lobby, get_game_by_handle(lobby, handle), player_index);
 
-                // Execute the client
-                execl(client_path, CLIENT_EXEC_NAME, AI_USERNAME, NULL);
+    if (remote)
+        wake_frontend();
+}
 
-                // Executed only if execl fails
-                exit(EXIT_FAILURE);
-            } else if (fork_ret < 0) {
-                // Executed only if fork fails
-                // Prevent connected client from hanging
-                notify_server_quit();
-                errexit(FORK_ERROR);
-            } else {
-                do {
-                    errno = 0;
-                    wait_semaphore(sem_id, WAIT_FOR_PLAYERS, 1);
-                } while (errno == EINTR);
-
-                // Check if the AI client got executed or failed
-                if(get_pid_at(game->pids, PLAYER_TWO) == 0) {
-                    notify_server_quit();
-                    errexit(EXEC_ERROR);
-                }
+/// @brief Take a slot for a game against the AI of the requested difficulty
+/// @return The handle of the game, or NO_HANDLE (with the error, or
+/// MATCH_PENDING_CODE if the request has to wait for a slot)
+uint64_t find_ai_game(tris_ticket_t* cell, uint32_t user, int* player_index)
+{
+    int index = take_free_slot(lobby);
 
-                // If the server is in autoplay mode, print the message
-                printf(AUTOPLAY_ENABLED_MESSAGE);
-
-                switch (game->autoplay) {
-                case EASY:
-                    printf(EASY_MODE_MESSAGE);
-                    break;
-                case MEDIUM:
-                    printf(MEDIUM_MODE_MESSAGE);
-                    break;
-                case IMPOSSIBLE:
-                    printf(IMPOSSIBLE_MODE_MESSAGE);
-                    break;
-                }
+    if (index < 0) {
+        // The single game is never given back: this is its error
+        if (single_game)
+            *player_index = get_open_game(atomic_load(&open_handle)) != NULL ? AUTOPLAY_NOT_ALLOWED_ERROR_CODE : TOO_MANY_PLAYERS_ERROR_CODE;
+        else
+            *player_index = MATCH_PENDING_CODE;
 
-                break;
-            }
+        return NO_HANDLE;
+    }
+
+    tris_game_t* game = get_game_at(lobby, index);
+    add_shard_load(directory, shard, 1);
+    atomic_store(&game->autoplay, cell->mode);
+    place_player(game, PLAYER_ONE, cell->pid, user);
+
+    *player_index = PLAYER_ONE;
+    return get_game_handle(lobby, index);
+}
+
+/// @brief Pair a human with the one waiting for an opponent, if any; otherwise,
+/// take a slot and open its game to the next human
+/// @return The handle of the game, or NO_HANDLE (with the error, or
+/// MATCH_PENDING_CODE if the request has to wait for a slot)
+uint64_t find_human_game(tris_ticket_t* cell, uint32_t user, int* player_index)
+{
+    uint64_t open = atomic_load(&open_handle);
+    tris_game_t* game = get_open_game(open);
+
+    if (game != NULL) {
+        int free_index = atomic_load(&game->players[PLAYER_ONE].state) == SLOT_FREE ? PLAYER_ONE : PLAYER_TWO;
+
+        if (place_player(game, free_index, cell->pid, user)) {
+            atomic_compare_exchange_strong(&open_handle, &open, NO_HANDLE);
+            *player_index = free_index;
+            return open;
         }
+    }
+
+    int index = take_free_slot(lobby);
+    if (index < 0) {
+        *player_index = single_game ? TOO_MANY_PLAYERS_ERROR_CODE : MATCH_PENDING_CODE;
+        return NO_HANDLE;
+    }
+
+    add_shard_load(directory, shard, 1);
+    place_player(get_game_at(lobby, index), PLAYER_ONE, cell->pid, user);
+    atomic_store(&open_handle, get_game_handle(lobby, index));
+
+    *player_index = PLAYER_ONE;
+    return get_game_handle(lobby, index);
+}
+
+/// @brief Get the game a handle refers to, if a human is waiting there alone
+/// @return The game, or NULL if it is stale, full, empty or against the AI
+tris_game_t* get_open_game(uint64_t handle)
+{
+    tris_game_t* game = get_game_by_handle(lobby, handle);
+
+    if (game == NULL || atomic_load(&game->autoplay) != NONE)
+        return NULL;
 
-        // Wait for the first player
-        do {
-            errno = 0;
-            wait_semaphore(sem_id, WAIT_FOR_PLAYERS, 1);
-        } while (errno == EINTR);
+    int p1 = atomic_load(&game->players[PLAYER_ONE].state), p2 = atomic_load(&game->players[PLAYER_TWO].state);
+    if ((p1 == SLOT_READY && p2 == SLOT_FREE) || (p1 == SLOT_FREE && p2 == SLOT_READY))
+        return game;
+
+    return NULL;
+}
+
+/// @brief Open the game of a session again, after a player left it before the
+/// start, unless the matcher has another open game already
+void reopen_game(session_t* session)
+{
+    uint64_t handle = get_game_handle(lobby, session->index);
+    uint64_t open = atomic_load(&open_handle);
+
+    if (open != handle && get_open_game(open) == NULL && get_open_game(handle) != NULL)
+        atomic_compare_exchange_strong(&open_handle, &open, handle);
+}
+
+// ----------------- GAME FUNCTIONS -----------------
+
+/// @brief Thread that runs the sessions woken up by their players. A worker takes
+/// them from its own deque first, then from the ready ring of the lobby, then
+/// from the deques of the other workers. With nothing to run, it sleeps: an idle
+/// game costs no CPU time, only a move, a join or a quit does
+void* worker_handler(void* arg)
+{
+    worker_t* worker = (worker_t*)arg;
+
+    while (1) {
+        int seen = atomic_load(&lobby->ready_signal);
+
+        if (atomic_load(&closing))
+            return NULL;
+
+        // The main thread upgrades the server, between two sessions
+        if (worker->id == 0 && atomic_load(&upgrade_requested))
+            upgrade_server();
+
+        int index = find_work(worker);
+        if (index == NO_WORK) {
+            futex_wait(&lobby->ready_signal, seen, NULL);
+            continue;
+        }
+
+        run_task(worker, index);
+    }
+
+    return NULL;
+}
+
+/// @brief Find a session to run
+/// @return The index of its slot, or NO_WORK
+int find_work(worker_t* worker)
+{
+    int index = pop_work(&worker->deque);
+    if (index != NO_WORK)
+        return index;
+
+    // A batch is taken from the ring at once: an idle worker is woken up to
+    // steal from it
+    if ((index = pop_ready_session(lobby)) != NO_WORK) {
+        int next, taken = 0;
+
+        while (taken < WORKER_BATCH - 1 && (next = pop_ready_session(lobby)) != NO_WORK) {
+            push_work(&worker->deque, next);
+            taken++;
+        }
+
+        if (taken > 0 && n_workers > 1)
+            futex_wake(&lobby->ready_signal, 1);
+
+        return index;
+    }
+
+    for (int i = 1; i < n_workers; i++) {
+        if ((index = steal_work(&workers[(worker->id + i) % n_workers].deque)) != NO_WORK)
+            return index;
+    }
+
+    return NO_WORK;
+}
+
+/// @brief Run a session, then let it go idle, unless it has been woken up again
+/// in the meantime: then it goes back to the deque of the worker
+void run_task(worker_t* worker, int index)
+{
+    tris_game_t* game = get_game_at(lobby, index);
+
+    if (worker->node != NO_NODE)
+        atomic_fetch_add_explicit(sessions[index].node == worker->node ? &worker->local_runs : &worker->remote_runs,
+            1, memory_order_relaxed);
+
+    atomic_store(&game->schedule_state, SESSION_RUNNING);
+    run_session(&sessions[index]);
+
+    int running = SESSION_RUNNING;
+    if (!atomic_compare_exchange_strong(&game->schedule_state, &running, SESSION_IDLE)) {
+        atomic_store(&game->schedule_state, SESSION_SCHEDULED);
+        push_work(&worker->deque, index);
+    }
+}
+
+/// @brief Resume a session after a wake up: its phase tells what it was waiting for
+void run_session(session_t* session)
+{
+    if (session->phase == PHASE_PLAYING)
+        check_detached(session);
+
+    switch (session->phase) {
+    case PHASE_JOINING:
+        check_players(session);
+        break;
+    case PHASE_PLAYING:
+        check_move(session);
+        break;
+    case PHASE_LEAVING:
+        check_players_left(session);
+        break;
+    case PHASE_REMATCH:
+        check_rematch(session);
+        break;
+    }
+
+    // Only a game being played waits for the players who lost their client: the
+    // ones still detached when it ends quit, and the session is run again
+    if (session->phase != PHASE_PLAYING)
+        release_detached(session);
+
+    notify_spectators(session);
+}
+
+/// @brief Reset the slot of a session to an empty game, with the current settings
+void reset_session(session_t* session)
+{
+    tris_game_t* game = session->game;
+
+    game->sem_id = sem_id;
+    game->sem_base = session->sem_base;
+    game->timeout = timeout;
+    game->clock_ms = clock_ms;
+    game->clock_increment_ms = clock_increment_ms;
+    memcpy(game->symbols, symbols, sizeof(game->symbols));
+    game->result = NOT_FINISHED;
+    game->first_turn = INITIAL_TURN;
+    atomic_store(&game->round, 0);
+    atomic_store(&game->autoplay, NONE);
+    init_board(game->matrix);
+    init_pids(game);
+
+    // Register the server pid at the very first position
+    set_pid_at(game, SERVER, getpid());
+
+    // Drop the posts left by the previous game
+    clear_semaphores(sem_id, session->sem_base, N_SEM);
+
+    session->turn = INITIAL_TURN;
+    session->moves = 0;
+    session->marks = 0;
+    session->round = 0;
+    session->players_count = 0;
+    memset(session->joined, 0, sizeof(session->joined));
+    memset(session->detached, 0, sizeof(session->detached));
+    session->occupied = false;
+    session->ai_started = false;
+    session->started = false;
+    session->phase = PHASE_JOINING;
+    session->exit_status = EXIT_SUCCESS;
+    session->flagged = NONE;
+}
+
+/// @brief Reset the slot of a session and give it back to the lobby, waking up
+/// the matcher for the requests waiting for a slot
+void give_back_slot(session_t* session)
+{
+    // At startup the slots are given to the lobby for the first time
+    if (session->occupied)
+        add_shard_load(directory, shard, -1);
+
+    reset_session(session);
+    release_game_slot(lobby, session->index);
+    wake_matcher(lobby);
+}
+
+/// @brief Look at the slots of a game waiting for its players: the session is
+/// woken up by every join and every quit. With both players in, the game starts
+void check_players(session_t* session)
+{
+    tris_game_t* game = session->game;
+
+    check_quits(session);
+
+    // If everybody left before the start, the slot is given back (only once:
+    // a slot in the lobby may still be woken up by a late notification)
+    if (session->occupied && session->players_count == 0
+        && atomic_load(&game->players[PLAYER_ONE].state) == SLOT_FREE
+        && atomic_load(&game->players[PLAYER_TWO].state) == SLOT_FREE) {
+        give_back_slot(session);
+        return;
+    }
+
+    // A human left alone by the other one waits for the next opponent
+    if (game->autoplay == NONE)
+        reopen_game(session);
+
+    for (int i = PLAYER_ONE; i <= PLAYER_TWO; i++) {
+        if (session->joined[i] || atomic_load(&game->players[i].state) != SLOT_READY)
+            continue;
+
+        session->joined[i] = true;
+        session->occupied = true;
+        session->players_count++;
+        emit_join(session->index, i, get_player_username(lobby, game, i));
+
+        if (!single_game)
+            continue;
 
         // Stop the spinner
-        stop_loading_spinner(&spinner_tid);
+        stop_loading_spinner();
         print_and_flush(NEWLINE);
 
-        // If a player joined, but they are not two, print the message
-        if (++players_count == 1) {
-            printf(A_PLAYER_JOINED_SERVER_MESSAGE,
-                game->usernames[PLAYER_ONE]);
+        if (session->players_count == 1) {
+            // If a player joined, but they are not two, print the message
+            printf(A_PLAYER_JOINED_SERVER_MESSAGE, get_player_username(lobby, game, i));
+        } else if (game->autoplay != NONE) {
+            // If the server is in autoplay mode, print the message
+            printf(AUTOPLAY_ENABLED_MESSAGE);
+
+            switch (game->autoplay) {
+            case EASY:
+                printf(EASY_MODE_MESSAGE);
+                break;
+            case MEDIUM:
+                printf(MEDIUM_MODE_MESSAGE);
+                break;
+            case IMPOSSIBLE:
+                printf(IMPOSSIBLE_MODE_MESSAGE);
+                break;
+            }
+        } else {
+            // If the second player joined, print the message
+            printf(ANOTHER_PLAYER_JOINED_SERVER_MESSAGE, get_player_username(lobby, game, i));
+        }
 
 #if DEBUG
-            printf(WITH_PID_MESSAGE, game->pids[PLAYER_ONE]);
+        printf(WITH_PID_MESSAGE, game->players[i].pid);
 #endif
-        } else if (players_count == 2) {
-            // If the second player joined, print the message
-            printf(ANOTHER_PLAYER_JOINED_SERVER_MESSAGE,
-                game->usernames[PLAYER_TWO]);
 
+        fflush(stdout);
+    }
+
+    // The AI never waits alone: if its opponent left, it is sent away
+    if (game->autoplay != NONE && session->joined[PLAYER_TWO] && !session->joined[PLAYER_ONE])
+        notify_player(session, PLAYER_TWO, SIGUSR1);
+
+    // If the game is in autoplay mode, start the client in another process
+    if (game->autoplay != NONE && session->players_count == 1 && !session->ai_started) {
+        const char* error = start_ai(session);
+        session->ai_started = true;
+
+        if (error != NULL) {
+            // Prevent connected client from hanging
+            notify_server_quit(session);
+
+            if (single_game)
+                errexit(error);
+
+            printf(LOBBY_AI_ERROR_MESSAGE, session->index);
+            finish_game(session, EXIT_FAILURE);
+            return;
+        }
+    }
+
+    // If both players are connected (or AI), the game can start
+    if (session->players_count == 2)
+        start_game(session);
+}
+
+/// @brief Start the game of a session, whose players are both connected
+void start_game(session_t* session)
+{
+    tris_game_t* game = session->game;
+
+    if (single_game)
+        print_and_flush(READY_TO_START_MESSAGE);
+
+    reset_move_clocks(session);
+    notify_opponent_ready(session);
+
+    session->started = true;
+    session->phase = PHASE_PLAYING;
+
+    if (single_game) {
+        printf(STARTS_PLAYER_MESSAGE,
+            session->turn == PLAYER_ONE ? PLAYER_ONE_COLOR : PLAYER_TWO_COLOR, session->turn,
+            get_player_username(lobby, game, session->turn));
+    } else {
+        printf(LOBBY_GAME_STARTED_MESSAGE, session->index,
+            get_player_username(lobby, game, PLAYER_ONE), get_player_username(lobby, game, PLAYER_TWO));
+    }
+
+    print_waiting_for_move(session);
+}
+
+/// @brief Look at the board of a game being played. A quit wakes the session up
+/// too, even one posted before the start: a wake up without a new mark on the
+/// board is not a move
+void check_move(session_t* session)
+{
+    tris_game_t* game = session->game;
+
+    // The game ends here if a player quits
+    if (check_quits(session)) {
+        finish_game(session, session->exit_status);
+        return;
+    }
+
+    // ...or if the player on turn runs out of time, by the time of the server: a
+    // move counts if it was on the board when the clock ran out, even if the
+    // session is run to look at it after
+    bool moved = count_moves(game->matrix) != session->moves;
+    long long moved_at = get_move_time(session, moved);
+    if (is_out_of_time(session, moved_at)) {
+        flag_player(session);
+        finish_game(session, session->exit_status);
+        return;
+    }
+
+    if (!moved)
+        return;
+
+    session->moves++;
+    stop_move_clock(session, moved_at);
+    emit_move(session->index, session->turn, take_new_mark(session));
+    print_move_received(session);
+
+    check_result(session);
+}
+
+/// @brief Look at the board of a game after a move: the game goes on with the
+/// other player, or it is ended
+void check_result(session_t* session)
+{
+    tris_game_t* game = session->game;
+
+    int result = is_game_ended(game->matrix);
+    if (result == NOT_FINISHED) {
+        // Notify the next player
+        notify_next_move(session);
+        print_waiting_for_move(session);
+        return;
+    }
+
+    // The result is published only at the end, so that
+    // the server does not write to the shared memory on every turn
+    game->result = result;
+
+    // If the game is ended, print the result
+    emit_result(session->index, result, result);
+    print_result(session);
+
+    // The players of a rematch session stay for the next game
+    if (rematch) {
+        wait_for_rematch(session);
+        return;
+    }
+
+    // Notify the player(s) still connected that the game is ended
+    notify_name_ended(session);
+
+    finish_game(session, EXIT_SUCCESS);
+}
+
+/// @brief Give both players the whole time of a game, and start the clock of the
+/// player who moves first
+void reset_move_clocks(session_t* session)
+{
+    if (clock_ms == 0)
+        return;
+
+    session->clock_left[PLAYER_ONE] = clock_ms;
+    session->clock_left[PLAYER_TWO] = clock_ms;
+    publish_move_clock(session, PLAYER_ONE, NO_DEADLINE);
+    publish_move_clock(session, PLAYER_TWO, NO_DEADLINE);
+    run_move_clock(session);
+}
+
+/// @brief Start the clock of the player on turn: the session is woken up at the
+/// deadline, if it has not been woken up by the move before
+void run_move_clock(session_t* session)
+{
+    if (clock_ms == 0)
+        return;
+
+    session->turn_started_at = monotonic_ms();
+    arm_clock(session->index, session->turn_started_at + session->clock_left[session->turn]);
+    publish_move_clock(session, session->turn, session->turn_started_at + session->clock_left[session->turn]);
+}
+
+/// @brief Stop the clock of the player on turn, who moved: the time taken up to
+/// the move is charged, and the increment is given
+/// @param moved_at The time the move is judged at (see get_move_time)
+void stop_move_clock(session_t* session, long long moved_at)
+{
+    if (clock_ms == 0)
+        return;
+
+    disarm_clock(session->index);
+    session->clock_left[session->turn] -= moved_at - session->turn_started_at;
+    session->clock_left[session->turn] += clock_increment_ms;
+    publish_move_clock(session, session->turn, NO_DEADLINE);
+}
+
+/// @brief Publish the clock of a player in the game, for the clients to budget
+/// their moves against the time the server enforces. It is written before the
+/// player is told that it is on turn
+/// @param index The index of the player
+/// @param deadline The time the clock runs out at, or NO_DEADLINE if it is stopped
+void publish_move_clock(session_t* session, int index, long long deadline)
+{
+    atomic_store(&session->game->clock_left[index], session->clock_left[index]);
+    atomic_store(&session->game->clock_deadline[index], deadline);
+}
+
+/// @brief Get the time the clock of the player on turn is judged at, as seen by
+/// the server: now, when the session is run. A move found on the board by the
+/// expiry of the timer (see get_marks_at_expiry) is judged just before the
+/// deadline instead, however late the session is run after it
+/// @param moved If a new mark is on the board
+long long get_move_time(session_t* session, bool moved)
+{
+    long long now = monotonic_ms();
+    if (!moved || clock_ms == 0)
+        return now;
+
+    long long deadline = session->turn_started_at + session->clock_left[session->turn];
+    if (now >= deadline && get_marks_at_expiry(session->index, deadline) > session->moves)
+        return deadline - 1;
+
+    return now;
+}
+
+/// @brief Check if the player on turn had used up its time at a given time
+/// @param at The time the clock is judged at
+bool is_out_of_time(session_t* session, long long at)
+{
+    return clock_ms > 0 && at - session->turn_started_at >= session->clock_left[session->turn];
+}
+
+/// @brief Find the cell marked by the move just received, and remember it
+/// @return The index of the cell in the matrix
+int take_new_mark(session_t* session)
+{
+    int cell = 0;
+
+    while (cell < MATRIX_SIZE - 1 && (session->game->matrix[cell] == 0 || (session->marks & (1u << cell))))
+        cell++;
+
+    session->marks |= 1u << cell;
+
+    return cell;
+}
+
+/// @brief Make the player on turn lose on time. It is treated as a player who
+/// quitted, whatever its client does; a client that is still there is told with
+/// the signal of its own timeout
+void flag_player(session_t* session)
+{
+    session->flagged = session->turn;
+
+    notify_player(session, session->turn, SIGALRM);
+    request_quit(lobby, session->game, session->turn);
+    drop_detached(lobby, session->game, session->turn);
+    check_quits(session);
+}
+
+/// @brief End the game of a session. A single game server exits; in a lobby, the
+/// slot is given back once the players have read the result and left it
+void finish_game(session_t* session, int status)
+{
+    if (clock_ms > 0) {
+        disarm_clock(session->index);
+        publish_move_clock(session, session->turn, NO_DEADLINE);
+    }
+
+    if (single_game) {
+        // The spectators see the final board before the server is gone
+        notify_spectators(session);
+        exit(status);
+    }
+
+    session->phase = PHASE_LEAVING;
+    check_players_left(session);
+}
+
+/// @brief Wait for the players of an ended game to read the result: they are woken
+/// up on their turn semaphores, since no signal is needed to stay in the game
+void wait_for_rematch(session_t* session)
+{
+    notify_result(session);
+
+    session->started = false;
+    session->phase = PHASE_REMATCH;
+}
+
+/// @brief Look at the slots of a game between two rounds of a rematch session.
+/// Each player tells that it is ready for the next round; a player who quits
+/// ends the session, without a winner
+void check_rematch(session_t* session)
+{
+    tris_game_t* game = session->game;
+
+    check_quits(session);
+
+    if (session->players_count < 2) {
+        // The player who stayed is sent away too
+        notify_server_quit(session);
+        finish_game(session, EXIT_SUCCESS);
+        return;
+    }
+
+    for (int i = PLAYER_ONE; i <= PLAYER_TWO; i++) {
+        if (atomic_load(&game->players[i].ready_round) != session->round + 1)
+            return;
+    }
+
+    start_rematch(session);
+}
+
+/// @brief Start the next round of a rematch session in the same slot: only the
+/// board is reset, the players and the IPCs are kept
+void start_rematch(session_t* session)
+{
+    tris_game_t* game = session->game;
+
+    init_board(game->matrix);
+    game->result = NOT_FINISHED;
+
+    // With the swap, the first turn goes to the other player at every round
+    if (swap_turns)
+        game->first_turn = PLAYER_ONE + PLAYER_TWO - game->first_turn;
+
+    session->round++;
+    atomic_store(&game->round, session->round);
+    session->turn = game->first_turn;
+    session->moves = 0;
+    session->marks = 0;
+
+    if (single_game)
+        printf(NEXT_GAME_SERVER_MESSAGE, session->round + 1);
+
+    start_game(session);
+}
+
+/// @brief Look at the slots of an ended game, whose players leave after reading
+/// the result (the reaper makes the crashed ones leave)
+void check_players_left(session_t* session)
+{
+    tris_game_t* game = session->game;
+
+    for (int i = PLAYER_ONE; i <= PLAYER_TWO; i++) {
+        if (atomic_load(&game->players[i].state) == SLOT_QUIT)
+            free_player(session, i);
+    }
+
+    if (atomic_load(&game->players[PLAYER_ONE].state) == SLOT_FREE
+        && atomic_load(&game->players[PLAYER_TWO].state) == SLOT_FREE)
+        give_back_slot(session);
+}
+
+/// @brief Look at the players of a game being played who lost their client: the
+/// game waits for them, and a player who resumed gets its turn back
+void check_detached(session_t* session)
+{
+    tris_game_t* game = session->game;
+
+    for (int i = PLAYER_ONE; i <= PLAYER_TWO; i++) {
+        int state = atomic_load(&game->players[i].state);
+        const char* username = get_player_username(lobby, game, i);
+
+        if (state == SLOT_DETACHED && !session->detached[i]) {
+            session->detached[i] = true;
+
+            if (single_game) {
+                stop_loading_spinner();
+                printf(A_PLAYER_DETACHED_SERVER_MESSAGE, i == PLAYER_ONE ? PLAYER_ONE_COLOR : PLAYER_TWO_COLOR,
+                    i, username);
+            } else {
+                printf(LOBBY_GAME_DETACHED_MESSAGE, session->index, username);
+            }
+
+            fflush(stdout);
+        } else if (state == SLOT_RESUMED) {
+            session->detached[i] = false;
+            resume_turn(session, i);
+
+            if (single_game)
+                printf(A_PLAYER_RESUMED_SERVER_MESSAGE, i == PLAYER_ONE ? PLAYER_ONE_COLOR : PLAYER_TWO_COLOR,
+                    i, username);
+            else
+                printf(LOBBY_GAME_RESUMED_MESSAGE, session->index, username);
+
+            fflush(stdout);
+        }
+    }
+}
+
+/// @brief Give the turn semaphore of a resumed player back as it should be: the
+/// posts taken or left by the lost client are dropped, and the turn is posted
+/// again if the player is on turn. The client is woken up once its slot is ready
+void resume_turn(session_t* session, int index)
+{
+    tris_game_t* game = session->game;
+
+    clear_semaphores(sem_id, session->sem_base + PLAYER_ONE_TURN + index - 1, 1);
+    if (session->turn == index)
+        signal_semaphore(sem_id, session->sem_base + PLAYER_ONE_TURN + index - 1, 1);
+
+    atomic_store_explicit(&game->players[index].state, SLOT_READY, memory_order_release);
+    futex_wake(&game->players[index].state, INT_MAX);
+}
+
+/// @brief Outside of a game being played, a player who lost its client is not
+/// waited for: it quits, and a player who resumed in the meantime is sent away
+void release_detached(session_t* session)
+{
+    tris_game_t* game = session->game;
+
+    for (int i = PLAYER_ONE; i <= PLAYER_TWO; i++) {
+        session->detached[i] = false;
+        drop_detached(lobby, game, i);
+
+        int expected = SLOT_RESUMED;
+        if (atomic_compare_exchange_strong(&game->players[i].state, &expected, SLOT_QUIT))
+            futex_wake(&game->players[i].state, INT_MAX);
+    }
+}
+
+/// @brief Start the AI client of a game: a warm one of the pool, if any is idle,
+/// otherwise a new one in another process. The AI joins the slot through its handle
+/// @return NULL if the AI client got the game, the error otherwise
+const char* start_ai(session_t* session)
+{
+    uint64_t handle = get_game_handle(lobby, session->index);
+    if (assign_ai_worker(lobby, ai_pool_size, handle))
+        return NULL;
+
+    char handle_arg[24];
+    snprintf(handle_arg, sizeof(handle_arg), "%" PRIu64, handle);
+    pid_t pid;
+
+    return exec_client(SLOT_OPTION, handle_arg, &pid);
+}
+
+/// @brief Execute an AI client of this shard in another process
+/// @param option The option telling the client where to play
+/// @param value The value of the option
+/// @param pid Where to store the pid of the client
+/// @return NULL if the client got executed, the error otherwise
+const char* exec_client(const char* option, const char* value, pid_t* pid)
+{
+    char shard_arg[12];
+    snprintf(shard_arg, sizeof(shard_arg), "%d", shard);
+    const char* client_path = get_client_path(lobby);
+
+    // The pipe is closed by a successful exec: if something is read, exec failed
+    int exec_pipe[2];
+    if (pipe2(exec_pipe, O_CLOEXEC) < 0)
+        return FORK_ERROR;
+
+    // Fork the process
+    pid_t fork_ret = fork();
+    if (fork_ret == 0) {
+        // Prevent the client from writing to the same stdout of the server.
+        // The descriptor is redirected rather than closed, otherwise it
+        // could be reused by the client for its shared memory
+        int null_fd = open("/dev/null", O_WRONLY);
+        dup2(null_fd, STDOUT_FILENO);
+        close(null_fd);
+
+        // The AI clients keep off the CPUs of the workers, if asked to
+        if (ai_cpus_list != NULL)
+            pin_process(&ai_cpus);
+
+        // Execute the client
+        execl(client_path, CLIENT_EXEC_NAME, AI_USERNAME, option, value, SHARD_OPTION, shard_arg,
+            is_headless() ? HEADLESS_OPTION : NULL, NULL);
+
+        // Executed only if execl fails (without the atexit handlers of the server)
+        char failed = 1;
+        if (write(exec_pipe[1], &failed, 1) < 0)
+            _exit(EXIT_FAILURE);
+        _exit(EXIT_FAILURE);
+    }
+
+    close(exec_pipe[1]);
+
+    char failed;
+    bool executed = fork_ret > 0 && read(exec_pipe[0], &failed, 1) == 0;
+    close(exec_pipe[0]);
+
+    if (fork_ret < 0)
+        return FORK_ERROR;
+
+    *pid = fork_ret;
+
+    return executed ? NULL : EXEC_ERROR;
+}
+
+/// @brief Handle the players who quitted the game of a session: their slot is
+/// freed and, if the game has already started, the player who stayed wins
+/// @return True if the game is ended
+bool check_quits(session_t* session)
+{
+    tris_game_t* game = session->game;
+    bool ended = false;
+
+    for (int player_who_quitted = PLAYER_ONE; player_who_quitted <= PLAYER_TWO; player_who_quitted++) {
+        if (atomic_load(&game->players[player_who_quitted].state) != SLOT_QUIT)
+            continue;
+
+        int player_who_stayed = PLAYER_ONE + PLAYER_TWO - player_who_quitted;
+        char* player_who_quitted_color = player_who_quitted == PLAYER_ONE ? PLAYER_ONE_COLOR : PLAYER_TWO_COLOR;
+        char* player_who_stayed_color = player_who_stayed == PLAYER_ONE ? PLAYER_ONE_COLOR : PLAYER_TWO_COLOR;
+
+        bool flagged = session->flagged == player_who_quitted;
+
+        if (session->joined[player_who_quitted])
+            emit_quit(session->index, player_who_quitted, flagged ? EVENT_REASON_TIMEOUT : EVENT_REASON_QUIT);
+
+        if (single_game) {
+            stop_loading_spinner();
+            printf(flagged ? A_PLAYER_FLAGGED_SERVER_MESSAGE : A_PLAYER_QUIT_SERVER_MESSAGE, player_who_quitted_color,
+                player_who_quitted, get_player_username(lobby, game, player_who_quitted));
 #if DEBUG
-            printf(WITH_PID_MESSAGE, game->pids[PLAYER_TWO]);
+            printf(WITH_PID_MESSAGE "\n", game->players[player_who_quitted].pid);
 #endif
+            fflush(stdout);
+        } else if (session->started) {
+            printf(flagged ? LOBBY_GAME_FLAG_MESSAGE : LOBBY_GAME_QUIT_MESSAGE, session->index,
+                get_player_username(lobby, game, player_who_quitted));
         }
 
-        fflush(stdout);
+        // If a user quits, free its slot
+        free_player(session, player_who_quitted);
+        session->occupied = true;
+
+        // ...and decrease the number of players
+        if (session->joined[player_who_quitted]) {
+            session->joined[player_who_quitted] = false;
+            session->players_count--;
+        }
+
+        // If the game has already started, this means that the player who quitted loses
+        if (session->started && !ended) {
+            ended = true;
+
+            // An AI that quits means that it could not play, unless it ran out of time
+            if (game->autoplay != NONE && player_who_quitted == PLAYER_TWO && !flagged) {
+                notify_server_quit(session);
+                session->exit_status = EXIT_FAILURE;
+                continue;
+            }
+
+            game->result = QUIT;
+            emit_result(session->index, QUIT, player_who_stayed);
+
+            if (single_game) {
+                printf("\n" WINS_PLAYER_MESSAGE, player_who_stayed_color,
+                    player_who_stayed, get_player_username(lobby, game, player_who_stayed));
+            }
+
+            // Notify the player who stayed that he won
+            notify_player_who_won_for_quit(session, player_who_stayed);
+        }
     }
 
-    // If the server is here, it means that both players are connected (or AI), so the game can start
-    print_and_flush(READY_TO_START_MESSAGE);
+    return ended;
+}
+
+/// @brief Free the slot of a player who left, and its username
+void free_player(session_t* session, int index)
+{
+    unregister_username(lobby, session->game->players[index].user_id);
+    record_quit(session->game, index);
+}
+
+/// @brief Send a signal to a player of the game, if still connected. A remote
+/// player gets it through the front-end
+void notify_player(session_t* session, int player, int sig)
+{
+    pid_t pid = session->game->players[player].pid;
+
+    if (signal_remote_player(session->index, player, sig))
+        return;
+
+    if (pid != 0)
+        kill(pid, sig);
 }
 
-/// @brief Tell the opponent that the player is ready
-void notify_opponent_ready()
+/// @brief Tell the players that their opponent is ready, and give the first turn
+void notify_opponent_ready(session_t* session)
 {
-    signal_semaphore(sem_id, WAIT_FOR_OPPONENT_READY, 2);
+    signal_semaphore(sem_id, session->sem_base + WAIT_FOR_OPPONENT_READY, 2);
+    signal_semaphore(sem_id, session->sem_base + PLAYER_ONE_TURN + session->turn - 1, 1);
 }
 
 /// @brief Notify the player who won because the other player quitted
-void notify_player_who_won_for_quit(int player_who_won)
+void notify_player_who_won_for_quit(session_t* session, int player_who_won)
 {
-    kill(game->pids[player_who_won], SIGUSR2);
+    notify_player(session, player_who_won, SIGUSR2);
 }
 
 /// @brief Notify the players that the game is ended
-void notify_name_ended()
+void notify_name_ended(session_t* session)
+{
+    notify_player(session, PLAYER_ONE, SIGUSR2);
+    notify_player(session, PLAYER_TWO, SIGUSR2);
+}
+
+/// @brief Wake up both players, who find the result of the game
+void notify_result(session_t* session)
 {
-    kill(game->pids[PLAYER_ONE], SIGUSR2);
-    kill(game->pids[PLAYER_TWO], SIGUSR2);
+    signal_semaphore(sem_id, session->sem_base + PLAYER_ONE_TURN, 1);
+    signal_semaphore(sem_id, session->sem_base + PLAYER_TWO_TURN, 1);
 }
 
-/// @brief Notify that the server is quitting
-void notify_server_quit()
+/// @brief Notify the players of a game that the server is quitting
+void notify_server_quit(session_t* session)
 {
-    if (game->pids[PLAYER_ONE] != 0)
-        kill(game->pids[PLAYER_ONE], SIGUSR1);
+    notify_player(session, PLAYER_ONE, SIGUSR1);
+    notify_player(session, PLAYER_TWO, SIGUSR1);
+}
+
+/// @brief Publish the game of a session to its spectators. A slot given back to
+/// the lobby keeps showing its last game, until somebody joins it
+void notify_spectators(session_t* session)
+{
+    if (session->phase == PHASE_JOINING && session->players_count == 0)
+        return;
+
+    publish_snapshot(session->game, session->started ? session->turn : 0);
+
+    // The remote players are spectators of their own game
+    notify_frontend(session->index);
+}
+
+/// @brief Count the marks on the board
+int count_moves(int* matrix)
+{
+    int moves = 0;
 
-    if (game->pids[PLAYER_TWO] != 0)
-        kill(game->pids[PLAYER_TWO], SIGUSR1);
+    for (int i = 0; i < MATRIX_SIZE; i++)
+        moves += matrix[i] != 0;
+
+    return moves;
 }
 
-/// @brief Wait for the move of the current player
-void wait_for_move()
+/// @brief Print the player the server is waiting for
+void print_waiting_for_move(session_t* session)
 {
+    if (!single_game)
+        return;
+
+#if DEBUG
+    print_board(stdout, session->game->matrix, session->game->symbols[0], session->game->symbols[1]);
+#else
+    printf(NEWLINE);
+#endif
+
     printf(WAITING_FOR_MOVE_SERVER_MESSAGE,
-        turn == PLAYER_ONE ? PLAYER_ONE_COLOR : PLAYER_TWO_COLOR, turn,
-        game->usernames[turn]);
+        session->turn == PLAYER_ONE ? PLAYER_ONE_COLOR : PLAYER_TWO_COLOR, session->turn,
+        get_player_username(lobby, session->game, session->turn));
     fflush(stdout);
-
-    do {
-        errno = 0;
-        wait_semaphore(sem_id, WAIT_FOR_MOVE, 1);
-    } while (errno == EINTR);
 }
 
-/// @brief Notify the next player that it's their turn
-void notify_next_move()
+/// @brief Print the player whose move has been received
+void print_move_received(session_t* session)
 {
+    if (!single_game)
+        return;
+
     printf(MOVE_RECEIVED_SERVER_MESSAGE,
-        turn == PLAYER_ONE ? PLAYER_ONE_COLOR : PLAYER_TWO_COLOR, turn,
-        game->usernames[turn]);
+        session->turn == PLAYER_ONE ? PLAYER_ONE_COLOR : PLAYER_TWO_COLOR, session->turn,
+        get_player_username(lobby, session->game, session->turn));
+}
 
-    turn = turn == 1 ? 2 : 1;
-    signal_semaphore(sem_id, PLAYER_ONE_TURN + turn - 1, 1);
+/// @brief Notify the next player that it's their turn
+void notify_next_move(session_t* session)
+{
+    session->turn = session->turn == 1 ? 2 : 1;
+    run_move_clock(session);
+    signal_semaphore(sem_id, session->sem_base + PLAYER_ONE_TURN + session->turn - 1, 1);
 }
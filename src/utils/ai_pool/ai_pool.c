@@ -0,0 +1,115 @@
+/************************************
+ * VR487434 - Lorenzo Di Berardino
+ * VR486588 - Filippo Milani
+ * 09/05/2024
+ ************************************/
+
+#include "ai_pool.h"
+#include "../data.h"
+#include "../semaphores/semaphores.h"
+
+#include <errno.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <unistd.h>
+
+// Every worker of the pool is a warm AI client, with its own cell. The server
+// claims an idle worker with a compare-and-swap, writes the handle of the game
+// and wakes the worker up; the worker marks itself busy, plays the game, and
+// goes back to idle when it waits for the next one
+
+/// @brief Empty every cell of the pool: the workers are started by the server
+void init_ai_pool(tris_lobby_t* lobby)
+{
+    for (int i = 0; i < MAX_AI_POOL; i++) {
+        atomic_store(&lobby->ai_pool[i].state, AI_WORKER_EMPTY);
+        atomic_store(&lobby->ai_pool[i].pid, 0);
+        lobby->ai_pool[i].handle = NO_HANDLE;
+    }
+}
+
+/// @brief Check if the process of a worker is gone
+static bool is_dead(pid_t pid)
+{
+    return pid != 0 && kill(pid, 0) < 0 && errno == ESRCH;
+}
+
+/// @brief Give a game to an idle worker of the pool, if any
+/// @param lobby The lobby
+/// @param pool_size The number of workers of the pool
+/// @param handle The handle of the game
+/// @return True if a worker has been woken up for the game
+bool assign_ai_worker(tris_lobby_t* lobby, int pool_size, uint64_t handle)
+{
+    for (int i = 0; i < pool_size; i++) {
+        tris_ai_worker_t* worker = &lobby->ai_pool[i];
+        int expected = AI_WORKER_IDLE;
+
+        // A worker that crashed is never given a game (the reaper starts it again)
+        if (atomic_load(&worker->state) != AI_WORKER_IDLE || is_dead(atomic_load(&worker->pid)))
+            continue;
+
+        if (!atomic_compare_exchange_strong(&worker->state, &expected, AI_WORKER_CLAIMED))
+            continue;
+
+        worker->handle = handle;
+        atomic_store_explicit(&worker->state, AI_WORKER_ASSIGNED, memory_order_release);
+        futex_wake(&worker->state, 1);
+
+        return true;
+    }
+
+    return false;
+}
+
+/// @brief Check if the process of a worker is gone, so that it has to be started again
+bool is_ai_worker_lost(tris_lobby_t* lobby, int index)
+{
+    tris_ai_worker_t* worker = &lobby->ai_pool[index];
+
+    return atomic_load(&worker->state) != AI_WORKER_EMPTY && is_dead(atomic_load(&worker->pid));
+}
+
+/// @brief Prepare the cell of a worker that is about to be started (again). A
+/// game given to a worker that crashed before taking it is kept for the next one
+/// @return True if the cell can be used by a new worker
+bool reset_ai_worker(tris_lobby_t* lobby, int index)
+{
+    tris_ai_worker_t* worker = &lobby->ai_pool[index];
+    int state = atomic_load(&worker->state);
+
+    if (state == AI_WORKER_CLAIMED || state == AI_WORKER_ASSIGNED)
+        return true;
+
+    return atomic_compare_exchange_strong(&worker->state, &state, AI_WORKER_STARTING);
+}
+
+/// @brief Wait for the server to give a game to this worker, for at most one
+/// heartbeat interval. The worker is idle from the first call on
+/// @param lobby The lobby
+/// @param index The index of the cell of the worker
+/// @return The handle of the game, or NO_HANDLE if none has been given yet
+uint64_t wait_for_ai_game(tris_lobby_t* lobby, int index)
+{
+    tris_ai_worker_t* worker = &lobby->ai_pool[index];
+    atomic_store(&worker->pid, getpid());
+
+    // Only the worker leaves these states: the server waits for it to be idle
+    int state = atomic_load(&worker->state);
+    if (state == AI_WORKER_STARTING || state == AI_WORKER_BUSY || state == AI_WORKER_EMPTY)
+        atomic_compare_exchange_strong(&worker->state, &state, AI_WORKER_IDLE);
+
+    if ((state = atomic_load_explicit(&worker->state, memory_order_acquire)) != AI_WORKER_ASSIGNED) {
+        struct timespec poll = { 0, HEARTBEAT_INTERVAL_MS * 1000000L };
+        futex_wait(&worker->state, state, &poll);
+
+        if (atomic_load_explicit(&worker->state, memory_order_acquire) != AI_WORKER_ASSIGNED)
+            return NO_HANDLE;
+    }
+
+    uint64_t handle = worker->handle;
+    atomic_store(&worker->state, AI_WORKER_BUSY);
+
+    return handle;
+}
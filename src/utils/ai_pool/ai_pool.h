@@ -0,0 +1,20 @@
+/************************************
+ * VR487434 - Lorenzo Di Berardino
+ * VR486588 - Filippo Milani
+ * 09/05/2024
+ ************************************/
+
+#ifndef AI_POOL_H
+#define AI_POOL_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "../globals.h"
+
+void init_ai_pool(tris_lobby_t*);
+bool assign_ai_worker(tris_lobby_t*, int, uint64_t);
+bool reset_ai_worker(tris_lobby_t*, int);
+bool is_ai_worker_lost(tris_lobby_t*, int);
+uint64_t wait_for_ai_game(tris_lobby_t*, int);
+
+#endif
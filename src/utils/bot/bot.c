@@ -0,0 +1,507 @@
+/************************************
+ * VR487434 - Lorenzo Di Berardino
+ * VR486588 - Filippo Milani
+ * 09/05/2024
+ ************************************/
+
+#include "bot.h"
+#include "../data.h"
+#include "../engine/engine.h"
+#include "../events/events.h"
+#include "../lobby/lobby.h"
+#include "../matchmaking/matchmaking.h"
+#include "../semaphores/semaphores.h"
+
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// A bot plays several games from a single process, each one under its own
+// username (the one of the bot, followed by the number of the game). A game goes
+// from the queue of the matcher to its slot, and back to the queue once over.
+// Nothing blocks on a single game: the semaphores of the turns are only tried,
+// and the process waits in one place, on the futex words telling that something
+// changed in any of its games: the ticket of a queued game, or the snapshot of a
+// joined one, which the server publishes after every change of the game
+
+typedef struct {
+    int state;
+    char username[USERNAME_MAX_LEN + 1];
+    uint64_t ticket;
+    tris_game_t* game;
+    int player_index;
+    unsigned generation;
+    int seen;
+    int cycles;
+    unsigned recorded_marks;
+} bot_game_t;
+
+static tris_lobby_t* lobby = NULL;
+static bot_game_t games[MAX_BOT_GAMES];
+static int n_games = 0;
+
+// The mode asked to the matcher, and the level of the moves of the bot
+static int mode = NONE;
+static int level = BOT_DEFAULT_LEVEL;
+static bool use_engine = false;
+
+// How long the next wait lasts: shorter than a heartbeat interval when a game
+// has to be looked at again soon, rather than on its next change
+static int wait_ms = HEARTBEAT_INTERVAL_MS;
+static bool server_gone = false;
+
+// Statistics
+static int played = 0;
+static int won = 0;
+static int lost = 0;
+static int drawn = 0;
+static int interrupted = 0;
+static int moves = 0;
+static int turns = 0;
+
+static void queue_game(bot_game_t*);
+static void take_game(bot_game_t*);
+static bool run_game(bot_game_t*);
+static void play_moves(bot_game_t**, int);
+static void play_engine_moves(bot_game_t**, int);
+static void send_moves(bot_game_t**, int);
+static void end_game(bot_game_t*);
+static void leave_game(bot_game_t*, const char*);
+static void leave_games(const char*);
+static void record_moves(bot_game_t*);
+static void print_stats();
+
+/// @brief Play games until the bot is asked to quit, or the server is gone
+/// @param shared The lobby of the server
+/// @param username The username of the bot, short enough to be followed by the
+/// number of any of its games
+/// @param autoplay The difficulty of the AI to play against, or NONE to play
+/// against the other players
+/// @param n The number of games played at once, at most MAX_BOT_GAMES
+/// @param engine True if the moves are asked to the external engine
+/// @return The exit status of the client
+int play_bot_games(tris_lobby_t* shared, const char* username, int autoplay, int n, bool engine)
+{
+    lobby = shared;
+    n_games = n;
+    mode = autoplay;
+    level = autoplay != NONE ? autoplay : BOT_DEFAULT_LEVEL;
+    use_engine = engine;
+
+    for (int i = 0; i < n_games; i++) {
+        games[i].state = BOT_IDLE;
+        snprintf(games[i].username, sizeof(games[i].username), "%s-%d", username, i);
+    }
+
+    printf(BOT_STARTED_MESSAGE, username, n_games);
+    fflush(stdout);
+
+    sigset_t pending;
+    bot_game_t* on_turn[MAX_BOT_GAMES];
+    atomic_int* words[MAX_BOT_GAMES];
+    int expected[MAX_BOT_GAMES];
+
+    while (1) {
+        // The signals are blocked, and only looked for between two waits
+        sigpending(&pending);
+        if (sigismember(&pending, SIGINT) || sigismember(&pending, SIGTERM) || sigismember(&pending, SIGHUP)) {
+            leave_games(EVENT_REASON_QUIT);
+            print_stats();
+            print_and_flush(CLOSING_MESSAGE);
+            return EXIT_SUCCESS;
+        }
+
+        if (server_gone) {
+            leave_games(EVENT_REASON_SERVER);
+            print_stats();
+            print_and_flush(SERVER_QUIT_MESSAGE);
+            return EXIT_FAILURE;
+        }
+
+        int n_turns = 0;
+        wait_ms = HEARTBEAT_INTERVAL_MS;
+
+        for (int i = 0; i < n_games; i++) {
+            if (run_game(&games[i]))
+                on_turn[n_turns++] = &games[i];
+        }
+
+        // The moves of all the games on turn are chosen at once
+        if (n_turns > 0)
+            play_moves(on_turn, n_turns);
+
+        int n_words = 0;
+        for (int i = 0; i < n_games; i++) {
+            if (games[i].state == BOT_QUEUED) {
+                words[n_words] = &get_ticket(lobby, games[i].ticket)->state;
+                expected[n_words++] = TICKET_WAITING;
+            } else if (games[i].state == BOT_JOINED || games[i].state == BOT_PLAYING) {
+                words[n_words] = &games[i].game->snapshot.sequence;
+                expected[n_words++] = games[i].seen;
+            }
+        }
+
+        // The timeout publishes the heartbeats, and tells if the server is gone
+        struct timespec timeout = { 0, wait_ms * 1000000L };
+        if (futex_wait_any(words, expected, n_words, &timeout) < 0 && errno == ETIMEDOUT
+            && kill(lobby->server_pid, 0) < 0 && errno == ESRCH)
+            server_gone = true;
+    }
+}
+
+/// @brief Put the request of a game in the queue of the matcher
+static void queue_game(bot_game_t* bot)
+{
+    bot->ticket = enqueue_join_request(lobby, bot->username, mode);
+
+    if (bot->ticket == NO_TICKET) {
+        wait_ms = min(wait_ms, QUEUE_POLL_MS);
+        return;
+    }
+
+    bot->state = BOT_QUEUED;
+}
+
+/// @brief Take the game the matcher placed a queued request in, if any, and tell
+/// the server that the player is ready
+static void take_game(bot_game_t* bot)
+{
+    uint64_t handle;
+    int player_index = take_match(lobby, bot->ticket, &handle);
+
+    if (player_index == MATCH_PENDING_CODE)
+        return;
+
+    // The username of the previous game may still be in use for a while
+    if (player_index == SAME_USERNAME_ERROR_CODE) {
+        bot->state = BOT_IDLE;
+        wait_ms = min(wait_ms, QUEUE_POLL_MS);
+        return;
+    }
+
+    if (player_index < 0) {
+        const char* error = player_index == TOO_MANY_PLAYERS_ERROR_CODE ? TOO_MANY_PLAYERS_ERROR
+            : player_index == AUTOPLAY_NOT_ALLOWED_ERROR_CODE           ? AUTOPLAY_NOT_ALLOWED_ERROR
+                                                                        : STALE_HANDLE_ERROR;
+
+        // A game that cannot be placed is given up; the bot goes on with the others
+        bot->state = BOT_STOPPED;
+        for (int i = 0; i < n_games; i++) {
+            if (games[i].state != BOT_STOPPED) {
+                print_error(error);
+                return;
+            }
+        }
+
+        errexit(error);
+    }
+
+    tris_game_t* game = get_game_by_handle(lobby, handle);
+    if (game == NULL) {
+        bot->state = BOT_IDLE;
+        wait_ms = min(wait_ms, QUEUE_POLL_MS);
+        return;
+    }
+
+    bot->game = game;
+    bot->player_index = player_index;
+    bot->generation = atomic_load(&game->generation);
+    bot->seen = atomic_load(&game->snapshot.sequence);
+    bot->cycles = 0;
+    bot->recorded_marks = 0;
+    bot->state = BOT_JOINED;
+    emit_join(get_game_index(lobby, game), player_index, bot->username);
+
+    atomic_store(&game->players[player_index].heartbeat, monotonic_ms());
+
+    // The first game of the slot, or the next one once the result has been read
+    int round = atomic_load(&game->round);
+    atomic_store(&game->players[player_index].ready_round, game->result == NOT_FINISHED ? round : round + 1);
+    notify_session(lobby, game);
+}
+
+/// @brief Look at a game of the bot, and move it on: a game is queued again once
+/// over. The snapshot is read before the game, so that any later change of the
+/// game wakes up the bot
+/// @return True if it is the turn of the bot in the game
+static bool run_game(bot_game_t* bot)
+{
+    switch (bot->state) {
+    case BOT_IDLE:
+        queue_game(bot);
+        return false;
+    case BOT_QUEUED:
+        take_game(bot);
+        return false;
+    case BOT_LEAVING:
+        // The username is free once the server has taken the player out
+        if (atomic_load(&bot->game->generation) == bot->generation
+            && atomic_load(&bot->game->players[bot->player_index].state) == SLOT_QUIT) {
+            wait_ms = min(wait_ms, FUTEX_POLL_MS);
+            return false;
+        }
+
+        queue_game(bot);
+        return false;
+    case BOT_STOPPED:
+        return false;
+    }
+
+    tris_game_t* game = bot->game;
+    bot->seen = atomic_load(&game->snapshot.sequence);
+
+    // The slot has already been given to another game
+    if (atomic_load(&game->generation) != bot->generation) {
+        leave_game(bot, EVENT_REASON_LEFT);
+        return false;
+    }
+
+    atomic_store_explicit(&game->players[bot->player_index].heartbeat, monotonic_ms(), memory_order_relaxed);
+
+    // The player has been made to quit: it ran out of time, or looked dead
+    int opponent = PLAYER_ONE + PLAYER_TWO - bot->player_index;
+    if (game->result != NOT_FINISHED || atomic_load(&game->players[bot->player_index].state) != SLOT_READY) {
+        end_game(bot);
+        return false;
+    }
+
+    // The opponent left a started game without a result: it was sent away
+    if (bot->state == BOT_PLAYING && atomic_load(&game->players[opponent].state) == SLOT_FREE) {
+        leave_game(bot, EVENT_REASON_LEFT);
+        return false;
+    }
+
+    if (bot->state == BOT_JOINED) {
+        if (!try_wait_semaphore(game->sem_id, game->sem_base + WAIT_FOR_OPPONENT_READY, 1)) {
+            server_gone |= errno == EIDRM || errno == EINVAL;
+            return false;
+        }
+
+        bot->state = BOT_PLAYING;
+    }
+
+    if (!try_wait_semaphore(game->sem_id, game->sem_base + PLAYER_ONE_TURN + bot->player_index - 1, 1)) {
+        server_gone |= errno == EIDRM || errno == EINVAL;
+        return false;
+    }
+
+    record_moves(bot);
+
+    // In a rematch session, the players are woken up on their turn with the result
+    if (game->result != NOT_FINISHED) {
+        end_game(bot);
+        return false;
+    }
+
+    return true;
+}
+
+/// @brief Make the moves of the games on turn: the external engine is given the
+/// boards in batches, otherwise the AI of the bot plays them one by one
+static void play_moves(bot_game_t** on_turn, int n)
+{
+    if (use_engine) {
+        play_engine_moves(on_turn, n);
+    } else {
+        for (int i = 0; i < n; i++)
+            chooseNextMove(on_turn[i]->game->matrix, level, on_turn[i]->player_index, on_turn[i]->cycles);
+
+        send_moves(on_turn, n);
+    }
+
+    moves += n;
+    turns++;
+}
+
+/// @brief Make the moves of the games on turn with the external engine. The
+/// boards of a batch are searched one after the other, for the same time: the
+/// one of the game with the least time left goes first and sizes it, and the
+/// batch stops at the first game whose move would come after its own budget
+/// (see get_move_budget). The moves of a batch are sent before the next one
+static void play_engine_moves(bot_game_t** on_turn, int n)
+{
+    int* matrices[MAX_BOT_GAMES];
+    int players[MAX_BOT_GAMES];
+    int cells[MAX_BOT_GAMES];
+    long long budgets[MAX_BOT_GAMES];
+
+    // The games with the least time left first (few games are on turn at once)
+    for (int i = 0; i < n; i++) {
+        bot_game_t* bot = on_turn[i];
+        long long budget = get_move_budget(bot->game, bot->player_index);
+        int j = i;
+
+        for (; j > 0 && budgets[j - 1] > budget; j--) {
+            budgets[j] = budgets[j - 1];
+            on_turn[j] = on_turn[j - 1];
+        }
+
+        budgets[j] = budget;
+        on_turn[j] = bot;
+    }
+
+    long long started = monotonic_ms();
+
+    for (int first = 0, batch; first < n; first += batch) {
+        // A board is never given more than the fixed time, so that the batches
+        // stay long when the clocks are long
+        long long spent = monotonic_ms() - started;
+        long long movetime = budgets[first] - spent < ENGINE_MOVETIME_MS ? budgets[first] - spent : ENGINE_MOVETIME_MS;
+        if (movetime < 1)
+            movetime = 1;
+
+        batch = 1;
+        while (first + batch < n && spent + (batch + 1) * movetime <= budgets[first + batch])
+            batch++;
+
+        for (int i = 0; i < batch; i++) {
+            matrices[i] = on_turn[first + i]->game->matrix;
+            players[i] = on_turn[first + i]->player_index;
+        }
+
+        if (ask_engine_moves(matrices, players, cells, batch, (int)movetime) < batch) {
+            leave_games(EVENT_REASON_QUIT);
+            errexit(ENGINE_MOVE_ERROR);
+        }
+
+        for (int i = 0; i < batch; i++)
+            on_turn[first + i]->game->matrix[cells[i]] = on_turn[first + i]->player_index;
+
+        send_moves(on_turn + first, batch);
+    }
+}
+
+/// @brief Tell the server about the moves just made in the games on turn
+static void send_moves(bot_game_t** on_turn, int n)
+{
+    for (int i = 0; i < n; i++) {
+        on_turn[i]->cycles++;
+        notify_session(lobby, on_turn[i]->game);
+        record_moves(on_turn[i]);
+    }
+}
+
+/// @brief Account for the result of a game, and leave its slot so that the lobby
+/// can give it to another game (a single game server does not wait for it): the
+/// next game is queued once the slot is left
+static void end_game(bot_game_t* bot)
+{
+    tris_game_t* game = bot->game;
+    int index = get_game_index(lobby, game);
+    bool stayed = atomic_load(&game->players[bot->player_index].state) == SLOT_READY;
+
+    record_moves(bot);
+    played++;
+
+    if (!stayed) {
+        emit_quit(index, bot->player_index, EVENT_REASON_TIMEOUT);
+        lost++;
+        printf(BOT_GAME_LOST_MESSAGE, bot->username, index);
+    } else {
+        int winner = game->result == QUIT ? bot->player_index : game->result;
+        emit_result(index, game->result, winner);
+
+        if (winner == DRAW) {
+            drawn++;
+            printf(BOT_GAME_DRAW_MESSAGE, bot->username, index);
+        } else if (winner == bot->player_index) {
+            won++;
+            printf(BOT_GAME_WON_MESSAGE, bot->username, index);
+        } else {
+            lost++;
+            printf(BOT_GAME_LOST_MESSAGE, bot->username, index);
+        }
+    }
+
+    fflush(stdout);
+
+    if (stayed && lobby->n_slots > 1) {
+        request_quit(lobby, game, bot->player_index);
+        bot->state = BOT_LEAVING;
+        wait_ms = min(wait_ms, FUTEX_POLL_MS);
+    } else
+        bot->state = BOT_IDLE;
+}
+
+/// @brief Leave a game before its end, or take the bot out of the queue
+/// @param bot The game
+/// @param reason Why the game is left: the bot quits (EVENT_REASON_QUIT), the
+/// opponent or the game are gone (EVENT_REASON_LEFT), or the server is
+static void leave_game(bot_game_t* bot, const char* reason)
+{
+    uint64_t handle;
+    tris_game_t* placed;
+    int player_index;
+
+    switch (bot->state) {
+    case BOT_QUEUED:
+        // The matcher may have been faster: the game it was placed in is left
+        if (cancel_join_request(lobby, bot->ticket))
+            break;
+
+        player_index = wait_for_match(lobby, bot->ticket, &handle);
+        placed = player_index >= 0 ? get_game_by_handle(lobby, handle) : NULL;
+
+        if (placed != NULL)
+            request_quit(lobby, placed, player_index);
+        break;
+    case BOT_JOINED:
+    case BOT_PLAYING:
+        if (strcmp(reason, EVENT_REASON_SERVER) == 0)
+            player_index = SERVER;
+        else if (strcmp(reason, EVENT_REASON_LEFT) == 0)
+            player_index = PLAYER_ONE + PLAYER_TWO - bot->player_index;
+        else
+            player_index = bot->player_index;
+
+        emit_quit(get_game_index(lobby, bot->game), player_index, reason);
+
+        if (player_index != SERVER && atomic_load(&bot->game->generation) == bot->generation)
+            request_quit(lobby, bot->game, bot->player_index);
+
+        // Only a started game counts
+        if (bot->state == BOT_PLAYING) {
+            played++;
+            interrupted++;
+            printf(BOT_GAME_LEFT_MESSAGE, bot->username, get_game_index(lobby, bot->game));
+            fflush(stdout);
+        }
+        break;
+    }
+
+    bot->state = BOT_IDLE;
+}
+
+/// @brief Leave all the games of the bot
+/// @param reason Why they are left
+static void leave_games(const char* reason)
+{
+    for (int i = 0; i < n_games; i++)
+        leave_game(&games[i], reason);
+}
+
+/// @brief Record the moves on the board of a game since the last look at it, as
+/// events: the opponent's, once on turn, and the bot's own, once made
+static void record_moves(bot_game_t* bot)
+{
+    if (!is_headless())
+        return;
+
+    for (int i = 0; i < MATRIX_SIZE; i++) {
+        if (bot->game->matrix[i] == 0 || (bot->recorded_marks & (1u << i)))
+            continue;
+
+        bot->recorded_marks |= 1u << i;
+        emit_move(get_game_index(lobby, bot->game), bot->game->matrix[i], i);
+    }
+}
+
+/// @brief Print the statistics of the games of the bot
+static void print_stats()
+{
+    printf(BOT_STATS_MESSAGE, played, won, lost, drawn, interrupted, moves, turns);
+    fflush(stdout);
+}
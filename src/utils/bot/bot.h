@@ -0,0 +1,15 @@
+/************************************
+ * VR487434 - Lorenzo Di Berardino
+ * VR486588 - Filippo Milani
+ * 09/05/2024
+ ************************************/
+
+#ifndef BOT_H
+#define BOT_H
+
+#include <stdbool.h>
+#include "../globals.h"
+
+int play_bot_games(tris_lobby_t*, const char*, int, int, bool);
+
+#endif
@@ -0,0 +1,160 @@
+/************************************
+ * VR487434 - Lorenzo Di Berardino
+ * VR486588 - Filippo Milani
+ * 09/05/2024
+ ************************************/
+
+#include "clocks.h"
+#include "../data.h"
+#include "../lobby/lobby.h"
+
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+// The move clocks of the players are kept by the sessions: the server only needs
+// to be woken up when the player on turn runs out of time. Every slot has a
+// timer, armed at the deadline of the player on turn; a thread waits for all of
+// them and wakes up the session whose timer expired, which checks its clock.
+// The thread also looks at the board when a timer expires: a move already on it
+// was made in time, by the clock of the server, even if the session runs late
+
+static tris_lobby_t* lobby = NULL;
+
+static int* timer_fds = NULL;
+static atomic_llong* expired_at = NULL;
+static atomic_int* marks_at_expiry = NULL;
+static int epoll_fd = -1;
+static int event_fd = -1;
+static pthread_t clocks_tid = 0;
+
+static void* clocks_handler(void*);
+
+/// @brief Start the timers of the move clocks, one per slot of the lobby
+void start_clocks(tris_lobby_t* new_lobby)
+{
+    lobby = new_lobby;
+
+    if ((timer_fds = malloc(lobby->n_slots * sizeof(int))) == NULL
+        || (expired_at = calloc(lobby->n_slots, sizeof(atomic_llong))) == NULL
+        || (marks_at_expiry = calloc(lobby->n_slots, sizeof(atomic_int))) == NULL
+        || (epoll_fd = epoll_create1(EPOLL_CLOEXEC)) < 0
+        || (event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) < 0)
+        errexit(INITIALIZATION_ERROR);
+
+    struct epoll_event event = { .events = EPOLLIN, .data.u32 = NO_CLOCK };
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, event_fd, &event) < 0)
+        errexit(INITIALIZATION_ERROR);
+
+    for (int i = 0; i < lobby->n_slots; i++) {
+        if ((timer_fds[i] = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC)) < 0)
+            errexit(INITIALIZATION_ERROR);
+
+        event.data.u32 = i;
+        if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, timer_fds[i], &event) < 0)
+            errexit(INITIALIZATION_ERROR);
+    }
+
+    // The signals are handled by the main thread only
+    sigset_t set, old_set;
+    sigfillset(&set);
+    pthread_sigmask(SIG_SETMASK, &set, &old_set);
+
+    if (pthread_create(&clocks_tid, NULL, clocks_handler, NULL) != 0)
+        errexit(INITIALIZATION_ERROR);
+
+    pthread_sigmask(SIG_SETMASK, &old_set, NULL);
+}
+
+/// @brief Stop the thread of the timers, and close them
+void stop_clocks()
+{
+    if (clocks_tid == 0)
+        return;
+
+    uint64_t one = 1;
+    if (write(event_fd, &one, sizeof(one)) == sizeof(one))
+        pthread_join(clocks_tid, NULL);
+    clocks_tid = 0;
+
+    for (int i = 0; i < lobby->n_slots; i++)
+        close(timer_fds[i]);
+    free(timer_fds);
+    free(expired_at);
+    free(marks_at_expiry);
+    close(epoll_fd);
+    close(event_fd);
+}
+
+/// @brief Wake up the session of a slot at a deadline. An earlier deadline of the
+/// same slot is replaced
+/// @param slot The slot
+/// @param deadline The deadline, in ms of the monotonic clock (see monotonic_ms)
+void arm_clock(int slot, long long deadline)
+{
+    // A deadline already passed is never 0, which would disarm the timer
+    if (deadline < 1)
+        deadline = 1;
+
+    struct itimerspec spec = { { 0, 0 }, { deadline / 1000, (deadline % 1000) * 1000000L } };
+    timerfd_settime(timer_fds[slot], TFD_TIMER_ABSTIME, &spec, NULL);
+}
+
+/// @brief Stop the timer of a slot. An expiry already read may still wake up the
+/// session: the session checks its clock anyway
+void disarm_clock(int slot)
+{
+    struct itimerspec spec = { { 0, 0 }, { 0, 0 } };
+    timerfd_settime(timer_fds[slot], 0, &spec, NULL);
+}
+
+/// @brief Get the marks on the board of a slot when its timer expired at a
+/// deadline. An expiry seen more than CLOCK_EXPIRY_SKEW_MS after the deadline
+/// (the whole server was late) tells nothing about the time of a move
+/// @param slot The slot
+/// @param deadline The deadline the timer was armed at
+/// @return The number of marks, or NO_EXPIRY if the expiry was not seen in time
+int get_marks_at_expiry(int slot, long long deadline)
+{
+    long long at = atomic_load(&expired_at[slot]);
+    int marks = atomic_load(&marks_at_expiry[slot]);
+
+    return at >= deadline && at <= deadline + CLOCK_EXPIRY_SKEW_MS ? marks : NO_EXPIRY;
+}
+
+/// @brief Thread that wakes up the sessions whose timer expired
+static void* clocks_handler(void* arg)
+{
+    struct epoll_event events[CLOCKS_BATCH];
+
+    while (1) {
+        int n = epoll_wait(epoll_fd, events, CLOCKS_BATCH, -1);
+
+        for (int i = 0; i < n; i++) {
+            if (events[i].data.u32 == NO_CLOCK)
+                return NULL;
+
+            int slot = events[i].data.u32;
+            uint64_t expirations;
+            if (read(timer_fds[slot], &expirations, sizeof(expirations)) != sizeof(expirations))
+                continue;
+
+            // The board is looked at before the time is taken
+            tris_game_t* game = get_game_at(lobby, slot);
+            int marks = 0;
+            for (int j = 0; j < MATRIX_SIZE; j++)
+                marks += game->matrix[j] != 0;
+
+            atomic_store(&marks_at_expiry[slot], marks);
+            atomic_store(&expired_at[slot], monotonic_ms());
+            notify_session(lobby, game);
+        }
+    }
+
+    return NULL;
+}
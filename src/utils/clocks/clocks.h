@@ -0,0 +1,18 @@
+/************************************
+ * VR487434 - Lorenzo Di Berardino
+ * VR486588 - Filippo Milani
+ * 09/05/2024
+ ************************************/
+
+#ifndef CLOCKS_H
+#define CLOCKS_H
+
+#include "../globals.h"
+
+void start_clocks(tris_lobby_t*);
+void stop_clocks();
+void arm_clock(int, long long);
+void disarm_clock(int);
+int get_marks_at_expiry(int, long long);
+
+#endif
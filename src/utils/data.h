@@ -85,37 +85,235 @@
 // Permissions
 #define PERM 0600
 
-// Keys
+// Keys (offset by the shard of the server)
 #define SEM_ID 885684
 #define GAME_ID 434784
+#define DIRECTORY_ID 636261
 #define FTOK_PATH ".config"
-
-// Semaphore indexes
-#define N_SEM 6
-#define WAIT_FOR_PLAYERS 0
-#define WAIT_FOR_OPPONENT_READY 1
-#define PID_LOCK 2
-#define PLAYER_ONE_TURN 3
-#define PLAYER_TWO_TURN 4
-#define WAIT_FOR_MOVE 5
+#define SHARD_KEY(key, shard) ((key) + (shard))
+
+// Backends
+#define IPC_BACKEND_SYSV 0
+#define IPC_BACKEND_POSIX 1
+#define IPC_BACKEND_MEMFD 2
+#define IPC_BACKEND_SYSV_NAME "sysv"
+#define IPC_BACKEND_POSIX_NAME "posix"
+#define IPC_BACKEND_MEMFD_NAME "memfd"
+#define DEFAULT_IPC_BACKEND IPC_BACKEND_SYSV
+
+// Names (suffixed by the uid, so that users do not collide, and by the shard)
+#define SHM_NAME_FORMAT "/tris-game-%d-%d"
+#define MEMFD_NAME "tris-game"
+#define MEMFD_SOCKET_NAME_FORMAT "tris-memfd-%d-%d"
+
+// Shards: every server takes one, and registers it in the directory
+#define MAX_SHARDS 64
+#define NO_SHARD -1
+#define SHARD_OPTION "--shard"
+#define IPC_NAME_MAX_LEN 64
+#define HUGE_PAGE_SIZE (2 * 1024 * 1024)
+
+// Semaphore indexes (the server is woken up through the scheduler instead)
+#define N_SEM 3
+#define WAIT_FOR_OPPONENT_READY 0
+#define PLAYER_ONE_TURN 1
+#define PLAYER_TWO_TURN 2
+
+// Player slot states
+#define SLOT_FREE 0
+#define SLOT_CLAIMED 1
+#define SLOT_READY 3
+#define SLOT_QUIT 4
+#define SLOT_DETACHED 5
+#define SLOT_RESUMED 6
 
 // Sizes
 #define MATRIX_SIDE_LEN 3
 #define MATRIX_SIZE (MATRIX_SIDE_LEN * MATRIX_SIDE_LEN)
 #define GAME_SIZE sizeof(tris_game_t)
+#define LOBBY_HEADER_SIZE sizeof(tris_lobby_t)
+#define LOBBY_SIZE(n_slots) (LOBBY_HEADER_SIZE + (size_t)(n_slots) * GAME_SIZE + REGISTRY_CAPACITY(n_slots) * sizeof(tris_user_t))
 #define MOVE_INPUT_LEN 512
+#define INPUT_BUFFER_LEN (2 * MOVE_INPUT_LEN)
+#define COUNTDOWN_LEN 64
 #define PID_ARRAY_LEN 3
-#define USERNAMES_ARRAY_LEN 3
 #define USERNAME_MAX_LEN 30
 #define USERNAME_MIN_LEN 2
 #define SYMBOLS_ARRAY_LEN 2
 
+// Layout
+#define CACHE_LINE_SIZE 64
+
+// Lobby
+#define DEFAULT_LOBBY_SLOTS 1
+#define MAX_LOBBY_SLOTS 4096
+#define NO_SLOT UINT32_MAX
+#define NO_HANDLE UINT64_MAX
+#define CLIENT_PATH_UNSET 0
+#define CLIENT_PATH_WRITING 1
+#define CLIENT_PATH_SET 2
+#define DEFAULT_CLIENT_PATH "./bin/TrisClient"
+#define SLOT_OPTION "--slot"
+#define NO_WATCH -1
+
+// Session tokens: a player who lost its client resumes the game with the token
+// of its slot (shard, handle of the game, index of the player and secret)
+#define NO_TOKEN 0
+#define RESUME_TOKEN_LEN 64
+#define RESUME_TOKEN_FORMAT "%d-%" PRIu64 "-%d-%016" PRIx64
+#define RESUME_TOKEN_SCAN_FORMAT "%d-%" SCNu64 "-%d-%" SCNx64 "%n"
+
+// Headless mode: no terminal, the events are written as JSON lines
+#define HEADLESS_OPTION "--headless"
+#define EVENT_RECORD_LEN 512
+#define EVENT_STRING_LEN 256
+#define EVENT_HEADER_FORMAT "{\"ts\":%lld,\"pid\":%d,\"ev\":\"%s\""
+#define EVENT_JOIN_FORMAT ",\"game\":%d,\"player\":%d,\"user\":\"%s\""
+#define EVENT_MOVE_FORMAT ",\"game\":%d,\"player\":%d,\"cell\":\"%c%d\""
+#define EVENT_RESULT_FORMAT ",\"game\":%d,\"result\":\"%s\",\"winner\":%d"
+#define EVENT_QUIT_FORMAT ",\"game\":%d,\"player\":%d,\"reason\":\"%s\""
+#define EVENT_ERROR_FORMAT ",\"message\":\"%s\""
+#define EVENT_REASON_QUIT "quit"
+#define EVENT_REASON_TIMEOUT "timeout"
+#define EVENT_REASON_SERVER "server"
+#define EVENT_REASON_LEFT "left"
+
+// External engines, playing for a client through a text protocol (as UCI)
+#define ENGINE_LINE_LEN 256
+#define ENGINE_START_MS 2000
+#define ENGINE_MOVETIME_MS 100
+#define ENGINE_GRACE_MS 50
+#define NO_MOVE_LIMIT LLONG_MAX
+#define ENGINE_HELLO_COMMAND "uci\n"
+#define ENGINE_HELLO_REPLY "uciok"
+#define ENGINE_NEW_GAME_COMMAND "ucinewgame\n"
+#define ENGINE_POSITION_COMMAND "position %s %d\n"
+#define ENGINE_GO_COMMAND "go movetime %d\n"
+#define ENGINE_MOVE_REPLY "bestmove "
+#define ENGINE_QUIT_COMMAND "quit\n"
+
+// Bot clients, playing several games at once from a single process: each game
+// is waited for through one futex word, all of them in a single wait
+#define NO_BOT 0
+#define MAX_BOT_GAMES 128
+#define BOT_DEFAULT_LEVEL MEDIUM
+#define BOT_IDLE 0
+#define BOT_QUEUED 1
+#define BOT_JOINED 2
+#define BOT_PLAYING 3
+#define BOT_LEAVING 4
+#define BOT_STOPPED 5
+#define FUTEX_POLL_MS 5
+
+// Pool of warm AI clients, started by the server and reused across games
+#define DEFAULT_AI_POOL 0
+#define MAX_AI_POOL 64
+#define NO_POOL_CELL -1
+#define POOL_OPTION "--pool"
+#define AI_WORKER_EMPTY 0
+#define AI_WORKER_STARTING 1
+#define AI_WORKER_IDLE 2
+#define AI_WORKER_CLAIMED 3
+#define AI_WORKER_ASSIGNED 4
+#define AI_WORKER_BUSY 5
+
+// Upgrade in place: on SIGUSR2 the server executes its binary again, which takes
+// over the IPCs and the sessions from the state handed over in a memfd
+#define UPGRADE_OPTION "--upgrade"
+#define UPGRADE_STATE_NAME "tris-upgrade"
+#define UPGRADE_STATE_MAGIC 0x54524953
+// Bumped when the meaning of a field of the sessions changes, not only its place
+#define UPGRADE_SESSION_VERSION 1
+#define NO_UPGRADE -1
+
+// Socket front-end: every datagram carries one message of the protocol. Anyone
+// on the host may play through it, since nothing in a message is trusted; only
+// the shared memory is kept to the players of the same user as the server
+#define SOCKET_PERM 0666
+#define SOCKET_BATCH 64
+#define NO_REMOTE -1
+#define NO_REMOTE_ID UINT32_MAX
+#define MESSAGE_JOIN 1
+#define MESSAGE_MOVE 2
+#define MESSAGE_STATE 3
+#define MESSAGE_RESULT 4
+#define MESSAGE_LEAVE 5
+#define MESSAGE_ERROR 6
+#define MESSAGE_SHARE_MEMORY 1
+#define REMOTE_FREE 0
+#define REMOTE_QUEUED 1
+#define REMOTE_PLAYING 2
+#define REMOTE_EVENT_CHANGED 1
+#define REMOTE_EVENT_QUIT 2
+#define REMOTE_EVENT_ENDED 4
+
+// Placement of the workers and of the AI clients on the CPUs, and of the game
+// slots on the NUMA nodes of their workers
+#define NO_CPU -1
+#define NO_NODE -1
+#define CPU_SYSFS_PATH_FORMAT "/sys/devices/system/cpu/cpu%d"
+
+// Move clocks of the players, kept by the server (milliseconds)
+#define MINIMUM_CLOCK_MS 10
+#define CLOCKS_BATCH 64
+#define NO_CLOCK UINT32_MAX
+#define NO_EXPIRY -1
+#define CLOCK_EXPIRY_SKEW_MS 10
+#define NO_DEADLINE 0
+#define NO_TIME_LEFT -1
+
+// Registry of the usernames: two players per slot, so it is at most half full
+#define REGISTRY_CAPACITY(n_slots) (4 * (size_t)(n_slots))
+#define USER_EMPTY 0
+#define USER_USED 1
+#define USER_FREE 2
+#define NO_USER UINT32_MAX
+#define AI_USER (UINT32_MAX - 1)
+
+// Scheduling of the sessions: a session is run by one worker at a time, and a
+// wake up while it runs makes the worker run it again
+#define SESSION_IDLE 0
+#define SESSION_SCHEDULED 1
+#define SESSION_RUNNING 2
+#define SESSION_RUNNING_AGAIN 3
+#define READY_RING_CAPACITY MAX_LOBBY_SLOTS
+#define NO_WORK -1
+#define WORKER_BATCH 8
+
+// Phases of a session
+#define PHASE_JOINING 0
+#define PHASE_PLAYING 1
+#define PHASE_LEAVING 2
+#define PHASE_REMATCH 3
+
+// Matchmaking
+#define QUEUE_CAPACITY 1024
+#define NO_TICKET UINT64_MAX
+#define TICKET_WAITING 0
+#define TICKET_ASSIGNED 1
+#define TICKET_CANCELLED 2
+#define QUEUE_POLL_MS 100
+
 // ----------------- GAME --------------------
 
 // Settings
 #define INITIAL_TURN PLAYER_ONE
 #define MINIMUM_TIMEOUT 5
 
+// Animations of the terminal (milliseconds)
+#define SPINNER_FRAME_MS 100
+
+// Rows left below a frame for the messages printed after it: on a shorter
+// terminal they could scroll the frame, which is then drawn again as a whole
+#define FRAME_HEADROOM_ROWS 6
+#define FRAME_COLORS_LEN 64
+
+// Liveness (milliseconds)
+#define HEARTBEAT_INTERVAL_MS 500
+#define DEFAULT_HEARTBEAT_GRACE_MS 5000
+#define MINIMUM_HEARTBEAT_GRACE_MS (2 * HEARTBEAT_INTERVAL_MS)
+#define DEFAULT_RESUME_GRACE_MS 30000
+
 // Results
 #define NOT_FINISHED -1
 #define DRAW 0
@@ -136,6 +334,11 @@
 #define MEDIUM 2
 #define IMPOSSIBLE 3
 
+// ---------------- BENCHMARK ----------------
+
+#define BENCH_DEFAULT_ITERATIONS 10000
+#define BENCH_SPIN_YIELD_INTERVAL 1024
+
 // ----------------- MACROS ------------------
 
 #define STR2(x) #x
@@ -151,6 +354,19 @@
 #define INFINITE_TIMEOUT_SETTINGS_MESSAGE "     ─ " INFINITE_TIMEOUT_MESSAGE
 #define PLAYER_ONE_SYMBOL_SETTINGS_MESSAGE "     ─ Simbolo " PLAYER_ONE_COLOR "giocatore 1" FNRM ": %c\n"
 #define PLAYER_TWO_SYMBOL_SETTINGS_MESSAGE "     ─ Simbolo " PLAYER_TWO_COLOR "giocatore 2" FNRM ": %c\n"
+#define IPC_BACKEND_SETTINGS_MESSAGE "     ─ Backend IPC: %s"
+#define HUGE_PAGES_SETTINGS_MESSAGE " (huge pages)"
+#define HEARTBEAT_GRACE_SETTINGS_MESSAGE "     ─ Tolleranza heartbeat: %d ms\n"
+#define RESUME_GRACE_SETTINGS_MESSAGE "     ─ Posto riservato dopo una disconnessione: %d ms\n"
+#define LOBBY_SLOTS_SETTINGS_MESSAGE "     ─ Partite contemporanee: %d\n"
+#define SHARD_SETTINGS_MESSAGE "     ─ Shard: %d\n"
+#define REMATCH_SETTINGS_MESSAGE "     ─ Rivincita automatica%s\n"
+#define SWAP_SETTINGS_MESSAGE " (con scambio dei turni)"
+#define SOCKET_SETTINGS_MESSAGE "     ─ Socket: %s\n"
+#define CLOCK_SETTINGS_MESSAGE "     ─ Orologio: %d ms a giocatore, +%d ms a mossa\n"
+#define WORKER_CPUS_SETTINGS_MESSAGE "     ─ CPU dei worker: %s\n"
+#define AI_CPUS_SETTINGS_MESSAGE "     ─ CPU dei client AI: %s\n"
+#define AI_POOL_SETTINGS_MESSAGE "     ─ Client AI pronti: %d\n"
 #define LOADING_MESSAGE INFO_CHAR "Caricamento in corso...  \n"
 #define LOADING_COMPLETE_MESSAGE SUCCESS_CHAR "Caricamento completato!\n\n" FNRM
 #define WELCOME_CLIENT_MESSAGE FNRM NO_BOLD "\nBenvenuto, " FORNG "%s!" FNRM "\n\n"
@@ -158,6 +374,10 @@
 #define FINAL_STATE_MESSAGE "\n" INFO_CHAR "Stato finale della partita:\n"
 #define CLOSING_MESSAGE "\n" WARNING_CHAR "Chiusura in corso...\n"
 #define FOUND_CRASHED_SERVER_MESSAGE WARNING_CHAR "Trovato un server crashato. Ripristino delle IPC in corso...\n"
+#define UPGRADING_MESSAGE "\n" WARNING_CHAR "Aggiornamento del server in corso...\n"
+#define UPGRADED_GAMES_MESSAGE SUCCESS_CHAR "Server aggiornato. Partite in corso: %d\n"
+#define RECOVERED_GAMES_MESSAGE INFO_CHAR "Partite riprese dal server precedente: %d\n"
+#define GAME_RECOVERED_SERVER_MESSAGE "\n" INFO_CHAR "Ripresa la partita tra " FORNG "%s" FNRM " e " FORNG "%s" FNRM "\n"
 
 // Debug messages
 #define MY_PID_MESSAGE SUCCESS_CHAR "PID = %d\n"
@@ -177,11 +397,19 @@
 #define ANOTHER_PLAYER_JOINED_SERVER_MESSAGE INFO_CHAR "Un altro giocatore " FORNG "%s" FNRM " è entrato in partita "
 #define STARTS_PLAYER_MESSAGE ". Inizia il %sgiocatore %d" FNRM " (" FORNG "%s" FNRM ")\n"
 #define A_PLAYER_QUIT_SERVER_MESSAGE "\n\n" WARNING_CHAR "Il %sgiocatore %d" FNRM " (" FORNG "%s" FNRM ") ha abbandonato la partita "
+#define A_PLAYER_FLAGGED_SERVER_MESSAGE "\n\n" WARNING_CHAR "Tempo scaduto per il %sgiocatore %d" FNRM " (" FORNG "%s" FNRM ")"
 #define DRAW_MESSAGE WARNING_CHAR "Pareggio.\n"
 #define YOU_LOST_MESSAGE ERROR_CHAR "Hai perso!\n"
 #define YOU_WON_MESSAGE SUCCESS_CHAR "Hai vinto!\n"
 #define YOU_WON_FOR_QUIT_MESSAGE FGRN SUCCESS_CHAR "Hai vinto per abbandono dell'altro giocatore!\n"
 #define OPPONENT_READY_MESSAGE "Avversario pronto!"
+#define REMATCH_MESSAGE "\n" INFO_CHAR "Prossima partita in arrivo...\n"
+#define A_PLAYER_DETACHED_SERVER_MESSAGE "\n\n" WARNING_CHAR "Il %sgiocatore %d" FNRM " (" FORNG "%s" FNRM ") si è disconnesso: la partita è in pausa\n"
+#define A_PLAYER_RESUMED_SERVER_MESSAGE "\n" INFO_CHAR "Il %sgiocatore %d" FNRM " (" FORNG "%s" FNRM ") è rientrato in partita\n"
+#define RESUME_TOKEN_MESSAGE INFO_CHAR "Se perdi la connessione, riprendi la partita con: " FORNG CLIENT_EXEC_NAME " --resume %s" FNRM "\n\n"
+#define RESUMED_MESSAGE SUCCESS_CHAR "Partita ripresa!\n"
+#define OPPONENT_LEFT_SESSION_MESSAGE "\n\n" WARNING_CHAR "L'avversario ha lasciato la sessione\n"
+#define NEXT_GAME_SERVER_MESSAGE "\n" INFO_CHAR "Partita %d"
 #define OPPONENT_TURN_MESSAGE " (Turno di " FORNG "%s" FNRM ") "
 #define YOUR_SYMBOL_IS_MESSAGE INFO_CHAR FORNG "%s" FNRM ", il tuo simbolo è " BOLD "%s%c" FNRM NO_BOLD "\n"
 #define TIMEOUT_LOSS_MESSAGE ERROR_CHAR "Il tempo è scaduto. Verrai disconnesso per inattività e perderai la partita.\n"
@@ -190,6 +418,40 @@
 #define MEDIUM_MODE_MESSAGE " (" FYEL "media" FNRM ")"
 #define IMPOSSIBLE_MODE_MESSAGE " (" FRED "impossibile" FNRM ")"
 
+// Spectator messages
+#define SPECTATOR_HEADER_MESSAGE INFO_CHAR "Stai guardando la partita %d\n\n"
+#define SPECTATOR_PLAYERS_MESSAGE INFO_CHAR FORNG "%s" FNRM " (" PLAYER_ONE_COLOR "%c" FNRM ") contro " FORNG "%s" FNRM " (" PLAYER_TWO_COLOR "%c" FNRM ")\n"
+#define SPECTATOR_WAITING_MESSAGE WARNING_CHAR "In attesa dei giocatori...\n"
+#define SPECTATOR_TURN_MESSAGE WARNING_CHAR "Turno di " FORNG "%s" FNRM "\n"
+#define SPECTATOR_QUIT_MESSAGE WARNING_CHAR "Partita terminata per abbandono\n"
+
+// Lobby messages (one line per event, the games are interleaved)
+#define LOBBY_GAME_STARTED_MESSAGE INFO_CHAR "Partita %d: " FORNG "%s" FNRM " contro " FORNG "%s" FNRM "\n"
+#define LOBBY_GAME_RECOVERED_MESSAGE INFO_CHAR "Partita %d: " FORNG "%s" FNRM " contro " FORNG "%s" FNRM " (ripresa)\n"
+#define LOBBY_GAME_DRAW_MESSAGE INFO_CHAR "Partita %d: pareggio\n"
+#define LOBBY_GAME_WON_MESSAGE INFO_CHAR "Partita %d: vince " FORNG "%s" FNRM "\n"
+#define LOBBY_GAME_QUIT_MESSAGE WARNING_CHAR "Partita %d: " FORNG "%s" FNRM " ha abbandonato\n"
+#define LOBBY_GAME_FLAG_MESSAGE WARNING_CHAR "Partita %d: tempo scaduto per " FORNG "%s" FNRM "\n"
+#define WAITING_IN_QUEUE_MESSAGE FNRM WARNING_CHAR "Tutte le partite sono occupate, sei in coda...  "
+#define MATCHMAKING_STATS_MESSAGE INFO_CHAR "Matchmaking: %llu abbinamenti, attesa media %.1f ms (massima %lld ms), %llu in coda, %llu rifiutati\n"
+#define PLACEMENT_WORKER_STATS_MESSAGE INFO_CHAR "Worker %d: CPU %d (nodo %d), %llu esecuzioni sul nodo della partita, %llu su altri nodi\n"
+#define RENDER_STATS_MESSAGE INFO_CHAR "Schermate: %llu disegnate (%llu per intero), %llu byte in %llu scritture, %.1f byte e %.2f scritture per schermata\n"
+#define PLACEMENT_MEMORY_STATS_MESSAGE INFO_CHAR "Memoria delle partite: %d blocchi assegnati ai nodi dei worker, %d non spostati\n"
+#define BOT_STARTED_MESSAGE INFO_CHAR "Bot " FORNG "%s" FNRM ": %d partite alla volta\n"
+#define BOT_GAME_WON_MESSAGE SUCCESS_CHAR FORNG "%s" FNRM ": partita %d vinta\n"
+#define BOT_GAME_LOST_MESSAGE ERROR_CHAR FORNG "%s" FNRM ": partita %d persa\n"
+#define BOT_GAME_DRAW_MESSAGE WARNING_CHAR FORNG "%s" FNRM ": partita %d patta\n"
+#define BOT_GAME_LEFT_MESSAGE WARNING_CHAR FORNG "%s" FNRM ": partita %d interrotta\n"
+#define BOT_STATS_MESSAGE INFO_CHAR "Bot: %d partite giocate (%d vinte, %d perse, %d patte, %d interrotte), %d mosse in %d turni\n"
+#define LOBBY_GAME_DETACHED_MESSAGE WARNING_CHAR "Partita %d: " FORNG "%s" FNRM " si è disconnesso, la partita è in pausa\n"
+#define LOBBY_GAME_RESUMED_MESSAGE INFO_CHAR "Partita %d: " FORNG "%s" FNRM " è rientrato in partita\n"
+#define LOBBY_AI_ERROR_MESSAGE ERROR_CHAR "Partita %d: impossibile avviare l'AI\n"
+
+// Benchmark messages
+#define BENCH_HEADER_MESSAGE INFO_CHAR "Ping-pong tra due processi, %d iterazioni (latenza andata e ritorno in µs)\n\n" \
+    BOLD "     Primitiva               min        p50        p99        max     csw/iter\n" NO_BOLD
+#define BENCH_ROW_MESSAGE "     %-16s %10.2f %10.2f %10.2f %10.2f %12.2f\n"
+
 // General success messages
 #define SERVER_FOUND_SUCCESS FGRN SUCCESS_CHAR "Trovato TrisServer con PID = %d\n" FNRM
 
@@ -202,7 +464,10 @@
 #define MATRIX_INITIALIZED_MESSAGE FGRN SUCCESS_CHAR "Matrice inizializzata\n" FNRM
 #define SHARED_MEMORY_OBTAINED_SUCCESS FGRN SUCCESS_CHAR "Memoria condivisa ottenuta (ID: %d)\n" FNRM
 #define SHARED_MEMORY_ATTACHED_SUCCESS FGRN SUCCESS_CHAR "Memoria condivisa agganciata (@ %p)\n" FNRM
+#define SHARED_MEMORY_LAYOUT_SUCCESS FGRN SUCCESS_CHAR "Layout: %zu byte, %d linee di cache per partita\n" FNRM
+#define LOBBY_LAYOUT_SUCCESS FGRN SUCCESS_CHAR "Lobby: %d partite, %zu byte\n" FNRM
 #define SHARED_MEMORY_DEALLOCATION_SUCCESS FGRN SUCCESS_CHAR "Memoria condivisa deallocata\n" FNRM
+#define HUGE_PAGES_FALLBACK_MESSAGE WARNING_CHAR "Huge pages non disponibili, verranno usate pagine normali\n" FNRM
 
 // Output messages
 #define OUTPUT_RESTORED_SUCCESS FGRN SUCCESS_CHAR "Output ripristinato\n" FNRM
@@ -210,30 +475,80 @@
 // ----------------- ERRORS ------------------
 
 // General errors
-#define USAGE_ERROR_SERVER ERROR_CHAR "Uso: " FORNG "%s <timeout> <playerOneSymbol> <playerTwoSymbol>\n"
-#define USAGE_ERROR_CLIENT ERROR_CHAR "Uso: " FORNG "%s <username> [*|**|***]\n"
+#define USAGE_ERROR_SERVER ERROR_CHAR "Uso: " FORNG "%s <timeout> <playerOneSymbol> <playerTwoSymbol> [opzioni]\n" FNRM \
+    "     --ipc <sysv|posix|memfd>   backend della memoria condivisa\n" \
+    "     --huge-pages               usa huge pages (solo posix e memfd)\n" \
+    "     --grace <ms>               tempo senza heartbeat dopo cui un giocatore è considerato uscito\n" \
+    "     --resume-grace <ms>        per quanto il posto di un giocatore disconnesso resta riservato (0: mai)\n" \
+    "     --lobby <n>                numero di partite contemporanee (massimo " STR(MAX_LOBBY_SLOTS) ")\n" \
+    "     --rematch                  a fine partita ne inizia subito un'altra con gli stessi giocatori\n" \
+    "     --swap                     con --rematch, a ogni partita inizia l'altro giocatore\n" \
+    "     --ai-pool <n>              client AI avviati in anticipo e riusati tra le partite (massimo " STR(MAX_AI_POOL) ")\n" \
+    "     --socket <percorso>        accetta anche giocatori da un socket unix (protocollo binario)\n" \
+    "     --cpus <lista>             CPU dei worker (es. 0-3,8), con la memoria delle partite sul loro nodo NUMA\n" \
+    "     --ai-cpus <lista>          CPU dei client AI avviati dal server\n" \
+    "     --clock <ms>[+<ms>]        tempo di ogni giocatore per la partita e incremento a ogni mossa, gestiti\n" \
+    "                                dal server (con timeout 0)\n" \
+    "     --headless                 niente terminale: scrive gli eventi come righe JSON sullo standard output\n" \
+    "     --events <percorso>        come --headless, ma scrive gli eventi in coda al file\n" \
+    "     (SIGUSR2 aggiorna il server in esecuzione al binario attuale, senza interrompere le partite)\n"
+#define USAGE_ERROR_BENCH ERROR_CHAR "Uso: " FORNG "%s [iterazioni]\n"
+#define USAGE_ERROR_CLIENT ERROR_CHAR "Uso: " FORNG "%s <username> [*|**|***] [--shard <n>]\n" FNRM \
+    "     --watch <partita>          guarda una partita senza giocare (senza username)\n" \
+    "     --resume <codice>          riprende la partita interrotta di cui si ha il codice (senza username)\n" \
+    "     --engine <comando>         le mosse sono scelte da un motore esterno (protocollo testuale come UCI)\n" \
+    "     --games <n>                un solo processo gioca n partite alla volta, come bot (massimo " STR(MAX_BOT_GAMES) ")\n" \
+    "     --headless                 niente terminale: scrive gli eventi come righe JSON sullo standard output\n" \
+    "     --events <percorso>        come --headless, ma scrive gli eventi in coda al file\n"
 #define TOO_MANY_PLAYERS_ERROR "Troppi giocatori connessi. Riprova più tardi.\n"
 #define SAME_USERNAME_ERROR "Il nome utente è già in uso. Riprova con un altro nome.\n"
 #define INITIALIZATION_ERROR "Errore durante l'inizializzazione."
 #define INVALID_MOVE_ERROR "Mossa non valida. Riprova: "
 #define NO_SERVER_FOUND_ERROR "Nessun server trovato. Esegui TrisServer prima di eseguire TrisClient.\n"
 #define SERVER_ALREADY_RUNNING_ERROR "Il server è già in esecuzione. Esegui un solo server alla volta.\n"
+#define TOO_MANY_SHARDS_ERROR "Troppi server in esecuzione (massimo " STR(MAX_SHARDS) ")."
+#define SHARD_INVALID_ERROR "Lo shard deve essere compreso tra 0 e " STR(MAX_SHARDS) " escluso."
 #define USERNAME_TOO_LONG_ERROR "Il nome utente non può superare i 30 caratteri."
 #define USERNAME_TOO_SHORT_ERROR "Il nome utente deve contenere almeno 2 caratteri."
 #define AUTOPLAY_NOT_ALLOWED_ERROR "Non è possibile giocare in modalità AI con un altro giocatore già collegato."
 #define AI_USERNAME_ERROR "Il nome utente 'AI' è riservato per la modalità AI. Scegli un altro nome."
+#define WATCH_INVALID_ERROR "La partita da guardare non esiste."
+#define STALE_HANDLE_ERROR "La partita richiesta non esiste più."
+#define QUEUE_FULL_ERROR "La coda di attesa è piena. Riprova più tardi."
+#define BOT_GAMES_INVALID_ERROR "Il numero di partite del bot deve essere compreso tra 1 e " STR(MAX_BOT_GAMES) "."
+#define RESUME_ERROR "Impossibile riprendere la partita: il codice non è valido o è scaduto."
+#define RESUME_GRACE_INVALID_ERROR "Il tempo riservato per riprendere una partita non può essere negativo."
 #define EOF_ERROR "Hai chiuso lo standard input. Verrai disconnesso per comportamento scorretto."
 
 // Error codes
 #define TOO_MANY_PLAYERS_ERROR_CODE -1
 #define SAME_USERNAME_ERROR_CODE -2
 #define AUTOPLAY_NOT_ALLOWED_ERROR_CODE -3
+#define STALE_HANDLE_ERROR_CODE -4
+#define QUEUE_FULL_ERROR_CODE -5
+#define MATCH_PENDING_CODE -6
+#define INVALID_MESSAGE_ERROR_CODE -7
+#define INVALID_MOVE_ERROR_CODE -8
+#define RESUME_ERROR_CODE -9
 
 // Args errors
 #define TIMEOUT_INVALID_CHAR_ERROR "Il valore specificato per il timeout non è valido."
 #define TIMEOUT_TOO_LOW_ERROR "Il minimo timeout ammesso è di 5 secondi"
 #define SYMBOLS_LENGTH_ERROR "I simboli dei giocatori devono essere di un solo carattere."
 #define SYMBOLS_EQUAL_ERROR "I simboli dei giocatori devono essere diversi."
+#define IPC_BACKEND_INVALID_ERROR "Backend IPC non valido. Valori ammessi: sysv, posix, memfd."
+#define HEARTBEAT_GRACE_INVALID_ERROR "La tolleranza heartbeat deve essere di almeno " STR(MINIMUM_HEARTBEAT_GRACE_MS) " ms."
+#define LOBBY_SLOTS_INVALID_ERROR "Il numero di partite deve essere compreso tra 1 e " STR(MAX_LOBBY_SLOTS) "."
+#define AI_POOL_INVALID_ERROR "Il numero di client AI pronti deve essere compreso tra 0 e " STR(MAX_AI_POOL) "."
+#define CLOCK_INVALID_ERROR "L'orologio deve essere di almeno " STR(MINIMUM_CLOCK_MS) " ms, con un incremento non negativo (esempio: 300+50)."
+#define CLOCK_WITH_TIMEOUT_ERROR "Con --clock il tempo delle mosse è gestito dal server: il timeout deve essere 0."
+#define CPU_LIST_INVALID_ERROR "Lista di CPU non valida (esempio: 0-3,8): ogni CPU deve essere disponibile."
+#define SWAP_WITHOUT_REMATCH_ERROR "Lo scambio dei turni è disponibile solo con --rematch."
+#define HUGE_PAGES_NOT_SUPPORTED_ERROR "Le huge pages sono disponibili solo con i backend posix e memfd."
+
+// Benchmark errors
+#define ITERATIONS_INVALID_ERROR "Il numero di iterazioni deve essere un intero positivo."
+#define BENCH_IO_ERROR "Errore durante la comunicazione tra i processi del benchmark."
 
 // Semaphore errors
 #define SEMAPHORE_ALLOCATION_ERROR "Errore durante la creazione dei semafori."
@@ -249,8 +564,16 @@
 #define SHARED_MEMORY_DEALLOCATION_ERROR "Errore durante la deallocazione della memoria condivisa."
 #define SHARED_MEMORY_STATUS_ERROR "Errore durante l'ottenimento di dati sulla memoria condivisa."
 #define SHARED_MEMORY_DETACH_ERROR "Errore durante l'ottenimento dell'indirizzo della memoria condivisa."
+#define SOCKET_ERROR "Errore durante l'apertura del socket."
+#define FRAME_ERROR "Errore durante la preparazione della schermata."
+#define EVENTS_FILE_ERROR "Errore durante l'apertura del file degli eventi."
+#define ENGINE_START_ERROR "Errore durante l'avvio del motore esterno."
+#define ENGINE_MOVE_ERROR "Il motore esterno non ha dato una mossa valida in tempo."
+#define SHARED_MEMORY_HANDOFF_ERROR "Errore durante la condivisione del descrittore della memoria condivisa."
 
 // Fork errors
+#define UPGRADE_ERROR "Impossibile eseguire il nuovo binario del server."
+#define UPGRADE_STATE_ERROR "Lo stato passato dal server precedente non è valido."
 #define FORK_ERROR "Errore durante la creazione di un processo figlio."
 
 // Exec errors
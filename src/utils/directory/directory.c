@@ -0,0 +1,137 @@
+/************************************
+ * VR487434 - Lorenzo Di Berardino
+ * VR486588 - Filippo Milani
+ * 09/05/2024
+ ************************************/
+
+#include "directory.h"
+#include "../data.h"
+
+#include <errno.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <sys/ipc.h>
+#include <sys/shm.h>
+#include <unistd.h>
+
+/// @brief Check if the server of an entry of the directory is running
+static bool is_shard_alive(tris_shard_t* shard)
+{
+    pid_t pid = atomic_load(&shard->server_pid);
+
+    return pid != 0 && (kill(pid, 0) == 0 || errno == EPERM);
+}
+
+/// @brief Attach the directory of the shards. It is a small SysV segment with a
+/// well-known key, whatever the backend of the servers, created zeroed (every
+/// entry free) by the first server
+/// @param create True to create it if it does not exist
+/// @return The directory, or NULL if it does not exist and create is false
+tris_directory_t* open_directory(bool create)
+{
+    while (1) {
+        int id = shmget(DIRECTORY_ID, sizeof(tris_directory_t), create ? IPC_CREAT | PERM : PERM);
+        if (id < 0) {
+            if (!create)
+                return NULL;
+
+            errexit(SHARED_MEMORY_ALLOCATION_ERROR);
+        }
+
+        tris_directory_t* directory = shmat(id, NULL, 0);
+        if (directory != (void*)-1)
+            return directory;
+
+        // Removed by the last process out in the meantime: look again
+        if (errno != EIDRM && errno != EINVAL)
+            errexit(SHARED_MEMORY_ATTACH_ERROR);
+    }
+}
+
+/// @brief Detach the directory. The last process out removes it, if no server
+/// is registered anymore
+void close_directory(tris_directory_t* directory)
+{
+    bool in_use = false;
+    for (int i = 0; i < MAX_SHARDS && !in_use; i++)
+        in_use = is_shard_alive(&directory->shards[i]);
+
+    struct shmid_ds ds;
+    int id = shmget(DIRECTORY_ID, 0, PERM);
+    if (!in_use && id >= 0 && shmctl(id, IPC_STAT, &ds) == 0 && ds.shm_nattch == 1)
+        shmctl(id, IPC_RMID, NULL);
+
+    shmdt(directory);
+}
+
+/// @brief Claim the first free entry of the directory (or one left by a crashed
+/// server): its index is the shard of this server
+/// @return The shard, or NO_SHARD if every entry is taken
+int register_shard(tris_directory_t* directory)
+{
+    for (int i = 0; i < MAX_SHARDS; i++) {
+        tris_shard_t* shard = &directory->shards[i];
+        pid_t pid = atomic_load(&shard->server_pid);
+
+        if (pid != 0 && is_shard_alive(shard))
+            continue;
+
+        if (atomic_compare_exchange_strong(&shard->server_pid, &pid, getpid())) {
+            atomic_store(&shard->capacity, 0);
+            atomic_store(&shard->load, 0);
+            return i;
+        }
+    }
+
+    return NO_SHARD;
+}
+
+/// @brief Open the shard to the clients, once its IPCs are ready
+/// @param directory The directory
+/// @param index The shard
+/// @param backend The IPC backend of the server
+/// @param capacity The number of game slots of the server
+void publish_shard(tris_directory_t* directory, int index, int backend, int capacity)
+{
+    directory->shards[index].backend = backend;
+    atomic_store_explicit(&directory->shards[index].capacity, capacity, memory_order_release);
+}
+
+/// @brief Give the entry of a shard back
+void unregister_shard(tris_directory_t* directory, int index)
+{
+    atomic_store(&directory->shards[index].capacity, 0);
+    atomic_store(&directory->shards[index].server_pid, 0);
+}
+
+/// @brief Account for the game slots taken (positive) or given back (negative)
+void add_shard_load(tris_directory_t* directory, int index, int delta)
+{
+    atomic_fetch_add_explicit(&directory->shards[index].load, delta, memory_order_relaxed);
+}
+
+/// @brief Find the running shard with the lowest share of its slots in use
+/// @return The shard, or NO_SHARD if no server is running
+int find_least_loaded_shard(tris_directory_t* directory)
+{
+    int best = NO_SHARD;
+    long long best_load = 0, best_capacity = 1;
+
+    for (int i = 0; i < MAX_SHARDS; i++) {
+        tris_shard_t* shard = &directory->shards[i];
+        long long capacity = atomic_load_explicit(&shard->capacity, memory_order_acquire);
+        long long load = atomic_load_explicit(&shard->load, memory_order_relaxed);
+
+        if (capacity <= 0 || !is_shard_alive(shard))
+            continue;
+
+        // load / capacity < best_load / best_capacity, without divisions
+        if (best == NO_SHARD || load * best_capacity < best_load * capacity) {
+            best = i;
+            best_load = load;
+            best_capacity = capacity;
+        }
+    }
+
+    return best;
+}
@@ -0,0 +1,21 @@
+/************************************
+ * VR487434 - Lorenzo Di Berardino
+ * VR486588 - Filippo Milani
+ * 09/05/2024
+ ************************************/
+
+#ifndef DIRECTORY_H
+#define DIRECTORY_H
+
+#include <stdbool.h>
+#include "../globals.h"
+
+tris_directory_t* open_directory(bool);
+void close_directory(tris_directory_t*);
+int register_shard(tris_directory_t*);
+void publish_shard(tris_directory_t*, int, int, int);
+void unregister_shard(tris_directory_t*, int);
+void add_shard_load(tris_directory_t*, int, int);
+int find_least_loaded_shard(tris_directory_t*);
+
+#endif
@@ -0,0 +1,286 @@
+/************************************
+ * VR487434 - Lorenzo Di Berardino
+ * VR486588 - Filippo Milani
+ * 09/05/2024
+ ************************************/
+
+#define _GNU_SOURCE
+
+#include "engine.h"
+#include "../data.h"
+#include "../globals.h"
+#include "../lobby/lobby.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+// An external engine plays the moves of a client. It is started once, through
+// the shell, and kept for all the games; it reads commands on its standard input
+// and replies on its standard output, one line each, as in UCI:
+//
+//   uci                        ->  uciok             (once, at the start)
+//   ucinewgame                                       (before every game)
+//   position <board> <player>                        (the board: 9 cells, row by
+//                                                     row, each one '.', '1' or '2')
+//   go movetime <ms>           ->  bestmove <cell>   (the cell as typed, e.g. B2)
+//   quit
+//
+// Any other line of the engine is ignored. Both pipes are non-blocking: the
+// client never waits on them for longer than the time given to the engine
+
+static pid_t engine_pid = 0;
+static int to_engine = -1;
+static int from_engine = -1;
+
+// Lines read from the engine, up to the last complete one
+static char reply_buffer[ENGINE_LINE_LEN];
+static int reply_len = 0;
+
+static bool send_command(const char*);
+static bool read_reply(char*, const char*, long long);
+static bool take_line(char*);
+
+/// @brief Start the engine, and wait for it to be ready
+/// @param command The command line of the engine, run by the shell
+void start_engine(const char* command)
+{
+    int input[2], output[2];
+
+    if (pipe2(input, O_CLOEXEC) < 0 || pipe2(output, O_CLOEXEC) < 0)
+        errexit(ENGINE_START_ERROR);
+
+    if ((engine_pid = fork()) < 0)
+        errexit(ENGINE_START_ERROR);
+
+    if (engine_pid == 0) {
+        // The engine starts with the signals of a new process, out of the
+        // process group of the terminal: a CTRL+C is for the player only
+        setpgid(0, 0);
+
+        sigset_t set;
+        sigemptyset(&set);
+        sigprocmask(SIG_SETMASK, &set, NULL);
+
+        dup2(input[0], STDIN_FILENO);
+        dup2(output[1], STDOUT_FILENO);
+
+        execl("/bin/sh", "sh", "-c", command, NULL);
+        _exit(EXIT_FAILURE);
+    }
+
+    close(input[0]);
+    close(output[1]);
+    to_engine = input[1];
+    from_engine = output[0];
+
+    fcntl(to_engine, F_SETFL, O_NONBLOCK);
+    fcntl(from_engine, F_SETFL, O_NONBLOCK);
+
+    char line[ENGINE_LINE_LEN];
+    if (!send_command(ENGINE_HELLO_COMMAND) || !read_reply(line, ENGINE_HELLO_REPLY, monotonic_ms() + ENGINE_START_MS))
+        errexit(ENGINE_START_ERROR);
+}
+
+/// @brief Ask the engine to quit, and make sure it is gone
+void stop_engine()
+{
+    if (engine_pid <= 0)
+        return;
+
+    send_command(ENGINE_QUIT_COMMAND);
+    close(to_engine);
+    close(from_engine);
+
+    // An engine that does not quit by itself is killed
+    long long deadline = monotonic_ms() + ENGINE_START_MS;
+    while (waitpid(engine_pid, NULL, WNOHANG) == 0) {
+        if (monotonic_ms() >= deadline) {
+            kill(engine_pid, SIGKILL);
+            waitpid(engine_pid, NULL, 0);
+            break;
+        }
+
+        usleep(1000);
+    }
+
+    engine_pid = 0;
+}
+
+/// @brief Tell the engine that a new game starts
+void new_engine_game()
+{
+    send_command(ENGINE_NEW_GAME_COMMAND);
+}
+
+/// @brief Ask the engine for its move
+/// @param matrix The board
+/// @param player The player the engine moves for
+/// @param movetime The time the engine is given, in milliseconds
+/// @return The index of the cell, or -1 if the engine gave no valid move in time
+int ask_engine(int* matrix, int player, int movetime)
+{
+    int cell;
+
+    return ask_engine_moves(&matrix, &player, &cell, 1, movetime) == 1 ? cell : -1;
+}
+
+/// @brief Ask the engine for the moves of several games at once: all the
+/// positions leave in the same write, and the moves are read back in order
+/// @param matrices The boards
+/// @param players The players the engine moves for, one per board
+/// @param cells Where to store the index of the cell of each move
+/// @param n The number of boards, at most MAX_BOT_GAMES
+/// @param movetime The time the engine is given for each board, in milliseconds
+/// @return The number of valid moves given in time, before the first missing one
+int ask_engine_moves(int** matrices, const int* players, int* cells, int n, int movetime)
+{
+    char commands[MAX_BOT_GAMES * ENGINE_LINE_LEN];
+    int len = 0;
+    commands[0] = '\0';
+
+    for (int i = 0; i < n; i++) {
+        char board[MATRIX_SIZE + 1];
+
+        for (int j = 0; j < MATRIX_SIZE; j++)
+            board[j] = matrices[i][j] == 0 ? '.' : '0' + matrices[i][j];
+        board[MATRIX_SIZE] = '\0';
+
+        len += snprintf(commands + len, sizeof(commands) - len, ENGINE_POSITION_COMMAND ENGINE_GO_COMMAND,
+            board, players[i], movetime);
+    }
+
+    if (!send_command(commands))
+        return 0;
+
+    // The engine searches the positions one after the other
+    long long deadline = monotonic_ms() + (long long)movetime * n + ENGINE_GRACE_MS;
+
+    for (int i = 0; i < n; i++) {
+        char line[ENGINE_LINE_LEN];
+        char cell[ENGINE_LINE_LEN];
+        move_t move;
+
+        if (!read_reply(line, ENGINE_MOVE_REPLY, deadline)
+            || sscanf(line + strlen(ENGINE_MOVE_REPLY), "%s", cell) != 1 || !is_valid_move(matrices[i], cell, &move))
+            return i;
+
+        cells[i] = move.col * MATRIX_SIDE_LEN + move.row;
+    }
+
+    return n;
+}
+
+/// @brief Get the time the move of a player can take, leaving the grace to the
+/// reply of the engine. In a game with clocks, it is a share of the time left
+/// to the player: the moves it has still to make split it, and each one brings
+/// the increment back. Otherwise it is the timeout of the game
+/// @param game The game
+/// @param player The player on turn
+/// @return The time in milliseconds, or NO_MOVE_LIMIT if the game has no limit
+long long get_move_budget(tris_game_t* game, int player)
+{
+    long long left = get_time_left(game, player);
+
+    if (left == NO_TIME_LEFT)
+        return game->timeout == 0 ? NO_MOVE_LIMIT : game->timeout * 1000LL - ENGINE_GRACE_MS;
+
+    // The moves still to make by the player on turn, this one included
+    int empty = 0;
+    for (int i = 0; i < MATRIX_SIZE; i++)
+        empty += game->matrix[i] == 0;
+
+    long long share = left / ((empty + 1) / 2) + game->clock_increment_ms;
+
+    return share < left - ENGINE_GRACE_MS ? share : left - ENGINE_GRACE_MS;
+}
+
+/// @brief Write a command to the engine, as a whole
+/// @return False if the engine is gone
+static bool send_command(const char* command)
+{
+    size_t len = strlen(command);
+
+    while (len > 0) {
+        ssize_t n = write(to_engine, command, len);
+
+        if (n < 0 && errno == EAGAIN) {
+            struct pollfd fd = { .fd = to_engine, .events = POLLOUT };
+            poll(&fd, 1, ENGINE_GRACE_MS);
+            continue;
+        }
+
+        if (n <= 0 && errno != EINTR)
+            return false;
+
+        if (n > 0) {
+            command += n;
+            len -= n;
+        }
+    }
+
+    return true;
+}
+
+/// @brief Wait for a line of the engine starting with a given reply
+/// @param line Where to store the line
+/// @param reply The start of the line
+/// @param deadline The monotonic time to wait until
+/// @return False if the engine is gone or late
+static bool read_reply(char* line, const char* reply, long long deadline)
+{
+    while (1) {
+        while (take_line(line)) {
+            if (strncmp(line, reply, strlen(reply)) == 0)
+                return true;
+        }
+
+        long long left = deadline - monotonic_ms();
+        if (left <= 0)
+            return false;
+
+        struct pollfd fd = { .fd = from_engine, .events = POLLIN };
+        if (poll(&fd, 1, left) <= 0)
+            continue;
+
+        ssize_t n = read(from_engine, reply_buffer + reply_len, sizeof(reply_buffer) - 1 - reply_len);
+        if (n == 0 || (n < 0 && errno != EAGAIN && errno != EINTR))
+            return false;
+
+        if (n > 0)
+            reply_len += n;
+
+        // A line longer than the buffer is dropped
+        if (reply_len == (int)sizeof(reply_buffer) - 1 && memchr(reply_buffer, '\n', reply_len) == NULL)
+            reply_len = 0;
+    }
+}
+
+/// @brief Take the first complete line out of what has been read from the engine
+/// @param line Where to store the line, without its newline
+/// @return False if no line is complete yet
+static bool take_line(char* line)
+{
+    char* end = memchr(reply_buffer, '\n', reply_len);
+    if (end == NULL)
+        return false;
+
+    int len = end - reply_buffer;
+    memcpy(line, reply_buffer, len);
+    line[len] = '\0';
+
+    // Lines ended by CRLF too
+    if (len > 0 && line[len - 1] == '\r')
+        line[len - 1] = '\0';
+
+    reply_len -= len + 1;
+    memmove(reply_buffer, end + 1, reply_len);
+
+    return true;
+}
@@ -0,0 +1,19 @@
+/************************************
+ * VR487434 - Lorenzo Di Berardino
+ * VR486588 - Filippo Milani
+ * 09/05/2024
+ ************************************/
+
+#ifndef ENGINE_H
+#define ENGINE_H
+
+#include "../globals.h"
+
+void start_engine(const char*);
+void stop_engine();
+void new_engine_game();
+int ask_engine(int*, int, int);
+int ask_engine_moves(int**, const int*, int*, int, int);
+long long get_move_budget(tris_game_t*, int);
+
+#endif
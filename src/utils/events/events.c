@@ -0,0 +1,160 @@
+/************************************
+ * VR487434 - Lorenzo Di Berardino
+ * VR486588 - Filippo Milani
+ * 09/05/2024
+ ************************************/
+
+#define _GNU_SOURCE
+
+#include "events.h"
+#include "../data.h"
+#include "../globals.h"
+
+#include <fcntl.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+// In headless mode nothing is drawn on the terminal: the output of a process is
+// its events, one JSON record per line. A record is written with a single write,
+// in append mode, so that the processes sharing a file never mix their lines.
+// Whatever the program still prints goes to /dev/null
+
+static bool headless = false;
+static int events_fd = -1;
+static bool on_stdout = false;
+
+static void emit(const char*, const char*, ...);
+static void escape_string(char*, size_t, const char*);
+
+/// @brief Switch to headless mode: the events are written to a file, or to the
+/// standard output, which is taken from the rest of the program
+/// @param path The path of the file (appended to), or NULL for the standard output
+void open_events(const char* path)
+{
+    int fd = path == NULL ? fcntl(STDOUT_FILENO, F_DUPFD_CLOEXEC, 0)
+                          : open(path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (fd < 0)
+        errexit(EVENTS_FILE_ERROR);
+
+    int null_fd = open("/dev/null", O_WRONLY);
+    if (null_fd < 0)
+        errexit(EVENTS_FILE_ERROR);
+
+    fflush(stdout);
+    dup2(null_fd, STDOUT_FILENO);
+    close(null_fd);
+
+    events_fd = fd;
+    on_stdout = path == NULL;
+    headless = true;
+}
+
+/// @brief Give the standard output back to the events written there, before the
+/// process executes a new image (which takes it again)
+void release_events()
+{
+    if (!on_stdout)
+        return;
+
+    dup2(events_fd, STDOUT_FILENO);
+}
+
+/// @brief Check if the process runs without a terminal to draw on
+bool is_headless()
+{
+    return headless;
+}
+
+/// @brief A player joined a game
+void emit_join(int game, int player, const char* username)
+{
+    char name[EVENT_STRING_LEN];
+    escape_string(name, sizeof(name), username);
+
+    emit("join", EVENT_JOIN_FORMAT, game, player, name);
+}
+
+/// @brief A player made a move
+/// @param cell The index of the cell in the matrix
+void emit_move(int game, int player, int cell)
+{
+    emit("move", EVENT_MOVE_FORMAT, game, player, 'A' + cell % MATRIX_SIDE_LEN, 1 + cell / MATRIX_SIDE_LEN);
+}
+
+/// @brief A game ended
+/// @param result The result of the game (DRAW, the player who won, or QUIT)
+/// @param winner The player who won (0 for a draw)
+void emit_result(int game, int result, int winner)
+{
+    emit("result", EVENT_RESULT_FORMAT, game,
+        result == DRAW ? "draw" : result == QUIT ? "quit" : "win", winner);
+}
+
+/// @brief A player left a game before its end
+/// @param reason Why (one of the EVENT_REASON_*)
+void emit_quit(int game, int player, const char* reason)
+{
+    emit("quit", EVENT_QUIT_FORMAT, game, player, reason);
+}
+
+/// @brief The process is exiting on an error
+void emit_error(const char* message)
+{
+    char text[EVENT_STRING_LEN];
+    escape_string(text, sizeof(text), message);
+
+    emit("error", EVENT_ERROR_FORMAT, text);
+}
+
+/// @brief Write a record, with the time and the process in front of its fields
+/// @param event The name of the event
+/// @param format The format of the fields, each one preceded by a comma
+static void emit(const char* event, const char* format, ...)
+{
+    if (!headless)
+        return;
+
+    char record[EVENT_RECORD_LEN];
+    int len = snprintf(record, sizeof(record), EVENT_HEADER_FORMAT, monotonic_ms(), getpid(), event);
+
+    va_list args;
+    va_start(args, format);
+    len += vsnprintf(record + len, sizeof(record) - len, format, args);
+    va_end(args);
+
+    // A record that does not fit is cut, but still closed
+    if (len > (int)sizeof(record) - 3)
+        len = sizeof(record) - 3;
+    record[len++] = '}';
+    record[len++] = '\n';
+
+    if (write(events_fd, record, len) < 0)
+        return;
+}
+
+/// @brief Copy a string as the content of a JSON string: the quotes and the
+/// backslashes are escaped, the control characters (the colors) dropped
+static void escape_string(char* dst, size_t len, const char* src)
+{
+    size_t j = 0;
+
+    for (size_t i = 0; src[i] != '\0' && j + 2 < len; i++) {
+        unsigned char c = src[i];
+
+        if (c == '"' || c == '\\')
+            dst[j++] = '\\';
+        else if (c < 0x20) {
+            // Skip the rest of an escape sequence, up to its final letter
+            if (c == 0x1b)
+                while (src[i + 1] != '\0' && !(src[i] >= 'A' && src[i] <= 'Z') && !(src[i] >= 'a' && src[i] <= 'z'))
+                    i++;
+            continue;
+        }
+
+        dst[j++] = c;
+    }
+
+    dst[j] = '\0';
+}
@@ -0,0 +1,21 @@
+/************************************
+ * VR487434 - Lorenzo Di Berardino
+ * VR486588 - Filippo Milani
+ * 09/05/2024
+ ************************************/
+
+#ifndef EVENTS_H
+#define EVENTS_H
+
+#include <stdbool.h>
+
+void open_events(const char*);
+void release_events();
+bool is_headless();
+void emit_join(int, int, const char*);
+void emit_move(int, int, int);
+void emit_result(int, int, int);
+void emit_quit(int, int, const char*);
+void emit_error(const char*);
+
+#endif
@@ -0,0 +1,911 @@
+/************************************
+ * VR487434 - Lorenzo Di Berardino
+ * VR486588 - Filippo Milani
+ * 09/05/2024
+ ************************************/
+
+#define _GNU_SOURCE
+
+#include "frontend.h"
+#include "../data.h"
+#include "../lobby/lobby.h"
+#include "../matchmaking/matchmaking.h"
+#include "../semaphores/semaphores.h"
+#include "../shared_memory/shared_memory.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+// The players on the socket are played by a thread of the server on their
+// behalf: it queues their joins, writes their moves on the board and sends
+// them the state of their game. To the sessions they look like any other
+// player, whose pid is the one of the server
+
+// ID of a remote player: a generation, bumped when the entry is reused, and
+// the index of the entry
+#define REMOTE_ID(generation, index) (((uint32_t)(generation) << 16) | (uint32_t)(index))
+#define REMOTE_INDEX(id) ((id) & 0xffff)
+#define REMOTE_GENERATION(id) ((id) >> 16)
+
+// A player on the socket. Only the thread of the front-end touches it (every
+// field is hashed by get_remote_layout, for the upgrades)
+typedef struct {
+    int state;
+    uint16_t generation;
+    struct sockaddr_un address;
+    socklen_t address_len;
+    bool share_memory;
+    long long last_seen;
+    uint64_t ticket;
+    uint64_t handle;
+    tris_game_t* game;
+    int slot;
+    int index;
+    int ready_round;
+    int result_round;
+    bool state_requested;
+    tris_message_t last_state;
+} remote_t;
+
+// A message waiting for the next batch, with the descriptor it carries (if any)
+typedef struct {
+    tris_message_t message;
+    struct sockaddr_un address;
+    socklen_t address_len;
+    int fd;
+    _Alignas(struct cmsghdr) char control[CMSG_SPACE(sizeof(int))];
+} outgoing_t;
+
+static tris_lobby_t* lobby = NULL;
+static int shm_id = -1;
+static bool rematch = false;
+static int heartbeat_grace = DEFAULT_HEARTBEAT_GRACE_MS;
+
+static int socket_fd = -1;
+static int event_fd = -1;
+static char socket_path[sizeof(((struct sockaddr_un*)0)->sun_path)];
+static pthread_t frontend_tid = 0;
+static atomic_bool stopping = false;
+
+// As many entries as the players of the arena, with a stack of the free ones
+static remote_t* remotes = NULL;
+static int n_remotes = 0;
+static int* free_remotes = NULL;
+static int n_free = 0;
+
+// For every player of every slot: the entry playing there, read by the thread
+// only, and the events posted by the sessions, to be handled by the thread
+static int* owners = NULL;
+static atomic_int* remote_events = NULL;
+
+static outgoing_t outgoing[SOCKET_BATCH];
+static int n_outgoing = 0;
+
+static void* frontend_handler(void*);
+static uint32_t get_remote_layout();
+
+/// @brief Get the key of the seat of a player, in owners and remote_events
+static int get_seat(int slot, int index)
+{
+    return slot * PID_ARRAY_LEN + index;
+}
+
+static uint32_t get_remote_id(remote_t* remote)
+{
+    return REMOTE_ID(remote->generation, remote - remotes);
+}
+
+/// @brief Start the front-end on a unix datagram socket, or go on with the
+/// socket and the players adopted from the previous image of the server
+/// @param new_lobby The lobby
+/// @param new_shm_id The shared memory of the lobby, passed read-only to the
+/// players of the same user as the server who ask for it
+/// @param path The path of the socket
+/// @param new_rematch Whether the players of a game stay for the next one
+/// @param grace The time without messages after which a player is gone
+void start_frontend(tris_lobby_t* new_lobby, int new_shm_id, const char* path, bool new_rematch, int grace)
+{
+    lobby = new_lobby;
+    shm_id = new_shm_id;
+    rematch = new_rematch;
+    heartbeat_grace = grace;
+
+    struct sockaddr_un addr = { 0 };
+    addr.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr.sun_path))
+        errexit(SOCKET_ERROR);
+    strcpy(addr.sun_path, path);
+
+    // The players adopted are only kept if they were as many
+    if (remotes != NULL && n_remotes != 2 * lobby->n_slots) {
+        free(remotes);
+        remotes = NULL;
+    }
+
+    n_remotes = 2 * lobby->n_slots;
+    if (remotes == NULL)
+        remotes = calloc(n_remotes, sizeof(remote_t));
+    free_remotes = malloc(n_remotes * sizeof(int));
+    owners = malloc(lobby->n_slots * PID_ARRAY_LEN * sizeof(int));
+    remote_events = calloc(lobby->n_slots * PID_ARRAY_LEN, sizeof(atomic_int));
+    if (remotes == NULL || free_remotes == NULL || owners == NULL || remote_events == NULL)
+        errexit(INITIALIZATION_ERROR);
+
+    for (int i = 0; i < lobby->n_slots * PID_ARRAY_LEN; i++)
+        owners[i] = NO_REMOTE;
+
+    // In reverse order, so that the first entry is the first one taken. The
+    // players adopted keep their entries, and those who play their seats: the
+    // thread looks at their games once, for what changed during the upgrade
+    for (int i = n_remotes - 1; i >= 0; i--) {
+        remote_t* remote = &remotes[i];
+
+        if (remote->state == REMOTE_FREE) {
+            free_remotes[n_free++] = i;
+        } else if (remote->state == REMOTE_PLAYING) {
+            remote->game = get_game_at(lobby, remote->slot);
+            owners[get_seat(remote->slot, remote->index)] = i;
+            atomic_store(&remote_events[get_seat(remote->slot, remote->index)], REMOTE_EVENT_CHANGED);
+        }
+    }
+
+    if ((event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) < 0)
+        errexit(SOCKET_ERROR);
+
+    strcpy(socket_path, path);
+
+    // The socket adopted is still bound to the path, with the messages sent
+    // meanwhile. The socket left by a crashed server is replaced (but nothing
+    // else is)
+    if (socket_fd < 0) {
+        struct stat st;
+        if (stat(path, &st) == 0 && S_ISSOCK(st.st_mode))
+            unlink(path);
+
+        // Every datagram comes with the credentials of its sender
+        int one = 1;
+        socket_fd = socket(AF_UNIX, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (socket_fd < 0
+            || setsockopt(socket_fd, SOL_SOCKET, SO_PASSCRED, &one, sizeof(one)) < 0
+            || bind(socket_fd, (struct sockaddr*)&addr, sizeof(addr)) < 0
+            || chmod(path, SOCKET_PERM) < 0)
+            errexit(SOCKET_ERROR);
+    }
+
+    // The signals are handled by the main thread only
+    sigset_t set, old_set;
+    sigfillset(&set);
+    pthread_sigmask(SIG_SETMASK, &set, &old_set);
+
+    if (pthread_create(&frontend_tid, NULL, frontend_handler, NULL) != 0)
+        errexit(INITIALIZATION_ERROR);
+
+    pthread_sigmask(SIG_SETMASK, &old_set, NULL);
+}
+
+/// @brief Stop the front-end, once the other threads of the server are gone: the
+/// messages still to be sent (the results, the quits) are sent first. The socket
+/// and the players are kept, for the next image of the server on an upgrade
+void stop_frontend()
+{
+    if (frontend_tid == 0)
+        return;
+
+    atomic_store(&stopping, true);
+    wake_frontend();
+    pthread_join(frontend_tid, NULL);
+    frontend_tid = 0;
+
+    close(event_fd);
+}
+
+/// @brief Close the socket of the front-end, once stopped, and remove its path
+void dispose_frontend()
+{
+    if (socket_fd < 0)
+        return;
+
+    close(socket_fd);
+    socket_fd = -1;
+    unlink(socket_path);
+}
+
+/// @brief Keep the socket of the stopped front-end open across the exec of a new
+/// image of the server: the messages sent meanwhile wait in it
+/// @return The socket, or -1 if there is no front-end
+int keep_frontend_on_exec()
+{
+    if (socket_fd >= 0 && fcntl(socket_fd, F_SETFD, 0) < 0)
+        errexit(SOCKET_ERROR);
+
+    return socket_fd;
+}
+
+/// @brief Write the players of the stopped front-end after the state handed over
+/// to the new image of the server: the layout of their entries, their number and
+/// the entries
+/// @param fd The descriptor of the state
+/// @return False if the players could not be written
+bool save_frontend_state(int fd)
+{
+    uint32_t layout = get_remote_layout();
+    size_t size = n_remotes * sizeof(remote_t);
+
+    return write(fd, &layout, sizeof(layout)) == sizeof(layout)
+        && write(fd, &n_remotes, sizeof(n_remotes)) == sizeof(n_remotes)
+        && write(fd, remotes, size) == (ssize_t)size;
+}
+
+/// @brief Take over the socket and the players of the front-end of the previous
+/// image of the server, before it is started again with them
+/// @param kept_socket The socket kept open by the previous image, or -1
+/// @param state_fd The descriptor of the state, at the players, or -1 if they
+/// cannot go on (their games have not been handed over)
+/// @return True if the players have been taken over
+bool adopt_frontend(int kept_socket, int state_fd)
+{
+    if (kept_socket < 0)
+        return false;
+
+    if (fcntl(kept_socket, F_SETFD, FD_CLOEXEC) < 0)
+        errexit(SOCKET_ERROR);
+    socket_fd = kept_socket;
+
+    uint32_t layout;
+    int count;
+    if (state_fd < 0 || read(state_fd, &layout, sizeof(layout)) != sizeof(layout) || layout != get_remote_layout()
+        || read(state_fd, &count, sizeof(count)) != sizeof(count) || count <= 0
+        || (remotes = malloc(count * sizeof(remote_t))) == NULL)
+        return false;
+
+    if (read(state_fd, remotes, count * sizeof(remote_t)) != (ssize_t)(count * sizeof(remote_t))) {
+        free(remotes);
+        remotes = NULL;
+        return false;
+    }
+
+    n_remotes = count;
+
+    return true;
+}
+
+/// @brief Hash the layout of the entries of the players: the offset and the size
+/// of every field. The players handed over on an upgrade are taken as they are
+/// only by an image that lays them out the same way
+static uint32_t get_remote_layout()
+{
+#define REMOTE_FIELD(field) offsetof(remote_t, field), sizeof(((remote_t*)0)->field)
+    uint64_t fields[] = { sizeof(remote_t), REMOTE_FIELD(state), REMOTE_FIELD(generation), REMOTE_FIELD(address),
+        REMOTE_FIELD(address_len), REMOTE_FIELD(share_memory), REMOTE_FIELD(last_seen), REMOTE_FIELD(ticket),
+        REMOTE_FIELD(handle), REMOTE_FIELD(game), REMOTE_FIELD(slot), REMOTE_FIELD(index), REMOTE_FIELD(ready_round),
+        REMOTE_FIELD(result_round), REMOTE_FIELD(state_requested), REMOTE_FIELD(last_state) };
+#undef REMOTE_FIELD
+    const unsigned char* bytes = (const unsigned char*)fields;
+    uint32_t hash = 2166136261u;
+
+    for (size_t i = 0; i < sizeof(fields); i++)
+        hash = (hash ^ bytes[i]) * 16777619u;
+
+    return hash;
+}
+
+/// @brief Wake up the thread of the front-end
+void wake_frontend()
+{
+    uint64_t one = 1;
+
+    // A full counter wakes the thread up all the same
+    if (write(event_fd, &one, sizeof(one)) < 0)
+        return;
+}
+
+/// @brief Tell the front-end that the game of a slot changed, if it is played by
+/// a remote player
+void notify_frontend(int slot)
+{
+    if (frontend_tid == 0)
+        return;
+
+    tris_game_t* game = get_game_at(lobby, slot);
+    bool remote = false;
+
+    for (int i = PLAYER_ONE; i <= PLAYER_TWO; i++) {
+        if (game->players[i].pid != getpid())
+            continue;
+
+        atomic_fetch_or(&remote_events[get_seat(slot, i)], REMOTE_EVENT_CHANGED);
+        remote = true;
+    }
+
+    if (remote)
+        wake_frontend();
+}
+
+/// @brief Deliver a signal of the server to a remote player, as an event
+/// @param slot The slot of the game
+/// @param index The index of the player
+/// @param sig SIGUSR2 (the game is ended), or SIGUSR1 or SIGALRM (the player is
+/// sent away, or ran out of time)
+/// @return False if the player is not remote, and has to be signalled
+bool signal_remote_player(int slot, int index, int sig)
+{
+    if (frontend_tid == 0 || get_game_at(lobby, slot)->players[index].pid != getpid())
+        return false;
+
+    atomic_fetch_or(&remote_events[get_seat(slot, index)], sig == SIGUSR2 ? REMOTE_EVENT_ENDED : REMOTE_EVENT_QUIT);
+    wake_frontend();
+
+    return true;
+}
+
+// --------- OUTGOING MESSAGES ---------
+
+/// @brief Send the messages waiting for the batch at once. A message that cannot
+/// be delivered (the client is gone, or it does not read) is dropped
+static void flush_messages()
+{
+    static struct mmsghdr headers[SOCKET_BATCH];
+    static struct iovec iovs[SOCKET_BATCH];
+
+    for (int i = 0; i < n_outgoing; i++) {
+        outgoing_t* out = &outgoing[i];
+
+        iovs[i].iov_base = &out->message;
+        iovs[i].iov_len = sizeof(out->message);
+
+        memset(&headers[i], 0, sizeof(headers[i]));
+        headers[i].msg_hdr.msg_name = &out->address;
+        headers[i].msg_hdr.msg_namelen = out->address_len;
+        headers[i].msg_hdr.msg_iov = &iovs[i];
+        headers[i].msg_hdr.msg_iovlen = 1;
+
+        if (out->fd < 0)
+            continue;
+
+        headers[i].msg_hdr.msg_control = out->control;
+        headers[i].msg_hdr.msg_controllen = sizeof(out->control);
+
+        struct cmsghdr* cmsg = CMSG_FIRSTHDR(&headers[i].msg_hdr);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+        memcpy(CMSG_DATA(cmsg), &out->fd, sizeof(int));
+    }
+
+    int sent = 0;
+    while (sent < n_outgoing) {
+        int n = sendmmsg(socket_fd, headers + sent, n_outgoing - sent, MSG_DONTWAIT | MSG_NOSIGNAL);
+
+        // The first message of the rest failed: it is skipped
+        if (n <= 0)
+            n = errno == EINTR ? 0 : 1;
+
+        sent += n;
+    }
+
+    for (int i = 0; i < n_outgoing; i++) {
+        if (outgoing[i].fd >= 0)
+            close(outgoing[i].fd);
+    }
+
+    n_outgoing = 0;
+}
+
+/// @brief Put a message in the batch, sending the batch if it is full
+/// @param address The address of the client
+/// @param address_len The length of the address
+/// @param message The message
+/// @param fd The descriptor passed with the message (closed once sent), or -1
+static void send_message(struct sockaddr_un* address, socklen_t address_len, tris_message_t* message, int fd)
+{
+    if (n_outgoing == SOCKET_BATCH)
+        flush_messages();
+
+    outgoing_t* out = &outgoing[n_outgoing++];
+    out->message = *message;
+    memcpy(&out->address, address, address_len);
+    out->address_len = address_len;
+    out->fd = fd;
+}
+
+static void init_message(tris_message_t* message, int type, uint32_t id)
+{
+    memset(message, 0, sizeof(*message));
+    message->type = type;
+    message->id = id;
+}
+
+static void send_error(struct sockaddr_un* address, socklen_t address_len, uint32_t id, int code)
+{
+    tris_message_t message;
+    init_message(&message, MESSAGE_ERROR, id);
+    message.value = code;
+
+    send_message(address, address_len, &message, -1);
+}
+
+static void send_leave(remote_t* remote)
+{
+    tris_message_t message;
+    init_message(&message, MESSAGE_LEAVE, get_remote_id(remote));
+
+    send_message(&remote->address, remote->address_len, &message, -1);
+}
+
+// --------- REMOTE PLAYERS ---------
+
+/// @brief Give an entry back to the free stack: its ID becomes stale
+static void free_remote(remote_t* remote)
+{
+    if (remote->state == REMOTE_PLAYING && owners[get_seat(remote->slot, remote->index)] == remote - remotes)
+        owners[get_seat(remote->slot, remote->index)] = NO_REMOTE;
+
+    remote->state = REMOTE_FREE;
+    free_remotes[n_free++] = remote - remotes;
+}
+
+/// @brief Find the entry of a message: it must come from the address of the player
+/// @return The entry, or NULL if the ID is unknown or stale
+static remote_t* find_remote(uint32_t id, struct sockaddr_un* address, socklen_t address_len)
+{
+    if (REMOTE_INDEX(id) >= (uint32_t)n_remotes)
+        return NULL;
+
+    remote_t* remote = &remotes[REMOTE_INDEX(id)];
+    if (remote->state == REMOTE_FREE || remote->generation != REMOTE_GENERATION(id)
+        || remote->address_len != address_len || memcmp(&remote->address, address, address_len) != 0)
+        return NULL;
+
+    return remote;
+}
+
+/// @brief Check if a remote player still holds its seat: the slot may have been
+/// given to another game, or the player removed by the server (e.g. the reaper)
+static bool is_seat_held(remote_t* remote)
+{
+    return owners[get_seat(remote->slot, remote->index)] == remote - remotes
+        && get_game_by_handle(lobby, remote->handle) != NULL
+        && remote->game->players[remote->index].pid == getpid()
+        && atomic_load(&remote->game->players[remote->index].state) == SLOT_READY;
+}
+
+/// @brief Withdraw the request of a queued player, leaving the game it has been
+/// placed in if the matcher was faster
+static void leave_queue(remote_t* remote)
+{
+    uint64_t handle;
+
+    if (cancel_join_request(lobby, remote->ticket))
+        return;
+
+    int index = take_match(lobby, remote->ticket, &handle);
+    tris_game_t* placed = index >= 0 ? get_game_by_handle(lobby, handle) : NULL;
+
+    if (placed != NULL)
+        request_quit(lobby, placed, index);
+}
+
+/// @brief Make a remote player leave, wherever it is
+static void leave_remote(remote_t* remote)
+{
+    if (remote->state == REMOTE_QUEUED)
+        leave_queue(remote);
+    else if (is_seat_held(remote))
+        request_quit(lobby, remote->game, remote->index);
+
+    free_remote(remote);
+}
+
+/// @brief Queue the join of a new remote player, as a client does
+/// @param same_user If the player belongs to the same user as the server: only
+/// then it may get the shared memory, as the clients of the lobby
+static void join_remote_player(tris_message_t* message, struct sockaddr_un* address, socklen_t address_len, bool same_user)
+{
+    message->username[USERNAME_MAX_LEN] = '\0';
+    size_t len = strlen(message->username);
+
+    if (len < USERNAME_MIN_LEN || message->value < NONE || message->value > IMPOSSIBLE
+        || (message->value != NONE && strcmp(message->username, AI_USERNAME) == 0)) {
+        send_error(address, address_len, NO_REMOTE_ID, INVALID_MESSAGE_ERROR_CODE);
+        return;
+    }
+
+    if (n_free == 0) {
+        send_error(address, address_len, NO_REMOTE_ID, TOO_MANY_PLAYERS_ERROR_CODE);
+        return;
+    }
+
+    uint64_t ticket = enqueue_join_request(lobby, message->username, message->value);
+    if (ticket == NO_TICKET) {
+        send_error(address, address_len, NO_REMOTE_ID, QUEUE_FULL_ERROR_CODE);
+        return;
+    }
+
+    remote_t* remote = &remotes[free_remotes[--n_free]];
+    remote->state = REMOTE_QUEUED;
+    remote->generation++;
+    memcpy(&remote->address, address, address_len);
+    remote->address_len = address_len;
+    remote->share_memory = (message->flags & MESSAGE_SHARE_MEMORY) && same_user;
+    remote->last_seen = monotonic_ms();
+    remote->ticket = ticket;
+}
+
+/// @brief Seat a remote player in the game the matcher placed it in, and send it
+/// its ID, with the shared memory if asked for (the snapshot is at the offset)
+static void seat_remote_player(remote_t* remote, tris_game_t* game, uint64_t handle, int index)
+{
+    remote->state = REMOTE_PLAYING;
+    remote->handle = handle;
+    remote->game = game;
+    remote->slot = game - lobby->games;
+    remote->index = index;
+    remote->ready_round = -1;
+    remote->result_round = -1;
+    remote->state_requested = false;
+    init_message(&remote->last_state, MESSAGE_STATE, NO_REMOTE_ID);
+
+    // The events of the previous player of the seat are dropped: the snapshot is
+    // looked at once the session has published the game of this one
+    int seat = get_seat(remote->slot, index);
+    owners[seat] = remote - remotes;
+    atomic_store(&remote_events[seat], 0);
+
+    // Ready for the first game of the slot, as a client that joins
+    atomic_store(&game->players[index].ready_round, atomic_load(&game->round));
+    notify_session(lobby, game);
+
+    tris_message_t message;
+    init_message(&message, MESSAGE_JOIN, get_remote_id(remote));
+    message.player_index = index;
+    message.snapshot_offset = (char*)&game->snapshot - (char*)lobby;
+
+    int fd = remote->share_memory ? open_read_only_shared_memory(shm_id) : -1;
+    if (fd >= 0)
+        message.flags = MESSAGE_SHARE_MEMORY;
+
+    send_message(&remote->address, remote->address_len, &message, fd);
+}
+
+/// @brief Look for the queued players the matcher has placed
+static void check_queued_players()
+{
+    for (int i = 0; i < n_remotes; i++) {
+        remote_t* remote = &remotes[i];
+        if (remote->state != REMOTE_QUEUED)
+            continue;
+
+        uint64_t handle;
+        int index = take_match(lobby, remote->ticket, &handle);
+        if (index == MATCH_PENDING_CODE)
+            continue;
+
+        tris_game_t* game = index >= 0 ? get_game_by_handle(lobby, handle) : NULL;
+        if (game == NULL) {
+            send_error(&remote->address, remote->address_len, get_remote_id(remote),
+                index >= 0 ? STALE_HANDLE_ERROR_CODE : index);
+            free_remote(remote);
+            continue;
+        }
+
+        seat_remote_player(remote, game, handle, index);
+    }
+}
+
+static int count_marks(const int* matrix)
+{
+    int marks = 0;
+
+    for (int i = 0; i < MATRIX_SIZE; i++)
+        marks += matrix[i] != 0;
+
+    return marks;
+}
+
+/// @brief Write the move of a remote player on the board, as a client does. It is
+/// checked against the last state published by the server: only one move per
+/// turn, on an empty cell, by the player on turn
+static void play_move(remote_t* remote, int cell)
+{
+    tris_game_t* game = remote->game;
+    tris_snapshot_t snapshot;
+
+    if (remote->state != REMOTE_PLAYING || !is_seat_held(remote) || cell < 0 || cell >= MATRIX_SIZE) {
+        send_error(&remote->address, remote->address_len, get_remote_id(remote), INVALID_MOVE_ERROR_CODE);
+        return;
+    }
+
+    read_snapshot(game, &snapshot);
+
+    if (snapshot.turn != remote->index || snapshot.result != NOT_FINISHED || game->result != NOT_FINISHED
+        || count_marks(game->matrix) != count_marks(snapshot.matrix) || game->matrix[cell] != 0) {
+        send_error(&remote->address, remote->address_len, get_remote_id(remote), INVALID_MOVE_ERROR_CODE);
+        return;
+    }
+
+    game->matrix[cell] = remote->index;
+    notify_session(lobby, game);
+}
+
+/// @brief Tell the server that a remote player is ready for the next game of a
+/// rematch session, once it has got the result
+static void ready_for_next_round(remote_t* remote)
+{
+    tris_game_t* game = remote->game;
+
+    if (remote->state != REMOTE_PLAYING || !is_seat_held(remote) || game->result == NOT_FINISHED)
+        return;
+
+    atomic_store(&game->players[remote->index].ready_round, atomic_load(&game->round) + 1);
+    notify_session(lobby, game);
+}
+
+/// @brief Check if the sender of a datagram belongs to the same user as the
+/// server, by the credentials the kernel attached to it
+static bool is_sender_same_user(struct msghdr* header)
+{
+    for (struct cmsghdr* cmsg = CMSG_FIRSTHDR(header); cmsg != NULL; cmsg = CMSG_NXTHDR(header, cmsg)) {
+        if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_CREDENTIALS)
+            continue;
+
+        struct ucred cred;
+        memcpy(&cred, CMSG_DATA(cmsg), sizeof(cred));
+        return cred.uid == getuid();
+    }
+
+    return false;
+}
+
+/// @brief Handle a message received on the socket
+/// @param same_user If the sender belongs to the same user as the server
+static void handle_message(tris_message_t* message, struct sockaddr_un* address, socklen_t address_len, bool same_user)
+{
+    if (message->type == MESSAGE_JOIN && message->id == NO_REMOTE_ID) {
+        join_remote_player(message, address, address_len, same_user);
+        return;
+    }
+
+    remote_t* remote = find_remote(message->id, address, address_len);
+    if (remote == NULL) {
+        send_error(address, address_len, message->id, INVALID_MESSAGE_ERROR_CODE);
+        return;
+    }
+
+    // Every message of the player is a heartbeat
+    remote->last_seen = monotonic_ms();
+    if (remote->state == REMOTE_PLAYING && is_seat_held(remote))
+        atomic_store_explicit(&remote->game->players[remote->index].heartbeat, remote->last_seen, memory_order_relaxed);
+
+    switch (message->type) {
+    case MESSAGE_JOIN:
+        ready_for_next_round(remote);
+        break;
+    case MESSAGE_MOVE:
+        play_move(remote, message->value);
+        break;
+    case MESSAGE_STATE:
+        // The state is sent again, even if it did not change
+        if (remote->state == REMOTE_PLAYING) {
+            remote->state_requested = true;
+            atomic_fetch_or(&remote_events[get_seat(remote->slot, remote->index)], REMOTE_EVENT_CHANGED);
+        }
+        break;
+    case MESSAGE_LEAVE:
+        send_leave(remote);
+        leave_remote(remote);
+        break;
+    default:
+        send_error(address, address_len, message->id, INVALID_MESSAGE_ERROR_CODE);
+    }
+}
+
+/// @brief Receive the messages on the socket, a batch at a time
+static void receive_messages()
+{
+    static tris_message_t messages[SOCKET_BATCH];
+    static struct sockaddr_un addresses[SOCKET_BATCH];
+    static struct mmsghdr headers[SOCKET_BATCH];
+    static struct iovec iovs[SOCKET_BATCH];
+    static _Alignas(struct cmsghdr) char controls[SOCKET_BATCH][CMSG_SPACE(sizeof(struct ucred))];
+    int n;
+
+    do {
+        for (int i = 0; i < SOCKET_BATCH; i++) {
+            iovs[i].iov_base = &messages[i];
+            iovs[i].iov_len = sizeof(messages[i]);
+
+            memset(&headers[i], 0, sizeof(headers[i]));
+            headers[i].msg_hdr.msg_name = &addresses[i];
+            headers[i].msg_hdr.msg_namelen = sizeof(addresses[i]);
+            headers[i].msg_hdr.msg_iov = &iovs[i];
+            headers[i].msg_hdr.msg_iovlen = 1;
+            headers[i].msg_hdr.msg_control = controls[i];
+            headers[i].msg_hdr.msg_controllen = sizeof(controls[i]);
+        }
+
+        n = recvmmsg(socket_fd, headers, SOCKET_BATCH, MSG_DONTWAIT, NULL);
+
+        for (int i = 0; i < n; i++) {
+            socklen_t address_len = headers[i].msg_hdr.msg_namelen;
+
+            // Nobody to answer to: the socket of the client is not bound
+            if (address_len <= offsetof(struct sockaddr_un, sun_path))
+                continue;
+
+            if (headers[i].msg_len != sizeof(tris_message_t) || (headers[i].msg_hdr.msg_flags & MSG_TRUNC)) {
+                send_error(&addresses[i], address_len, NO_REMOTE_ID, INVALID_MESSAGE_ERROR_CODE);
+                continue;
+            }
+
+            handle_message(&messages[i], &addresses[i], address_len, is_sender_same_user(&headers[i].msg_hdr));
+        }
+    } while (n == SOCKET_BATCH);
+}
+
+/// @brief Send the result of the game to a remote player, once per game
+/// @return True if the player leaves the slot
+static bool send_result(remote_t* remote, int round, int events)
+{
+    tris_game_t* game = remote->game;
+    int result = game->result;
+
+    if (remote->result_round == round)
+        return false;
+    remote->result_round = round;
+
+    tris_message_t message;
+    init_message(&message, MESSAGE_RESULT, get_remote_id(remote));
+    message.player_index = remote->index;
+    message.value = result;
+    message.result = result;
+    for (int i = 0; i < MATRIX_SIZE; i++)
+        message.matrix[i] = game->matrix[i];
+
+    send_message(&remote->address, remote->address_len, &message, -1);
+
+    // The players of a rematch session stay for the next game, unless it ended
+    // for a quit. The slot is left as a client does (a single game server does
+    // not wait for it)
+    if (rematch && result != QUIT && !(events & REMOTE_EVENT_ENDED))
+        return false;
+
+    if (lobby->n_slots > 1)
+        request_quit(lobby, game, remote->index);
+
+    return true;
+}
+
+/// @brief Send the state of its game to a remote player, if it changed. The posts
+/// a client would wait for are taken, so that they do not pile up in the slot
+static void update_remote_player(remote_t* remote, int events)
+{
+    tris_game_t* game = remote->game;
+
+    if (events & REMOTE_EVENT_QUIT) {
+        send_leave(remote);
+        request_quit(lobby, game, remote->index);
+        free_remote(remote);
+        return;
+    }
+
+    tris_snapshot_t snapshot;
+    int sequence = read_snapshot(game, &snapshot);
+    int round = atomic_load(&game->round);
+
+    if (snapshot.turn != 0 && remote->ready_round != round
+        && try_wait_semaphore(game->sem_id, game->sem_base + WAIT_FOR_OPPONENT_READY, 1))
+        remote->ready_round = round;
+
+    while (try_wait_semaphore(game->sem_id, game->sem_base + PLAYER_ONE_TURN + remote->index - 1, 1))
+        ;
+
+    if (game->result != NOT_FINISHED || (events & REMOTE_EVENT_ENDED)) {
+        if (send_result(remote, round, events))
+            free_remote(remote);
+        return;
+    }
+
+    // The server publishes the game after every wake up of the session: the
+    // state is sent only if it changed, so that every state is a new turn
+    tris_message_t message;
+    init_message(&message, MESSAGE_STATE, get_remote_id(remote));
+    message.player_index = remote->index;
+    message.turn = snapshot.turn;
+    message.result = snapshot.result;
+    for (int i = 0; i < MATRIX_SIZE; i++)
+        message.matrix[i] = snapshot.matrix[i];
+
+    if (!remote->state_requested && memcmp(&message, &remote->last_state, sizeof(message)) == 0)
+        return;
+
+    remote->state_requested = false;
+    remote->last_state = message;
+
+    message.sequence = sequence;
+    send_message(&remote->address, remote->address_len, &message, -1);
+}
+
+/// @brief Handle the events posted for the remote players who are playing
+static void check_playing_players()
+{
+    for (int i = 0; i < n_remotes; i++) {
+        remote_t* remote = &remotes[i];
+        if (remote->state != REMOTE_PLAYING)
+            continue;
+
+        // Another remote player took the seat, once this one had been removed
+        if (owners[get_seat(remote->slot, remote->index)] != i) {
+            send_leave(remote);
+            free_remote(remote);
+            continue;
+        }
+
+        int events = atomic_exchange(&remote_events[get_seat(remote->slot, remote->index)], 0);
+        if (events == 0)
+            continue;
+
+        if (!is_seat_held(remote)) {
+            send_leave(remote);
+            free_remote(remote);
+            continue;
+        }
+
+        update_remote_player(remote, events);
+    }
+}
+
+/// @brief Make the remote players who have been silent for too long leave
+static void check_silent_players()
+{
+    long long now = monotonic_ms();
+
+    for (int i = 0; i < n_remotes; i++) {
+        remote_t* remote = &remotes[i];
+
+        if (remote->state != REMOTE_FREE && now - remote->last_seen > heartbeat_grace) {
+            send_leave(remote);
+            leave_remote(remote);
+        }
+    }
+}
+
+/// @brief Thread that serves the socket: it wakes up on a message, on an event
+/// posted by the server, or at every heartbeat interval. The last pass, while the
+/// server is stopping, sends what is left
+static void* frontend_handler(void* arg)
+{
+    struct pollfd fds[2] = { { socket_fd, POLLIN, 0 }, { event_fd, POLLIN, 0 } };
+    uint64_t count;
+
+    while (1) {
+        bool last = atomic_load(&stopping);
+
+        if (!last)
+            poll(fds, 2, HEARTBEAT_INTERVAL_MS);
+
+        // Reading the counter resets it: every event is looked for at once
+        while (read(event_fd, &count, sizeof(count)) > 0)
+            ;
+
+        receive_messages();
+        check_queued_players();
+        check_playing_players();
+        check_silent_players();
+        flush_messages();
+
+        if (last)
+            return NULL;
+    }
+}
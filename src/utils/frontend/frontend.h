@@ -0,0 +1,23 @@
+/************************************
+ * VR487434 - Lorenzo Di Berardino
+ * VR486588 - Filippo Milani
+ * 09/05/2024
+ ************************************/
+
+#ifndef FRONTEND_H
+#define FRONTEND_H
+
+#include <stdbool.h>
+#include "../globals.h"
+
+void start_frontend(tris_lobby_t*, int, const char*, bool, int);
+void stop_frontend();
+void dispose_frontend();
+int keep_frontend_on_exec();
+bool save_frontend_state(int);
+bool adopt_frontend(int, int);
+void wake_frontend();
+void notify_frontend(int);
+bool signal_remote_player(int, int, int);
+
+#endif
@@ -6,15 +6,18 @@
 
 #include "globals.h"
 #include "data.h"
+#include "events/events.h"
 #include "semaphores/semaphores.h"
 
 #include <limits.h>
-#include <pthread.h>
+#include <sched.h>
 #include <signal.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <string.h>
+#include <sys/random.h>
 #include <termios.h>
+#include <time.h>
 #include <unistd.h>
 #include <errno.h>
 
@@ -50,6 +53,29 @@ int min(int a, int b)
     return a < b ? a : b;
 }
 
+// --------- TIME ---------
+
+/// @brief Returns the current time of the monotonic clock, which is the same for
+/// all the processes of the system
+/// @return The time in milliseconds
+long long monotonic_ms()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/// @brief Compute an absolute deadline, as expected by pthread_cond_timedwait
+/// @param deadline Where to store the deadline
+/// @param ms The milliseconds from now
+void deadline_after_ms(struct timespec* deadline, int ms)
+{
+    clock_gettime(CLOCK_REALTIME, deadline);
+    deadline->tv_nsec += (ms % 1000) * 1000000L;
+    deadline->tv_sec += ms / 1000 + deadline->tv_nsec / 1000000000L;
+    deadline->tv_nsec %= 1000000000L;
+}
+
 // --------- MESSAGES ---------
 
 void print_header_server()
@@ -61,7 +87,14 @@ void print_header_server()
 void print_header_client()
 {
     printf(CLEAR_SCREEN);
-    printf(BOLD FCYN TRIS_ASCII_ART_CLIENT NO_BOLD FNRM);
+    print_art_client(stdout);
+}
+
+/// @brief Print the title of the client, without clearing the screen (the
+/// first lines of a frame)
+void print_art_client(FILE* out)
+{
+    fprintf(out, BOLD FCYN TRIS_ASCII_ART_CLIENT NO_BOLD FNRM);
 }
 
 void print_welcome_message_server()
@@ -103,101 +136,63 @@ void print_spaces(int n)
     fflush(stdout);
 }
 
-/// @brief Function that prints the countdown of the timeout near the prompt
-void* timeout_print_handler(void* timeout)
-{
-    int timeoutValue = *(int*)timeout;
-    int originalDigits = digits(timeoutValue) + (timeoutValue % 10 != 0), newDigits;
-
-    while (timeoutValue > 0) {
-        newDigits = digits(timeoutValue);
-        printf("\x1b[s\r");
-        print_spaces(originalDigits - newDigits);
-        printf("(%d)\x1b[u", timeoutValue--);
-        fflush(stdout);
-
-        sleep(1);
-    }
-
-    return NULL;
-}
-
-/// @brief Starts the thread that prints the countdown
-void start_timeout_print(pthread_t* tid, int* timeout)
-{
-#if PRETTY
-    pthread_create(tid, NULL, timeout_print_handler, timeout);
-#endif
-}
-
-/// @brief Stops the thread that prints the countdown
-void stop_timeout_print(pthread_t tid)
-{
-#if PRETTY
-    if (tid == 0) {
-        return;
-    }
-
-    pthread_cancel(tid);
-#endif
-}
-
 void print_loading_complete_message()
 {
     printf(LOADING_COMPLETE_MESSAGE);
 }
 
-void print_board(int* matrix, char player_one_symbol, char player_two_symbol)
+void print_board(FILE* out, int* matrix, char player_one_symbol, char player_two_symbol)
 {
     int cell;
 
-    printf(MATRIX_TOP_ROW);
+    fprintf(out, MATRIX_TOP_ROW);
     for (int i = 0; i < MATRIX_SIDE_LEN; i++) {
-        printf("  %d  ", i + 1);
+        fprintf(out, "  %d  ", i + 1);
 
         for (int j = 0; j < MATRIX_SIDE_LEN; j++) {
             cell = matrix[i * MATRIX_SIDE_LEN + j];
 
             switch (cell) {
             case 0:
-                printf(EMPTY_CELL);
+                fprintf(out, EMPTY_CELL);
                 break;
             case 1:
-                printf(PLAYER_ONE_COLOR BOLD " %c" FNRM NO_BOLD, player_one_symbol);
+                fprintf(out, PLAYER_ONE_COLOR BOLD " %c" FNRM NO_BOLD, player_one_symbol);
                 break;
             case 2:
-                printf(PLAYER_TWO_COLOR BOLD " %c" FNRM NO_BOLD, player_two_symbol);
+                fprintf(out, PLAYER_TWO_COLOR BOLD " %c" FNRM NO_BOLD, player_two_symbol);
                 break;
             }
 
             if (j < MATRIX_SIDE_LEN - 1) {
-                printf(VERTICAL_SEPARATOR);
+                fprintf(out, VERTICAL_SEPARATOR);
             }
         }
         if (i < MATRIX_SIDE_LEN - 1) {
-            printf(HORIZONTAL_SEPARATOR);
+            fprintf(out, HORIZONTAL_SEPARATOR);
         }
     }
-    printf("\n\n");
-    fflush(stdout);
+    fprintf(out, "\n\n");
+    fflush(out);
 }
 
 /// @brief Print the symbol of the player as a hint
-void print_symbol(char symbol, int player_index, char* username)
+void print_symbol(FILE* out, char symbol, int player_index, char* username)
 {
-    printf(YOUR_SYMBOL_IS_MESSAGE, username, player_index == PLAYER_ONE ? PLAYER_ONE_COLOR : PLAYER_TWO_COLOR, symbol);
+    fprintf(out, YOUR_SYMBOL_IS_MESSAGE, username, player_index == PLAYER_ONE ? PLAYER_ONE_COLOR : PLAYER_TWO_COLOR, symbol);
 }
 
-void print_timeout(int timeout)
+void print_timeout(FILE* out, int timeout)
 {
-    printf(INFO_CHAR);
-    printf(timeout == 0 ? INFINITE_TIMEOUT_MESSAGE : TIMEOUT_MESSAGE, timeout);
+    fprintf(out, INFO_CHAR);
+    fprintf(out, timeout == 0 ? INFINITE_TIMEOUT_MESSAGE : TIMEOUT_MESSAGE, timeout);
 }
 
 /// @brief Print an error message and exit the program
 /// @param msg The error message to print
 void errexit(const char* msg)
 {
+    emit_error(msg);
     printf(FRED ERROR_CHAR "%s", msg);
 
 #if DEBUG
@@ -236,43 +231,6 @@ void clear_screen_client()
     print_header_client();
 }
 
-/// @brief Function that prints a loading spinner indefinitely
-void* loading_spinner()
-{
-    while (1) {
-        print_and_flush("\b|");
-        usleep(100000);
-        print_and_flush("\b/");
-        usleep(100000);
-        print_and_flush("\b-");
-        usleep(100000);
-        print_and_flush("\b\\");
-        usleep(100000);
-    }
-
-    return NULL;
-}
-
-/// @brief Starts the thread that prints the loading spinner
-void start_loading_spinner(pthread_t* tid)
-{
-#if PRETTY
-    pthread_create(tid, NULL, loading_spinner, NULL);
-#endif
-}
-
-/// @brief Stops the thread that prints the loading spinner
-void stop_loading_spinner(pthread_t* tid)
-{
-#if PRETTY
-    if (*tid != 0) {
-        pthread_cancel(*tid);
-        print_and_flush("\b \b");
-        *tid = 0;
-    }
-#endif
-}
-
 // --------- TERMINAL MANAGEMENT ---------
 
 /// @brief Set the terminal input settings
@@ -327,117 +285,149 @@ void init_board(int* matrix)
 #endif
 }
 
-/// @brief Initialize the array of pids with all zeros
-/// @param pids_pointer The pointer to the array of pids
-void init_pids(int* pids_pointer)
-{
-    // No need to use a semaphore, since only the server writes to this buffer at this point
-    for (int i = 0; i < 3; i++) {
-        pids_pointer[i] = 0;
+/// @brief Initialize the pids of all the processes with all zeros
+/// @param game The game struct
+void init_pids(tris_game_t* game)
+{
+    // No need to synchronize, since only the server writes to this buffer at this point
+    for (int i = 0; i < PID_ARRAY_LEN; i++) {
+        game->players[i].pid = 0;
+        game->players[i].user_id = NO_USER;
+        game->players[i].token = NO_TOKEN;
+        atomic_store(&game->players[i].state, SLOT_FREE);
     }
 }
 
-/// @brief set specified pid to the first empty slot (out of 3)
-/// @param sem_id The semaphore id
+/// @brief Free a slot claimed by this process
+/// @param game The game struct
+/// @param index The index of the slot
+static void release_slot(tris_game_t* game, int index)
+{
+    game->players[index].pid = 0;
+    atomic_store_explicit(&game->players[index].state, SLOT_FREE, memory_order_release);
+}
+
+/// @brief Make a new token for a slot, which cannot be guessed
+/// @return The token, never NO_TOKEN
+static uint64_t new_token()
+{
+    uint64_t token = NO_TOKEN;
+
+    // Without random bytes from the kernel, the token is made from the clock
+    if (getrandom(&token, sizeof(token), 0) != sizeof(token))
+        token = (uint64_t)monotonic_ms() * 6364136223846793005ULL ^ (uint64_t)getpid() << 32;
+
+    return token == NO_TOKEN ? 1 : token;
+}
+
+/// @brief Claim the first free slot of a game against the AI for the AI client,
+/// without locks: the slot is claimed with a compare-and-swap on its state, then
+/// the pid is published and the slot is marked as ready. The other players are
+/// placed by the matcher, which checks their username in the registry
 /// @param game The game struct
-/// @param pid The pid to set
 /// @param username The username of the player
-/// @param autoplay The autoplay mode
 /// @return The index of the player in the game struct, or an error code
-int record_join(tris_game_t* game, char* username, int autoplay)
+int record_join(tris_game_t* game, char* username)
 {
-    // Block all (catchable) signals in order to prevent deadlocks;
+    // Block all (catchable) signals, so that a slot is never left half claimed;
     // They will be re-enabled in init_signals() function in clients
     sigset_t mask;
     sigfillset(&mask);
     sigprocmask(SIG_BLOCK, &mask, NULL);
 
-    int player_index = TOO_MANY_PLAYERS_ERROR_CODE;
-    int sem_id = get_semaphores(N_SEM);
+    // Only the AI client joins a game through its handle
+    if (strcmp(username, AI_USERNAME) != 0 || atomic_load(&game->autoplay) == NONE)
+        return TOO_MANY_PLAYERS_ERROR_CODE;
 
-    wait_semaphore(sem_id, PID_LOCK, 1);
     for (int i = 1; i < PID_ARRAY_LEN; i++) {
-        if (game->pids[i] == 0) {
-            int other_player_index = i == PLAYER_ONE ? PLAYER_TWO : PLAYER_ONE;
+        int expected = SLOT_FREE;
+        if (!atomic_compare_exchange_strong(&game->players[i].state, &expected, SLOT_CLAIMED))
+            continue;
 
-            if (strcmp(username, game->usernames[other_player_index]) == 0) {
-                player_index = SAME_USERNAME_ERROR_CODE;
-                break;
-            }
+        game->players[i].user_id = AI_USER;
+        game->players[i].token = NO_TOKEN;
+        game->players[i].pid = getpid();
+        atomic_store(&game->players[i].heartbeat, monotonic_ms());
+        atomic_store_explicit(&game->players[i].state, SLOT_READY, memory_order_release);
 
-            // Check if user wants to autoplay
-            if (autoplay != NONE) {
-                // Check if someone else already wanted to autoplay
-                if (game->autoplay != NONE) {
-                    // Only AI client is allowed to occupy a slot with
-                    // an already joined client who wanted to autoplay
-                    if (strcmp(username, AI_USERNAME) != 0) {
-                        player_index = TOO_MANY_PLAYERS_ERROR_CODE;
-                        break;
-                    }
-                }
-
-                if (game->pids[other_player_index] != 0) {
-                    player_index = AUTOPLAY_NOT_ALLOWED_ERROR_CODE;
-                    break;
-                } else
-                    game->autoplay = autoplay;
-            }
+        return i;
+    }
 
-            // Copy pid, index and username
-            game->pids[i] = getpid();
-            player_index = i;
-            strncpy(game->usernames[i], username, USERNAME_MAX_LEN);
+    return TOO_MANY_PLAYERS_ERROR_CODE;
+}
 
-            // Copy the path of the client (might be needed by the server)
-            char current_path[PATH_MAX];
-            int n = readlink(SELF_EXEC_PATH, current_path, sizeof(current_path));
-            if (n != -1)
-                current_path[n] = '\0';
-            strncpy(game->client_path, current_path, sizeof(game->client_path));
+/// @brief Place a player in a free slot of a game on its behalf (the matcher
+/// does it for the clients in the queue)
+/// @param game The game struct
+/// @param index The index of the slot
+/// @param pid The pid of the player
+/// @param user_id The ID of the user, in the registry
+/// @return True if the slot was free
+bool place_player(tris_game_t* game, int index, pid_t pid, uint32_t user_id)
+{
+    int expected = SLOT_FREE;
+    if (!atomic_compare_exchange_strong(&game->players[index].state, &expected, SLOT_CLAIMED))
+        return false;
 
-            break;
-        }
-    }
-    signal_semaphore(sem_id, PID_LOCK, 1);
+    game->players[index].user_id = user_id;
+    game->players[index].token = new_token();
+    game->players[index].pid = pid;
+    atomic_store(&game->players[index].heartbeat, monotonic_ms());
+    atomic_store_explicit(&game->players[index].state, SLOT_READY, memory_order_release);
+
+    return true;
+}
+
+/// @brief Take back the slot of a player whose client was lost, with the token
+/// of the slot: the player gets the same index and board. The slot is resumed
+/// until the server has given the turn back to the player (then it is ready)
+/// @param game The game struct
+/// @param index The index of the slot
+/// @param token The token of the slot
+/// @return True if the slot was waiting for its player, with that token
+bool resume_player(tris_game_t* game, int index, uint64_t token)
+{
+    if (index < PLAYER_ONE || index > PLAYER_TWO || token == NO_TOKEN || game->players[index].token != token)
+        return false;
+
+    int expected = SLOT_DETACHED;
+    if (!atomic_compare_exchange_strong(&game->players[index].state, &expected, SLOT_CLAIMED))
+        return false;
 
-    return player_index;
+    game->players[index].pid = getpid();
+    atomic_store(&game->players[index].heartbeat, monotonic_ms());
+    atomic_store_explicit(&game->players[index].state, SLOT_RESUMED, memory_order_release);
+
+    return true;
 }
 
 /// @brief Explicitly set the pid at the specified index
-/// @param sem_id Semaphore id to lock pid array with
-/// @param pids_pointer The pointer to the array of pids
+/// @param game The game struct
 /// @param index The index to set the pid at
 /// @param pid The pid to set
-void set_pid_at(int sem_id, int* pids_pointer, int index, int pid)
+void set_pid_at(tris_game_t* game, int index, int pid)
 {
-    wait_semaphore(sem_id, PID_LOCK, 1);
-    pids_pointer[index] = pid;
-    signal_semaphore(sem_id, PID_LOCK, 1);
+    game->players[index].pid = pid;
+    atomic_store_explicit(&game->players[index].state, pid == 0 ? SLOT_FREE : SLOT_READY, memory_order_release);
 }
 
-/// @brief Set the pid at the specified index to 0
+/// @brief Free the slot at the specified index
 /// @param game The game struct
 /// @param index The index to clear the pid at
 void record_quit(tris_game_t* game, int index)
 {
-    int sem_id = get_semaphores(N_SEM);
-
-    wait_semaphore(sem_id, PID_LOCK, 1);
-    game->pids[index] = 0;
-    // free(game->usernames[index]);
-    signal_semaphore(sem_id, PID_LOCK, 1);
+    release_slot(game, index);
 }
 
 /// @brief Get the pid at the specified index
-/// @param pids_pointer The pointer to the array of pids
+/// @param game The game struct
 /// @param index The index to get the pid from
 /// @return The pid at the specified index
-int get_pid_at(int* pids_pointer, int index)
+int get_pid_at(tris_game_t* game, int index)
 {
     // no need to use semaphores here, as only the server read from this buffer,
     // and it does this only after clients have written to it and notified the server
-    return pids_pointer[index];
+    return game->players[index].pid;
 }
 
 /// @brief Check if the move is valid
@@ -554,7 +544,7 @@ int minimax(int* game_matrix, int depth, bool is_maximizing)
 void chooseBestMove(int* game_matrix, int player_index)
 {
     int best_val = INT_MIN;
-    move_t best_move;
+    move_t best_move = { 0, 0 };
 
     for (int i = 0; i < MATRIX_SIZE; i++) {
         if (game_matrix[i] == 0) {
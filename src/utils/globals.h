@@ -8,9 +8,14 @@
 #define GLOBALS_H
 
 #include <limits.h>
+#include <stdatomic.h>
+#include <stddef.h>
 #include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <termios.h>
+#include <time.h>
 
 #include "data.h"
 
@@ -21,39 +26,237 @@ typedef struct {
     int col;
 } move_t;
 
+// Copy of the game for the spectators, published under a sequence number (odd
+// while the server writes it): a reader retries a copy if the number changed
 typedef struct {
+    _Alignas(CACHE_LINE_SIZE) atomic_int sequence;
     int matrix[MATRIX_SIZE];
-    pid_t pids[PID_ARRAY_LEN];
-    char usernames[USERNAMES_ARRAY_LEN][USERNAME_MAX_LEN + 1];
     int result;
-    int autoplay;
-    char symbols[SYMBOLS_ARRAY_LEN];
-    int timeout;
-    char client_path[PATH_MAX];
+    int turn;
+    uint32_t user_ids[PID_ARRAY_LEN];
+} tris_snapshot_t;
+
+// Fields are grouped by the process that writes them, and every group starts
+// on its own cache line: a write of one side never invalidates the lines the
+// other sides are reading. A move writes the board line, the allocation line
+// (to wake up the session), the snapshot line and, if the game has clocks, the
+// clock line; the session is also pushed in a cell of the ready ring of the lobby
+typedef struct {
+    _Alignas(CACHE_LINE_SIZE) pid_t pid;
+    atomic_int state;
+    atomic_llong heartbeat;
+    atomic_int ready_round;
+    uint32_t user_id;
+    uint64_t token;
+} tris_player_t;
+
+typedef struct {
+    // Hot: written by the player on turn, read by everyone
+    struct {
+        _Alignas(CACHE_LINE_SIZE) int matrix[MATRIX_SIZE];
+    };
+
+    // Written by the server: settings when the slot is reset, result at the end,
+    // first turn and round when the next game of a rematch session starts
+    struct {
+        _Alignas(CACHE_LINE_SIZE) int result;
+        int timeout;
+        int clock_ms;
+        int clock_increment_ms;
+        int sem_id;
+        int sem_base;
+        int first_turn;
+        atomic_int round;
+        char symbols[SYMBOLS_ARRAY_LEN];
+    };
+
+    // Written when the slot is taken from, or given back to, the lobby, and
+    // when the session is woken up
+    struct {
+        _Alignas(CACHE_LINE_SIZE) atomic_uint generation;
+        atomic_uint next_free;
+        atomic_int schedule_state;
+    };
+
+    // One line per process (the server at index 0)
+    tris_player_t players[PID_ARRAY_LEN];
+
+    // Written by the server after every change, read by the spectators
+    tris_snapshot_t snapshot;
+
+    // Written by the server on every move, only if the game has clocks: the time
+    // left to each player, and the time the clock of the one on turn runs out at
+    struct {
+        _Alignas(CACHE_LINE_SIZE) atomic_llong clock_left[PID_ARRAY_LEN];
+        atomic_llong clock_deadline[PID_ARRAY_LEN];
+    };
+
+    // Cold: written once per game (the usernames are in the registry)
+    struct {
+        _Alignas(CACHE_LINE_SIZE) atomic_int autoplay;
+    };
 } tris_game_t;
 
+// A username in the registry of the lobby: players refer to it by its index
+typedef struct {
+    atomic_int state;
+    uint32_t hash;
+    char name[USERNAME_MAX_LEN + 1];
+} tris_user_t;
+
+// A session woken up, in the ready ring of the lobby
+typedef struct {
+    atomic_ullong sequence;
+    uint32_t index;
+} tris_ready_cell_t;
+
+// A request to join a game, in the matchmaking queue. The cell is given back to
+// the producers by the client, once it has read the game it has been assigned
+typedef struct {
+    _Alignas(CACHE_LINE_SIZE) atomic_ullong sequence;
+    atomic_int state;
+    int mode;
+    pid_t pid;
+    char username[USERNAME_MAX_LEN + 1];
+    long long enqueued_at;
+    uint64_t position;
+    uint64_t handle;
+    int player_index;
+} tris_ticket_t;
+
+// A message of the socket protocol, in the byte order of the host. A client gets
+// its ID in the reply to its join, and sends it with every other message (at
+// least once per heartbeat interval, or it is considered gone)
+typedef struct {
+    uint32_t id;
+    uint32_t sequence;
+    uint32_t snapshot_offset;
+    uint8_t type;
+    uint8_t flags;
+    int8_t player_index;
+    int8_t value;
+    int8_t turn;
+    int8_t result;
+    int8_t matrix[MATRIX_SIZE];
+    char username[USERNAME_MAX_LEN + 1];
+} tris_message_t;
+
+// A warm AI client of the pool of the server. The server claims an idle one,
+// writes the handle of a game and wakes it up on its state
+typedef struct {
+    _Alignas(CACHE_LINE_SIZE) atomic_int state;
+    atomic_int pid;
+    uint64_t handle;
+} tris_ai_worker_t;
+
+// The shared memory of the server: a header followed by an arena of game slots
+// and by the registry of the usernames.
+// Free slots are chained in a list whose head carries a tag, bumped on every
+// change, so that a concurrent pop and push are never confused (ABA)
+typedef struct {
+    // Written by the server at startup
+    struct {
+        _Alignas(CACHE_LINE_SIZE) pid_t server_pid;
+        int n_slots;
+        int sem_id;
+        int resume_grace;
+        uint32_t checksum;
+    };
+
+    // Written by the server when a slot is taken or given back
+    struct {
+        _Alignas(CACHE_LINE_SIZE) atomic_ullong free_head;
+    };
+
+    // Ready ring of the sessions: woken up by the players, run by the workers
+    struct {
+        _Alignas(CACHE_LINE_SIZE) atomic_ullong ready_tail;
+    };
+    struct {
+        _Alignas(CACHE_LINE_SIZE) atomic_ullong ready_head;
+        atomic_int ready_signal;
+    };
+
+    // Matchmaking queue: the producers (the clients) and the consumer (the
+    // matcher) move on separate lines
+    struct {
+        _Alignas(CACHE_LINE_SIZE) atomic_ullong enqueue_pos;
+        atomic_ullong rejected;
+    };
+    struct {
+        _Alignas(CACHE_LINE_SIZE) atomic_ullong dequeue_pos;
+        atomic_int matcher_signal;
+    };
+
+    // Matchmaking metrics, written by the matcher
+    struct {
+        _Alignas(CACHE_LINE_SIZE) atomic_ullong matches;
+        atomic_ullong served;
+        atomic_ullong total_wait_ms;
+        atomic_llong max_wait_ms;
+    };
+
+    // Cold: written once, by the first client asking for the AI
+    struct {
+        _Alignas(CACHE_LINE_SIZE) atomic_int client_path_state;
+        char client_path[PATH_MAX];
+    };
+
+    tris_ai_worker_t ai_pool[MAX_AI_POOL];
+    tris_ready_cell_t ready[READY_RING_CAPACITY];
+    tris_ticket_t tickets[QUEUE_CAPACITY];
+    tris_game_t games[];
+} tris_lobby_t;
+
+// A server in the directory of the shards: the pid claims the entry, the
+// capacity (zero while the server is starting) and the load guide the clients
+typedef struct {
+    _Alignas(CACHE_LINE_SIZE) atomic_int server_pid;
+    atomic_int capacity;
+    atomic_int load;
+    int backend;
+} tris_shard_t;
+
+typedef struct {
+    tris_shard_t shards[MAX_SHARDS];
+} tris_directory_t;
+
+_Static_assert(sizeof(tris_player_t) == CACHE_LINE_SIZE, "a player must fill exactly one cache line");
+_Static_assert(offsetof(tris_game_t, matrix) == 0, "the board must start the game slot");
+_Static_assert(sizeof(((tris_game_t*)0)->matrix) <= CACHE_LINE_SIZE, "the board must fit in one cache line");
+_Static_assert(offsetof(tris_game_t, result) == CACHE_LINE_SIZE, "the server line must follow the board line");
+_Static_assert(offsetof(tris_game_t, generation) == 2 * CACHE_LINE_SIZE, "the allocation line must follow the server line");
+_Static_assert(offsetof(tris_game_t, players) == 3 * CACHE_LINE_SIZE, "the player lines must follow the allocation line");
+_Static_assert(sizeof(tris_snapshot_t) == CACHE_LINE_SIZE, "the snapshot must fill exactly one cache line");
+_Static_assert(offsetof(tris_game_t, snapshot) == offsetof(tris_game_t, players) + PID_ARRAY_LEN * CACHE_LINE_SIZE, "the snapshot line must follow the player lines");
+_Static_assert(offsetof(tris_game_t, clock_left) == offsetof(tris_game_t, snapshot) + CACHE_LINE_SIZE, "the clock line must follow the snapshot line");
+_Static_assert(offsetof(tris_game_t, symbols) + SYMBOLS_ARRAY_LEN <= offsetof(tris_game_t, generation), "the server line must fit in one cache line");
+_Static_assert(offsetof(tris_game_t, clock_left) % CACHE_LINE_SIZE == 0, "the clocks must start on their own line");
+_Static_assert(sizeof(((tris_game_t*)0)->clock_left) + sizeof(((tris_game_t*)0)->clock_deadline) <= CACHE_LINE_SIZE, "the clocks must fit in one cache line");
+_Static_assert(offsetof(tris_game_t, autoplay) % CACHE_LINE_SIZE == 0, "the cold region must start on its own line");
+_Static_assert(sizeof(tris_game_t) % CACHE_LINE_SIZE == 0, "game slots must not share cache lines");
+_Static_assert(offsetof(tris_lobby_t, games) % CACHE_LINE_SIZE == 0, "the arena must start on its own line");
+_Static_assert(sizeof(tris_message_t) == 60, "the messages of the socket protocol must keep their size");
+_Static_assert((QUEUE_CAPACITY & (QUEUE_CAPACITY - 1)) == 0, "the queue capacity must be a power of two");
+_Static_assert((READY_RING_CAPACITY & (READY_RING_CAPACITY - 1)) == 0, "the ready ring capacity must be a power of two");
+
 void print_header_server();
 void print_header_client();
+void print_art_client(FILE*);
 void print_welcome_message_server();
 void print_welcome_message_client(char*);
 void print_loading_message();
 void print_and_flush(const char*);
 void print_spaces(int);
-void* timeout_print_handler(void*);
-void start_timeout_print(pthread_t*, int*);
-void stop_timeout_print(pthread_t);
 void print_loading_complete_message();
-void print_board(int*, char, char);
-void print_symbol(char, int, char*);
-void print_timeout(int);
+void print_board(FILE*, int*, char, char);
+void print_symbol(FILE*, char, int, char*);
+void print_timeout(FILE*, int);
 void print_error(const char*);
 void print_success(const char*);
 void errexit(const char*);
 void clear_screen_server();
 void clear_screen_client();
-void* loading_spinner();
-void start_loading_spinner(pthread_t*);
-void stop_loading_spinner(pthread_t*);
 int digits(int);
 int max(int, int);
 int min(int, int);
@@ -61,11 +264,15 @@ int set_input(struct termios*);
 void ignore_previous_input();
 bool init_output_settings(struct termios*, struct termios*);
 void init_board(int*);
-void init_pids(int*);
-int record_join(tris_game_t*, char*, int);
-void set_pid_at(int, int*, int, int);
+void init_pids(tris_game_t*);
+int record_join(tris_game_t*, char*);
+bool place_player(tris_game_t*, int, pid_t, uint32_t);
+bool resume_player(tris_game_t*, int, uint64_t);
+void set_pid_at(tris_game_t*, int, int);
 void record_quit(tris_game_t*, int);
-int get_pid_at(int*, int);
+int get_pid_at(tris_game_t*, int);
+long long monotonic_ms();
+void deadline_after_ms(struct timespec*, int);
 bool is_valid_move(int*, char*, move_t*);
 int is_game_ended(int*);
 int minimax(int*, int, bool);
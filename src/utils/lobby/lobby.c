@@ -0,0 +1,462 @@
+/************************************
+ * VR487434 - Lorenzo Di Berardino
+ * VR486588 - Filippo Milani
+ * 09/05/2024
+ ************************************/
+
+#include "lobby.h"
+#include "../data.h"
+#include "../ai_pool/ai_pool.h"
+#include "../registry/registry.h"
+#include "../semaphores/semaphores.h"
+
+#include <limits.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <unistd.h>
+
+// Both the head of the free list (tag, index) and the handles of the games
+// (generation, index) pack a counter in the high half and a slot in the low one
+#define PACK(high, low) (((uint64_t)(high) << 32) | (uint32_t)(low))
+#define HIGH(packed) ((uint32_t)((packed) >> 32))
+#define LOW(packed) ((uint32_t)(packed))
+
+/// @brief FNV-1a checksum of the header of the lobby, and of the layout of the
+/// arena it was made for. It is written last, once the lobby is ready, so that
+/// a server that crashed while writing the header leaves it wrong
+static uint32_t get_lobby_checksum(tris_lobby_t* lobby)
+{
+    uint64_t fields[] = { lobby->server_pid, lobby->n_slots, lobby->sem_id, sizeof(tris_lobby_t), GAME_SIZE,
+        LOBBY_SIZE(lobby->n_slots) };
+    const unsigned char* bytes = (const unsigned char*)fields;
+    uint32_t hash = 2166136261u;
+
+    for (size_t i = 0; i < sizeof(fields); i++)
+        hash = (hash ^ bytes[i]) * 16777619u;
+
+    return hash;
+}
+
+/// @brief Empty the free list and the ready ring of the lobby
+static void init_lobby_lists(tris_lobby_t* lobby)
+{
+    atomic_store(&lobby->free_head, PACK(0, NO_SLOT));
+
+    for (uint64_t i = 0; i < READY_RING_CAPACITY; i++)
+        atomic_store(&lobby->ready[i].sequence, i);
+    atomic_store(&lobby->ready_tail, 0);
+    atomic_store(&lobby->ready_head, 0);
+    atomic_store(&lobby->ready_signal, 0);
+}
+
+/// @brief Initialize the header of the lobby. The free list starts empty: every
+/// slot is given to the lobby by the server, once it is ready to be played
+/// @param lobby The lobby
+/// @param n_slots The number of game slots of the arena
+/// @param sem_id The semaphore set, with N_SEM semaphores per slot
+void init_lobby(tris_lobby_t* lobby, int n_slots, int sem_id)
+{
+    lobby->server_pid = getpid();
+    lobby->n_slots = n_slots;
+    lobby->sem_id = sem_id;
+
+    init_lobby_lists(lobby);
+
+    atomic_store(&lobby->client_path_state, CLIENT_PATH_UNSET);
+    memset(lobby->client_path, 0, sizeof(lobby->client_path));
+
+    // The players left by a crashed server are forgotten
+    for (int i = 0; i < n_slots; i++) {
+        init_pids(&lobby->games[i]);
+        atomic_store(&lobby->games[i].generation, 0);
+        atomic_store(&lobby->games[i].next_free, NO_SLOT);
+        atomic_store(&lobby->games[i].schedule_state, SESSION_IDLE);
+        init_snapshot(&lobby->games[i]);
+    }
+
+    init_registry(lobby);
+    init_ai_pool(lobby);
+
+    lobby->checksum = get_lobby_checksum(lobby);
+}
+
+/// @brief Check if the lobby left by a crashed server can be taken over: its
+/// header must be whole, and made for an arena of the same layout
+/// @param lobby The lobby left by the crashed server
+/// @param n_slots The number of game slots of this server
+/// @return True if the games of the lobby can be recovered
+bool is_lobby_recoverable(tris_lobby_t* lobby, int n_slots)
+{
+    return lobby->n_slots == n_slots && lobby->checksum == get_lobby_checksum(lobby);
+}
+
+/// @brief Take over the lobby left by a crashed server. The games, the usernames
+/// and the semaphore set are kept as they are; the lists of the slots and of the
+/// sessions are built again by this server, which gives every slot back to the
+/// lobby, or recovers its game
+/// @param lobby The lobby left by the crashed server
+void recover_lobby(tris_lobby_t* lobby)
+{
+    lobby->server_pid = getpid();
+    init_lobby_lists(lobby);
+
+    for (int i = 0; i < lobby->n_slots; i++) {
+        atomic_store(&lobby->games[i].next_free, NO_SLOT);
+        atomic_store(&lobby->games[i].schedule_state, SESSION_IDLE);
+    }
+
+    // The warm AI clients of the crashed server leave once their game is over
+    init_ai_pool(lobby);
+
+    lobby->checksum = get_lobby_checksum(lobby);
+}
+
+/// @brief Get the game in a slot of the arena
+tris_game_t* get_game_at(tris_lobby_t* lobby, int index)
+{
+    return &lobby->games[index];
+}
+
+/// @brief Get the slot of a game of the arena
+int get_game_index(tris_lobby_t* lobby, tris_game_t* game)
+{
+    return game - lobby->games;
+}
+
+/// @brief Get the handle of the game currently in a slot: it becomes stale as
+/// soon as the slot is given back to the lobby
+uint64_t get_game_handle(tris_lobby_t* lobby, int index)
+{
+    return PACK(atomic_load(&lobby->games[index].generation), index);
+}
+
+/// @brief Get the game a handle refers to
+/// @return The game, or NULL if the handle is stale
+tris_game_t* get_game_by_handle(tris_lobby_t* lobby, uint64_t handle)
+{
+    if (handle == NO_HANDLE || LOW(handle) >= (uint32_t)lobby->n_slots)
+        return NULL;
+
+    tris_game_t* game = &lobby->games[LOW(handle)];
+    if (atomic_load(&game->generation) != HIGH(handle))
+        return NULL;
+
+    return game;
+}
+
+/// @brief Pop a slot from the free list
+/// @return The index of the slot, or -1 if every slot is in use
+int take_free_slot(tris_lobby_t* lobby)
+{
+    uint64_t head = atomic_load(&lobby->free_head);
+    uint64_t next;
+
+    do {
+        if (LOW(head) == NO_SLOT)
+            return -1;
+
+        next = PACK(HIGH(head) + 1, atomic_load(&lobby->games[LOW(head)].next_free));
+    } while (!atomic_compare_exchange_weak(&lobby->free_head, &head, next));
+
+    return LOW(head);
+}
+
+/// @brief Push a slot on the free list. The generation of the slot is bumped
+/// first, so that the handles to the previous game are stale
+/// @param lobby The lobby
+/// @param index The index of the slot, already reset
+void release_game_slot(tris_lobby_t* lobby, int index)
+{
+    tris_game_t* game = &lobby->games[index];
+
+    atomic_fetch_add(&game->generation, 1);
+
+    uint64_t head = atomic_load(&lobby->free_head);
+    do {
+        atomic_store(&game->next_free, LOW(head));
+    } while (!atomic_compare_exchange_weak(&lobby->free_head, &head, PACK(HIGH(head) + 1, index)));
+}
+
+/// @brief Publish the path of this executable, needed by the server to start the
+/// AI. Every client is the same executable, so it is written only once
+void publish_client_path(tris_lobby_t* lobby)
+{
+    int expected = CLIENT_PATH_UNSET;
+    if (!atomic_compare_exchange_strong(&lobby->client_path_state, &expected, CLIENT_PATH_WRITING))
+        return;
+
+    int n = readlink(SELF_EXEC_PATH, lobby->client_path, sizeof(lobby->client_path) - 1);
+    if (n < 0) {
+        atomic_store(&lobby->client_path_state, CLIENT_PATH_UNSET);
+        return;
+    }
+
+    lobby->client_path[n] = '\0';
+    atomic_store_explicit(&lobby->client_path_state, CLIENT_PATH_SET, memory_order_release);
+}
+
+/// @brief Get the path of the client executable published by the clients
+/// @return The path, or the default one if no client published it
+const char* get_client_path(tris_lobby_t* lobby)
+{
+    if (atomic_load_explicit(&lobby->client_path_state, memory_order_acquire) == CLIENT_PATH_SET)
+        return lobby->client_path;
+
+    return DEFAULT_CLIENT_PATH;
+}
+
+/// @brief Join the game a handle refers to
+/// @param lobby The lobby
+/// @param handle The handle of the game
+/// @param username The username of the player
+/// @param player_index Where to store the index of the player, or an error code
+/// @return The game, or NULL on error
+tris_game_t* join_game(tris_lobby_t* lobby, uint64_t handle, char* username, int* player_index)
+{
+    tris_game_t* game = get_game_by_handle(lobby, handle);
+    if (game == NULL) {
+        *player_index = STALE_HANDLE_ERROR_CODE;
+        return NULL;
+    }
+
+    if ((*player_index = record_join(game, username)) < 0)
+        return NULL;
+
+    // The slot may have been recycled while joining
+    if (get_game_by_handle(lobby, handle) == NULL) {
+        if (game->players[*player_index].pid == getpid())
+            record_quit(game, *player_index);
+
+        *player_index = STALE_HANDLE_ERROR_CODE;
+        return NULL;
+    }
+
+    return game;
+}
+
+/// @brief Put a session in the ready ring. A session is in the ring at most once
+/// (see notify_session), so the ring, as large as the arena, is never full
+/// @param lobby The lobby
+/// @param index The index of the slot of the session
+void push_ready_session(tris_lobby_t* lobby, int index)
+{
+    uint64_t position = atomic_load_explicit(&lobby->ready_tail, memory_order_relaxed);
+    tris_ready_cell_t* cell;
+
+    while (1) {
+        cell = &lobby->ready[position & (READY_RING_CAPACITY - 1)];
+        int64_t diff = (int64_t)(atomic_load_explicit(&cell->sequence, memory_order_acquire) - position);
+
+        if (diff == 0 && atomic_compare_exchange_weak_explicit(&lobby->ready_tail, &position, position + 1,
+                             memory_order_relaxed, memory_order_relaxed))
+            break;
+
+        if (diff != 0)
+            position = atomic_load_explicit(&lobby->ready_tail, memory_order_relaxed);
+    }
+
+    cell->index = index;
+    atomic_store_explicit(&cell->sequence, position + 1, memory_order_release);
+}
+
+/// @brief Take the oldest session out of the ready ring
+/// @return The index of the slot of the session, or NO_WORK if the ring is empty
+int pop_ready_session(tris_lobby_t* lobby)
+{
+    uint64_t position = atomic_load_explicit(&lobby->ready_head, memory_order_relaxed);
+    tris_ready_cell_t* cell;
+
+    while (1) {
+        cell = &lobby->ready[position & (READY_RING_CAPACITY - 1)];
+        int64_t diff = (int64_t)(atomic_load_explicit(&cell->sequence, memory_order_acquire) - (position + 1));
+
+        if (diff < 0)
+            return NO_WORK;
+
+        if (diff == 0 && atomic_compare_exchange_weak_explicit(&lobby->ready_head, &position, position + 1,
+                             memory_order_relaxed, memory_order_relaxed))
+            break;
+
+        if (diff != 0)
+            position = atomic_load_explicit(&lobby->ready_head, memory_order_relaxed);
+    }
+
+    int index = cell->index;
+    atomic_store_explicit(&cell->sequence, position + READY_RING_CAPACITY, memory_order_release);
+
+    return index;
+}
+
+/// @brief Wake up the session of a game, after a join, a move or a quit. An idle
+/// session is put in the ready ring for the workers of the server; a running one
+/// is run again by its worker, so that the wake up is never lost
+/// @param lobby The lobby
+/// @param game The game
+void notify_session(tris_lobby_t* lobby, tris_game_t* game)
+{
+    int state = atomic_load(&game->schedule_state);
+    int next;
+
+    do {
+        if (state == SESSION_SCHEDULED || state == SESSION_RUNNING_AGAIN)
+            return;
+
+        next = state == SESSION_IDLE ? SESSION_SCHEDULED : SESSION_RUNNING_AGAIN;
+    } while (!atomic_compare_exchange_weak(&game->schedule_state, &state, next));
+
+    if (next == SESSION_SCHEDULED) {
+        push_ready_session(lobby, game - lobby->games);
+        atomic_fetch_add(&lobby->ready_signal, 1);
+        futex_wake(&lobby->ready_signal, 1);
+    }
+}
+
+/// @brief Tell the server that a player quitted. The slot is marked, so that the
+/// server knows the game and the player, and the session is woken up whatever it
+/// is waiting for. Only a ready player can quit, and only once
+/// @param lobby The lobby
+/// @param game The game struct
+/// @param index The index of the player who quitted
+void request_quit(tris_lobby_t* lobby, tris_game_t* game, int index)
+{
+    int expected = SLOT_READY;
+    if (!atomic_compare_exchange_strong(&game->players[index].state, &expected, SLOT_QUIT))
+        return;
+
+    notify_session(lobby, game);
+}
+
+/// @brief Tell the server that the client of a player was lost, while the game
+/// is being played. The slot is kept for the player, who can take it back with
+/// the token of the slot (see rejoin_game), until the server drops it
+/// @param lobby The lobby
+/// @param game The game struct
+/// @param index The index of the player whose client was lost
+void request_detach(tris_lobby_t* lobby, tris_game_t* game, int index)
+{
+    int expected = SLOT_READY;
+    if (!atomic_compare_exchange_strong(&game->players[index].state, &expected, SLOT_DETACHED))
+        return;
+
+    // The heartbeat of a detached slot is the time it was detached at
+    atomic_store(&game->players[index].heartbeat, monotonic_ms());
+    notify_session(lobby, game);
+}
+
+/// @brief Give up the slot of a detached player, as if the player quitted
+/// @param lobby The lobby
+/// @param game The game struct
+/// @param index The index of the detached player
+void drop_detached(tris_lobby_t* lobby, tris_game_t* game, int index)
+{
+    int expected = SLOT_DETACHED;
+    if (!atomic_compare_exchange_strong(&game->players[index].state, &expected, SLOT_QUIT))
+        return;
+
+    notify_session(lobby, game);
+}
+
+/// @brief Take back a detached slot of the game a handle refers to
+/// @param lobby The lobby
+/// @param handle The handle of the game
+/// @param index The index of the slot
+/// @param token The token of the slot
+/// @param player_index Where to store the index of the player, or an error code
+/// @return The game, or NULL on error
+tris_game_t* rejoin_game(tris_lobby_t* lobby, uint64_t handle, int index, uint64_t token, int* player_index)
+{
+    tris_game_t* game = get_game_by_handle(lobby, handle);
+    if (game == NULL || !resume_player(game, index, token)) {
+        *player_index = RESUME_ERROR_CODE;
+        return NULL;
+    }
+
+    *player_index = index;
+    notify_session(lobby, game);
+
+    return game;
+}
+
+/// @brief Get the time left to a player on the clock the server keeps for it,
+/// as of now: it runs only while the player is on turn
+/// @param game The game
+/// @param index The index of the player
+/// @return The time left (milliseconds), or NO_TIME_LEFT if the game has no clocks
+long long get_time_left(tris_game_t* game, int index)
+{
+    if (game->clock_ms == 0)
+        return NO_TIME_LEFT;
+
+    long long deadline = atomic_load(&game->clock_deadline[index]);
+    if (deadline == NO_DEADLINE)
+        return atomic_load(&game->clock_left[index]);
+
+    long long left = deadline - monotonic_ms();
+
+    return left > 0 ? left : 0;
+}
+
+/// @brief Initialize the snapshot of a game to an empty game, without players
+void init_snapshot(tris_game_t* game)
+{
+    atomic_store(&game->snapshot.sequence, 0);
+    memset(game->snapshot.matrix, 0, sizeof(game->snapshot.matrix));
+    game->snapshot.result = NOT_FINISHED;
+    game->snapshot.turn = 0;
+
+    for (int i = 0; i < PID_ARRAY_LEN; i++)
+        game->snapshot.user_ids[i] = NO_USER;
+}
+
+/// @brief Publish a copy of the game for the spectators, and wake them up. Only
+/// the server writes it, one worker at a time
+/// @param game The game
+/// @param turn The player on turn, or 0 if the game is not being played
+void publish_snapshot(tris_game_t* game, int turn)
+{
+    tris_snapshot_t* snapshot = &game->snapshot;
+    int sequence = atomic_load_explicit(&snapshot->sequence, memory_order_relaxed);
+
+    atomic_store_explicit(&snapshot->sequence, sequence + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+
+    memcpy(snapshot->matrix, game->matrix, sizeof(snapshot->matrix));
+    snapshot->result = game->result;
+    snapshot->turn = turn;
+    for (int i = 0; i < PID_ARRAY_LEN; i++)
+        snapshot->user_ids[i] = game->players[i].user_id;
+
+    atomic_store_explicit(&snapshot->sequence, sequence + 2, memory_order_release);
+    futex_wake(&snapshot->sequence, INT_MAX);
+}
+
+/// @brief Copy the snapshot of a game without locks, retrying while the server
+/// is writing it
+/// @param game The game
+/// @param copy Where to copy the snapshot
+/// @return The sequence number of the copy, to wait for the next one
+int read_snapshot(tris_game_t* game, tris_snapshot_t* copy)
+{
+    tris_snapshot_t* snapshot = &game->snapshot;
+    int before, after;
+
+    while (1) {
+        before = atomic_load_explicit(&snapshot->sequence, memory_order_acquire);
+        if (before & 1) {
+            sched_yield();
+            continue;
+        }
+
+        memcpy(copy->matrix, snapshot->matrix, sizeof(copy->matrix));
+        copy->result = snapshot->result;
+        copy->turn = snapshot->turn;
+        memcpy(copy->user_ids, snapshot->user_ids, sizeof(copy->user_ids));
+
+        atomic_thread_fence(memory_order_acquire);
+        after = atomic_load_explicit(&snapshot->sequence, memory_order_relaxed);
+
+        if (before == after)
+            return before;
+    }
+}
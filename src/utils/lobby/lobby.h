@@ -0,0 +1,38 @@
+/************************************
+ * VR487434 - Lorenzo Di Berardino
+ * VR486588 - Filippo Milani
+ * 09/05/2024
+ ************************************/
+
+#ifndef LOBBY_H
+#define LOBBY_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "../globals.h"
+
+void init_lobby(tris_lobby_t*, int, int);
+bool is_lobby_recoverable(tris_lobby_t*, int);
+void recover_lobby(tris_lobby_t*);
+tris_game_t* get_game_at(tris_lobby_t*, int);
+int get_game_index(tris_lobby_t*, tris_game_t*);
+uint64_t get_game_handle(tris_lobby_t*, int);
+tris_game_t* get_game_by_handle(tris_lobby_t*, uint64_t);
+int take_free_slot(tris_lobby_t*);
+void release_game_slot(tris_lobby_t*, int);
+tris_game_t* join_game(tris_lobby_t*, uint64_t, char*, int*);
+void publish_client_path(tris_lobby_t*);
+const char* get_client_path(tris_lobby_t*);
+void push_ready_session(tris_lobby_t*, int);
+int pop_ready_session(tris_lobby_t*);
+void notify_session(tris_lobby_t*, tris_game_t*);
+void request_quit(tris_lobby_t*, tris_game_t*, int);
+void request_detach(tris_lobby_t*, tris_game_t*, int);
+void drop_detached(tris_lobby_t*, tris_game_t*, int);
+tris_game_t* rejoin_game(tris_lobby_t*, uint64_t, int, uint64_t, int*);
+long long get_time_left(tris_game_t*, int);
+void init_snapshot(tris_game_t*);
+void publish_snapshot(tris_game_t*, int);
+int read_snapshot(tris_game_t*, tris_snapshot_t*);
+
+#endif
@@ -0,0 +1,211 @@
+/************************************
+ * VR487434 - Lorenzo Di Berardino
+ * VR486588 - Filippo Milani
+ * 09/05/2024
+ ************************************/
+
+#include "matchmaking.h"
+#include "../data.h"
+#include "../semaphores/semaphores.h"
+
+#include <stdatomic.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+// The queue is a bounded MPMC ring: every cell carries a sequence number telling
+// whether it is free for the producer of a position (sequence == position), full
+// for its consumer (sequence == position + 1) or still held by the previous lap
+#define CELL(lobby, position) (&(lobby)->tickets[(position) & (QUEUE_CAPACITY - 1)])
+
+/// @brief Initialize the matchmaking queue and its metrics
+void init_queue(tris_lobby_t* lobby)
+{
+    for (uint64_t i = 0; i < QUEUE_CAPACITY; i++) {
+        atomic_store(&lobby->tickets[i].sequence, i);
+        atomic_store(&lobby->tickets[i].state, TICKET_WAITING);
+    }
+
+    atomic_store(&lobby->enqueue_pos, 0);
+    atomic_store(&lobby->dequeue_pos, 0);
+    atomic_store(&lobby->matcher_signal, 0);
+    atomic_store(&lobby->rejected, 0);
+    atomic_store(&lobby->matches, 0);
+    atomic_store(&lobby->served, 0);
+    atomic_store(&lobby->total_wait_ms, 0);
+    atomic_store(&lobby->max_wait_ms, 0);
+}
+
+/// @brief Put a request to join a game in the queue, and wake up the matcher
+/// @param lobby The lobby
+/// @param username The username of the player
+/// @param mode The requested mode: NONE to play against a human, or the
+/// difficulty of the AI
+/// @return The ticket of the request, or NO_TICKET if the queue is full
+uint64_t enqueue_join_request(tris_lobby_t* lobby, char* username, int mode)
+{
+    uint64_t position = atomic_load_explicit(&lobby->enqueue_pos, memory_order_relaxed);
+    tris_ticket_t* ticket;
+
+    while (1) {
+        ticket = CELL(lobby, position);
+        int64_t diff = (int64_t)(atomic_load_explicit(&ticket->sequence, memory_order_acquire) - position);
+
+        if (diff == 0) {
+            if (atomic_compare_exchange_weak_explicit(&lobby->enqueue_pos, &position, position + 1,
+                    memory_order_relaxed, memory_order_relaxed))
+                break;
+        } else if (diff < 0) {
+            // Every cell is still in use: the player has to come back later
+            atomic_fetch_add_explicit(&lobby->rejected, 1, memory_order_relaxed);
+            return NO_TICKET;
+        } else {
+            position = atomic_load_explicit(&lobby->enqueue_pos, memory_order_relaxed);
+        }
+    }
+
+    atomic_store_explicit(&ticket->state, TICKET_WAITING, memory_order_relaxed);
+    ticket->mode = mode;
+    ticket->pid = getpid();
+    strncpy(ticket->username, username, USERNAME_MAX_LEN);
+    ticket->username[USERNAME_MAX_LEN] = '\0';
+    ticket->enqueued_at = monotonic_ms();
+    ticket->position = position;
+    ticket->handle = NO_HANDLE;
+    atomic_store_explicit(&ticket->sequence, position + 1, memory_order_release);
+
+    wake_matcher(lobby);
+
+    return position;
+}
+
+/// @brief Take the oldest request out of the queue. Its cell stays held until
+/// the ticket is released
+/// @return The ticket, or NO_TICKET if the queue is empty
+uint64_t dequeue_join_request(tris_lobby_t* lobby)
+{
+    uint64_t position = atomic_load_explicit(&lobby->dequeue_pos, memory_order_relaxed);
+
+    while (1) {
+        int64_t diff = (int64_t)(atomic_load_explicit(&CELL(lobby, position)->sequence, memory_order_acquire) - (position + 1));
+
+        if (diff == 0) {
+            if (atomic_compare_exchange_weak_explicit(&lobby->dequeue_pos, &position, position + 1,
+                    memory_order_relaxed, memory_order_relaxed))
+                return position;
+        } else if (diff < 0) {
+            return NO_TICKET;
+        } else {
+            position = atomic_load_explicit(&lobby->dequeue_pos, memory_order_relaxed);
+        }
+    }
+}
+
+/// @brief Get the cell of a ticket
+tris_ticket_t* get_ticket(tris_lobby_t* lobby, uint64_t ticket)
+{
+    return CELL(lobby, ticket);
+}
+
+/// @brief Check whether the cell of a ticket has not been released yet
+bool is_ticket_held(tris_lobby_t* lobby, uint64_t ticket)
+{
+    return atomic_load_explicit(&CELL(lobby, ticket)->sequence, memory_order_acquire) == ticket + 1;
+}
+
+/// @brief Give the cell of a ticket back to the producers of the next lap
+void release_ticket(tris_lobby_t* lobby, uint64_t ticket)
+{
+    uint64_t held = ticket + 1;
+    if (atomic_compare_exchange_strong_explicit(&CELL(lobby, ticket)->sequence, &held, ticket + QUEUE_CAPACITY,
+            memory_order_release, memory_order_relaxed))
+        atomic_fetch_add_explicit(&lobby->served, 1, memory_order_relaxed);
+}
+
+/// @brief Tell the client of a ticket which game it has been placed in, and
+/// account for the time it has waited
+/// @param lobby The lobby
+/// @param ticket The ticket
+/// @param handle The handle of the game, or NO_HANDLE on error
+/// @param player_index The index of the player in the game, or an error code
+/// @return False if the client has cancelled its request in the meantime
+bool assign_ticket(tris_lobby_t* lobby, uint64_t ticket, uint64_t handle, int player_index)
+{
+    tris_ticket_t* cell = CELL(lobby, ticket);
+    cell->handle = handle;
+    cell->player_index = player_index;
+
+    int expected = TICKET_WAITING;
+    if (!atomic_compare_exchange_strong(&cell->state, &expected, TICKET_ASSIGNED))
+        return false;
+
+    futex_wake(&cell->state, 1);
+
+    if (handle != NO_HANDLE) {
+        long long waited = monotonic_ms() - cell->enqueued_at;
+        long long max = atomic_load_explicit(&lobby->max_wait_ms, memory_order_relaxed);
+
+        atomic_fetch_add_explicit(&lobby->matches, 1, memory_order_relaxed);
+        atomic_fetch_add_explicit(&lobby->total_wait_ms, waited, memory_order_relaxed);
+        while (waited > max && !atomic_compare_exchange_weak_explicit(&lobby->max_wait_ms, &max, waited,
+                   memory_order_relaxed, memory_order_relaxed))
+            ;
+    }
+
+    return true;
+}
+
+/// @brief Wait for the matcher to place the player, for at most QUEUE_POLL_MS.
+/// Once assigned, the cell of the ticket is released
+/// @param lobby The lobby
+/// @param ticket The ticket of the player
+/// @param handle Where to store the handle of the game
+/// @return The index of the player, an error code, or MATCH_PENDING_CODE
+int wait_for_match(tris_lobby_t* lobby, uint64_t ticket, uint64_t* handle)
+{
+    tris_ticket_t* cell = CELL(lobby, ticket);
+    struct timespec timeout = { 0, QUEUE_POLL_MS * 1000000L };
+
+    if (atomic_load_explicit(&cell->state, memory_order_acquire) == TICKET_WAITING)
+        futex_wait(&cell->state, TICKET_WAITING, &timeout);
+
+    return take_match(lobby, ticket, handle);
+}
+
+/// @brief Take the game the matcher placed the player in, without waiting (see
+/// wait_for_match)
+int take_match(tris_lobby_t* lobby, uint64_t ticket, uint64_t* handle)
+{
+    tris_ticket_t* cell = CELL(lobby, ticket);
+
+    if (atomic_load_explicit(&cell->state, memory_order_acquire) != TICKET_ASSIGNED)
+        return MATCH_PENDING_CODE;
+
+    *handle = cell->handle;
+    int player_index = cell->player_index;
+    release_ticket(lobby, ticket);
+
+    return player_index;
+}
+
+/// @brief Withdraw a request from the queue
+/// @return False if the player had already been placed in a game: the caller
+/// has to leave it
+bool cancel_join_request(tris_lobby_t* lobby, uint64_t ticket)
+{
+    int expected = TICKET_WAITING;
+    return atomic_compare_exchange_strong(&CELL(lobby, ticket)->state, &expected, TICKET_CANCELLED);
+}
+
+/// @brief Wake up the matcher: a request has been queued or a slot freed
+void wake_matcher(tris_lobby_t* lobby)
+{
+    atomic_fetch_add(&lobby->matcher_signal, 1);
+    futex_wake(&lobby->matcher_signal, 1);
+}
+
+/// @brief Get the number of requests queued and not yet served
+unsigned long long get_queue_depth(tris_lobby_t* lobby)
+{
+    return atomic_load(&lobby->enqueue_pos) - atomic_load(&lobby->served);
+}
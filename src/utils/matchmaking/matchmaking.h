@@ -0,0 +1,27 @@
+/************************************
+ * VR487434 - Lorenzo Di Berardino
+ * VR486588 - Filippo Milani
+ * 09/05/2024
+ ************************************/
+
+#ifndef MATCHMAKING_H
+#define MATCHMAKING_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "../globals.h"
+
+void init_queue(tris_lobby_t*);
+uint64_t enqueue_join_request(tris_lobby_t*, char*, int);
+uint64_t dequeue_join_request(tris_lobby_t*);
+tris_ticket_t* get_ticket(tris_lobby_t*, uint64_t);
+bool is_ticket_held(tris_lobby_t*, uint64_t);
+void release_ticket(tris_lobby_t*, uint64_t);
+bool assign_ticket(tris_lobby_t*, uint64_t, uint64_t, int);
+int wait_for_match(tris_lobby_t*, uint64_t, uint64_t*);
+int take_match(tris_lobby_t*, uint64_t, uint64_t*);
+bool cancel_join_request(tris_lobby_t*, uint64_t);
+void wake_matcher(tris_lobby_t*);
+unsigned long long get_queue_depth(tris_lobby_t*);
+
+#endif
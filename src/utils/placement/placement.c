@@ -0,0 +1,132 @@
+/************************************
+ * VR487434 - Lorenzo Di Berardino
+ * VR486588 - Filippo Milani
+ * 09/05/2024
+ ************************************/
+
+#define _GNU_SOURCE
+
+#include "placement.h"
+#include "../data.h"
+
+#include <dirent.h>
+#include <linux/mempolicy.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+/// @brief Parse a list of CPUs, such as "0-3,8". Every CPU must be one this
+/// process is allowed to run on
+/// @param list The list
+/// @param set Where to store the CPUs
+/// @return The number of CPUs, or -1 if the list is not valid
+int parse_cpu_list(const char* list, cpu_set_t* set)
+{
+    cpu_set_t allowed;
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) < 0)
+        return -1;
+
+    CPU_ZERO(set);
+    const char* p = list;
+
+    while (1) {
+        char* end;
+        long first = strtol(p, &end, 10);
+        long last = first;
+
+        if (end == p || first < 0)
+            return -1;
+
+        if (*end == '-') {
+            p = end + 1;
+            last = strtol(p, &end, 10);
+            if (end == p || last < first)
+                return -1;
+        }
+
+        for (long cpu = first; cpu <= last; cpu++) {
+            if (cpu >= CPU_SETSIZE || !CPU_ISSET(cpu, &allowed))
+                return -1;
+            CPU_SET(cpu, set);
+        }
+
+        if (*end == '\0')
+            break;
+        if (*end != ',')
+            return -1;
+        p = end + 1;
+    }
+
+    return CPU_COUNT(set);
+}
+
+/// @brief Get the n-th CPU of a set, going around it if n is past its size
+int get_nth_cpu(const cpu_set_t* set, int n)
+{
+    int count = CPU_COUNT(set);
+    if (count == 0)
+        return NO_CPU;
+
+    n %= count;
+    for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+        if (CPU_ISSET(cpu, set) && n-- == 0)
+            return cpu;
+    }
+
+    return NO_CPU;
+}
+
+/// @brief Get the NUMA node of a CPU, from the node link in its sysfs directory
+/// @return The node, or 0 on a host without NUMA
+int get_cpu_node(int cpu)
+{
+    char path[IPC_NAME_MAX_LEN];
+    snprintf(path, sizeof(path), CPU_SYSFS_PATH_FORMAT, cpu);
+
+    DIR* dir = opendir(path);
+    if (dir == NULL)
+        return 0;
+
+    int node = 0;
+    struct dirent* entry;
+    while ((entry = readdir(dir)) != NULL) {
+        if (sscanf(entry->d_name, "node%d", &node) == 1)
+            break;
+    }
+
+    closedir(dir);
+    return node;
+}
+
+/// @brief Make a thread run on a single CPU, from its creation
+/// @param attr The attributes the thread is created with
+/// @param cpu The CPU
+/// @return False if the affinity cannot be set
+bool set_thread_cpu(pthread_attr_t* attr, int cpu)
+{
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+
+    return pthread_attr_setaffinity_np(attr, sizeof(set), &set) == 0;
+}
+
+/// @brief Make this process (and the programs it executes) run on a set of CPUs
+bool pin_process(const cpu_set_t* set)
+{
+    return sched_setaffinity(0, sizeof(*set), set) == 0;
+}
+
+/// @brief Prefer a NUMA node for a range of memory, moving the pages already
+/// there. The range must start on a page
+/// @return False if the kernel refused (e.g. it has no NUMA support)
+bool bind_to_node(void* addr, size_t len, int node)
+{
+    if (node < 0 || node >= (int)(8 * sizeof(unsigned long)))
+        return false;
+
+    unsigned long mask = 1UL << node;
+
+    return syscall(SYS_mbind, addr, len, MPOL_PREFERRED, &mask, 8 * sizeof(mask), MPOL_MF_MOVE) == 0;
+}
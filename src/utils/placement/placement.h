@@ -0,0 +1,22 @@
+/************************************
+ * VR487434 - Lorenzo Di Berardino
+ * VR486588 - Filippo Milani
+ * 09/05/2024
+ ************************************/
+
+#ifndef PLACEMENT_H
+#define PLACEMENT_H
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+int parse_cpu_list(const char*, cpu_set_t*);
+int get_nth_cpu(const cpu_set_t*, int);
+int get_cpu_node(int);
+bool set_thread_cpu(pthread_attr_t*, int);
+bool pin_process(const cpu_set_t*);
+bool bind_to_node(void*, size_t, int);
+
+#endif
@@ -0,0 +1,119 @@
+/************************************
+ * VR487434 - Lorenzo Di Berardino
+ * VR486588 - Filippo Milani
+ * 09/05/2024
+ ************************************/
+
+#include "registry.h"
+#include "../data.h"
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <string.h>
+
+// The registry is an open addressing table with linear probing, right after the
+// arena. Entries are only added by the matcher, so a lookup never races with an
+// insert; they are removed (left as tombstones) by whoever frees the slot of the
+// player, with a compare-and-swap. The matcher turns back into empty entries the
+// tombstones at the end of a probe sequence, so that sequences stay short
+#define REGISTRY(lobby) ((tris_user_t*)&(lobby)->games[(lobby)->n_slots])
+
+/// @brief FNV-1a hash of a username
+static uint32_t hash_username(const char* username)
+{
+    uint32_t hash = 2166136261u;
+
+    for (const char* c = username; *c != '\0'; c++)
+        hash = (hash ^ (unsigned char)*c) * 16777619u;
+
+    return hash;
+}
+
+/// @brief Empty the registry of the usernames
+void init_registry(tris_lobby_t* lobby)
+{
+    tris_user_t* users = REGISTRY(lobby);
+
+    for (size_t i = 0; i < REGISTRY_CAPACITY(lobby->n_slots); i++)
+        atomic_store(&users[i].state, USER_EMPTY);
+}
+
+/// @brief Add a username to the registry, if nobody is using it. Only called by
+/// the matcher
+/// @param lobby The lobby
+/// @param username The username
+/// @return The ID of the user, or NO_USER if the username is already in use
+uint32_t register_username(tris_lobby_t* lobby, const char* username)
+{
+    tris_user_t* users = REGISTRY(lobby);
+    size_t capacity = REGISTRY_CAPACITY(lobby->n_slots);
+    uint32_t hash = hash_username(username);
+    size_t first_free = capacity, i = hash % capacity;
+    bool found_empty = false;
+
+    // Look for the username up to the end of its probe sequence, keeping the
+    // first tombstone (the table is at most half full: if no entry is empty,
+    // a tombstone is)
+    for (size_t probes = 0; probes < capacity; probes++, i = (i + 1) % capacity) {
+        int state = atomic_load_explicit(&users[i].state, memory_order_acquire);
+
+        if (state == USER_EMPTY) {
+            found_empty = true;
+            break;
+        }
+
+        if (state == USER_USED && users[i].hash == hash && strcmp(users[i].name, username) == 0)
+            return NO_USER;
+
+        if (state == USER_FREE && first_free == capacity)
+            first_free = i;
+    }
+
+    // The tombstones right before the empty entry end no other sequence
+    for (size_t j = (i + capacity - 1) % capacity; found_empty && j != i; j = (j + capacity - 1) % capacity) {
+        int state = USER_FREE;
+        if (!atomic_compare_exchange_strong(&users[j].state, &state, USER_EMPTY))
+            break;
+    }
+
+    if (first_free != capacity)
+        i = first_free;
+
+    users[i].hash = hash;
+    strncpy(users[i].name, username, USERNAME_MAX_LEN);
+    users[i].name[USERNAME_MAX_LEN] = '\0';
+    atomic_store_explicit(&users[i].state, USER_USED, memory_order_release);
+
+    return i;
+}
+
+/// @brief Remove a user from the registry, once the player left its slot
+/// @param lobby The lobby
+/// @param user The ID of the user (the AI is not in the registry)
+void unregister_username(tris_lobby_t* lobby, uint32_t user)
+{
+    if (user >= REGISTRY_CAPACITY(lobby->n_slots))
+        return;
+
+    int state = USER_USED;
+    atomic_compare_exchange_strong(&REGISTRY(lobby)[user].state, &state, USER_FREE);
+}
+
+/// @brief Get the username of a user
+/// @return The username, or an empty string if there is no user
+const char* get_username(tris_lobby_t* lobby, uint32_t user)
+{
+    if (user == AI_USER)
+        return AI_USERNAME;
+
+    if (user >= REGISTRY_CAPACITY(lobby->n_slots))
+        return "";
+
+    return REGISTRY(lobby)[user].name;
+}
+
+/// @brief Get the username of a player of a game
+const char* get_player_username(tris_lobby_t* lobby, tris_game_t* game, int index)
+{
+    return get_username(lobby, game->players[index].user_id);
+}
@@ -0,0 +1,19 @@
+/************************************
+ * VR487434 - Lorenzo Di Berardino
+ * VR486588 - Filippo Milani
+ * 09/05/2024
+ ************************************/
+
+#ifndef REGISTRY_H
+#define REGISTRY_H
+
+#include <stdint.h>
+#include "../globals.h"
+
+void init_registry(tris_lobby_t*);
+uint32_t register_username(tris_lobby_t*, const char*);
+void unregister_username(tris_lobby_t*, uint32_t);
+const char* get_username(tris_lobby_t*, uint32_t);
+const char* get_player_username(tris_lobby_t*, tris_game_t*, int);
+
+#endif
@@ -0,0 +1,415 @@
+/************************************
+ * VR487434 - Lorenzo Di Berardino
+ * VR486588 - Filippo Milani
+ * 09/05/2024
+ ************************************/
+
+#include "render.h"
+#include "../data.h"
+#include "../globals.h"
+#include "../events/events.h"
+#include "../semaphores/semaphores.h"
+
+#include <limits.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <sys/eventfd.h>
+#include <sys/ioctl.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+// The animations of the terminal (the spinner and the countdown) are drawn by a
+// single thread, started the first time it is needed. The other threads only
+// post what they want on screen and wake it up: requests posted before it runs
+// are drawn once, as the latest of them. The timer ticks only while the spinner
+// turns, otherwise the thread sleeps until the next request. It writes straight
+// to the descriptor, so that it never waits for the stdio lock of the others
+
+static pthread_once_t render_once = PTHREAD_ONCE_INIT;
+static atomic_bool render_started = false;
+static int timer_fd = -1;
+static int event_fd = -1;
+
+// The requests: what should be on screen, and how many requests have been posted
+// and handled (a stop waits for its own)
+static atomic_bool spinner_wanted = false;
+static atomic_int countdown_value = 0;
+static atomic_int countdown_timeout = 0;
+static atomic_int countdown_posted = 0;
+static atomic_int posted = 0;
+static atomic_int handled = 0;
+
+// The screens of the game are drawn as frames: a frame is composed in memory,
+// compared with the one on screen, and only the lines that changed are written
+// again, with the moves of the cursor, in a single write. The unit is the line
+// rather than the cell, since the colors are escape sequences within the text:
+// a line written again starts with the colors in effect where it begins. A frame
+// is drawn from the top of the screen, and ends with a newline: whatever is
+// printed below it is erased by the next one
+static FILE* frame = NULL;
+static char* frame_text = NULL;
+static size_t frame_len = 0;
+static char* screen_text = NULL;
+static size_t screen_len = 0;
+static bool screen_valid = false;
+
+// Cost of the frames drawn
+static unsigned long long frames_drawn = 0;
+static unsigned long long frames_repainted = 0;
+static unsigned long long frame_bytes = 0;
+static unsigned long long frame_writes = 0;
+
+static void start_renderer();
+static void* render_handler(void*);
+static int post_request();
+static void wake_renderer();
+static int draw_bytes(const char*, size_t);
+static bool next_line(const char*, size_t, size_t*, const char**, size_t*);
+static void track_colors(char*, const char*, size_t);
+static bool fits_terminal(const char*, size_t);
+
+/// @brief Start turning the loading spinner, after the last character printed
+void start_loading_spinner()
+{
+#if PRETTY
+    if (is_headless())
+        return;
+
+    pthread_once(&render_once, start_renderer);
+
+    if (!atomic_exchange(&spinner_wanted, true))
+        post_request();
+#endif
+}
+
+/// @brief Stop the loading spinner, if it is turning, and erase it. It returns
+/// once the spinner is gone from the screen. Safe in a signal handler
+void stop_loading_spinner()
+{
+#if PRETTY
+    if (!atomic_exchange(&spinner_wanted, false) || !atomic_load(&render_started))
+        return;
+
+    int request = post_request();
+    int seen;
+
+    while ((seen = atomic_load(&handled)) - request < 0)
+        futex_wait(&handled, seen, NULL);
+#endif
+}
+
+/// @brief Show the countdown of the timeout at the start of the line, keeping
+/// the cursor where it is
+/// @param remaining The seconds left
+/// @param timeout The whole timeout, which gives the width of the countdown
+void show_countdown(int remaining, int timeout)
+{
+#if PRETTY
+    if (is_headless())
+        return;
+
+    pthread_once(&render_once, start_renderer);
+
+    atomic_store(&countdown_value, remaining);
+    atomic_store(&countdown_timeout, timeout);
+    atomic_fetch_add(&countdown_posted, 1);
+    post_request();
+#endif
+}
+
+/// @brief Start composing a frame
+/// @return The stream to print the frame to
+FILE* begin_frame()
+{
+    if (frame != NULL)
+        fclose(frame);
+
+    if ((frame = open_memstream(&frame_text, &frame_len)) == NULL)
+        errexit(FRAME_ERROR);
+
+    return frame;
+}
+
+/// @brief Draw the frame composed since begin_frame, writing only the lines
+/// that differ from the frame on screen
+void end_frame()
+{
+    if (frame == NULL)
+        return;
+
+    fclose(frame);
+    frame = NULL;
+
+    // Whatever stdio still holds was printed before the frame
+    fflush(stdout);
+
+    char* output = NULL;
+    size_t output_len = 0;
+    FILE* out = open_memstream(&output, &output_len);
+    if (out == NULL)
+        errexit(FRAME_ERROR);
+
+    bool repaint = !screen_valid || !fits_terminal(frame_text, frame_len);
+
+    if (repaint) {
+        fputs(CLEAR_SCREEN, out);
+        fwrite(frame_text, 1, frame_len, out);
+        frames_repainted++;
+    } else {
+        char colors[FRAME_COLORS_LEN] = "";
+        size_t new_pos = 0, old_pos = 0;
+        const char *line, *old_line = NULL;
+        size_t len, old_len = 0;
+        int row = 1;
+
+        while (next_line(frame_text, frame_len, &new_pos, &line, &len)) {
+            bool old = next_line(screen_text, screen_len, &old_pos, &old_line, &old_len);
+
+            if (!old || len != old_len || memcmp(line, old_line, len) != 0) {
+                fprintf(out, "\x1b[%d;1H" FNRM "%s", row, colors);
+                fwrite(line, 1, len, out);
+                fputs("\x1b[K", out);
+            }
+
+            track_colors(colors, line, len);
+            row++;
+        }
+
+        // Erase what was printed below the last frame, with the colors of the
+        // end of this one
+        fprintf(out, "\x1b[%d;1H\x1b[J" FNRM "%s", row, colors);
+    }
+
+    fclose(out);
+
+    frames_drawn++;
+    frame_bytes += output_len;
+    frame_writes += draw_bytes(output, output_len);
+    free(output);
+
+    // The frame is now the one on screen
+    free(screen_text);
+    screen_text = frame_text;
+    screen_len = frame_len;
+    screen_valid = true;
+    frame_text = NULL;
+    frame_len = 0;
+}
+
+/// @brief Forget the frame on screen, so that the next one is drawn as a whole:
+/// to be called when the screen is cleared, or when an unknown number of lines
+/// may have been printed below the frame
+void invalidate_frame()
+{
+    screen_valid = false;
+}
+
+/// @brief Print how much the frames drawn so far have cost
+void print_render_stats()
+{
+    if (frames_drawn == 0)
+        return;
+
+    printf(RENDER_STATS_MESSAGE, frames_drawn, frames_repainted, frame_bytes, frame_writes,
+        (double)frame_bytes / frames_drawn, (double)frame_writes / frames_drawn);
+}
+
+/// @brief Get the next line of a frame, without its newline
+/// @param text The frame
+/// @param len The length of the frame
+/// @param pos Where the line starts, moved to the next one
+/// @param line Where to store the start of the line
+/// @param line_len Where to store the length of the line
+/// @return False if the frame has no more lines
+static bool next_line(const char* text, size_t len, size_t* pos, const char** line, size_t* line_len)
+{
+    if (text == NULL || *pos >= len)
+        return false;
+
+    const char* end = memchr(text + *pos, '\n', len - *pos);
+    size_t next = end == NULL ? len : (size_t)(end - text) + 1;
+
+    *line = text + *pos;
+    *line_len = (end == NULL ? len : (size_t)(end - text)) - *pos;
+    *pos = next;
+
+    return true;
+}
+
+/// @brief Keep track of the colors in effect after a line: the sequences that
+/// set them since the last reset
+/// @param colors The sequences in effect before the line, updated
+static void track_colors(char* colors, const char* line, size_t len)
+{
+    for (size_t i = 0; i + 1 < len; i++) {
+        if (line[i] != '\x1b' || line[i + 1] != '[')
+            continue;
+
+        size_t end = i + 2;
+        while (end < len && (line[end] == ';' || (line[end] >= '0' && line[end] <= '9')))
+            end++;
+
+        if (end >= len || line[end] != 'm')
+            continue;
+
+        size_t sequence_len = end - i + 1;
+        size_t colors_len = strlen(colors);
+
+        if (sequence_len == strlen(FNRM) && memcmp(line + i, FNRM, sequence_len) == 0)
+            colors[0] = '\0';
+        else if (colors_len + sequence_len < FRAME_COLORS_LEN) {
+            memcpy(colors + colors_len, line + i, sequence_len);
+            colors[colors_len + sequence_len] = '\0';
+        }
+
+        i = end;
+    }
+}
+
+/// @brief Check whether the terminal leaves enough rows below a frame for the
+/// messages printed after it. The frames sent anywhere but to a terminal are
+/// always drawn as a whole
+static bool fits_terminal(const char* text, size_t len)
+{
+    struct winsize size;
+
+    if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &size) < 0)
+        return false;
+
+    int rows = 0;
+    for (size_t i = 0; i < len; i++)
+        rows += text[i] == '\n';
+
+    return size.ws_row >= rows + FRAME_HEADROOM_ROWS;
+}
+
+/// @brief Start the render thread, with every signal blocked
+static void start_renderer()
+{
+    if ((timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC)) < 0
+        || (event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) < 0)
+        return;
+
+    sigset_t set, old_set;
+    sigfillset(&set);
+    pthread_sigmask(SIG_SETMASK, &set, &old_set);
+
+    pthread_t tid;
+    if (pthread_create(&tid, NULL, render_handler, NULL) == 0) {
+        pthread_detach(tid);
+        atomic_store(&render_started, true);
+    }
+
+    pthread_sigmask(SIG_SETMASK, &old_set, NULL);
+}
+
+/// @brief Post a request to the render thread and wake it up
+/// @return The number of the request
+static int post_request()
+{
+    int request = atomic_fetch_add(&posted, 1) + 1;
+    wake_renderer();
+
+    return request;
+}
+
+/// @brief Wake up the render thread
+static void wake_renderer()
+{
+    uint64_t one = 1;
+
+    // A full counter wakes the thread up all the same
+    if (write(event_fd, &one, sizeof(one)) < 0)
+        return;
+}
+
+/// @brief Write some bytes to the terminal, as a whole
+/// @return The number of writes it took
+static int draw_bytes(const char* str, size_t len)
+{
+    int writes = 0;
+
+    while (len > 0) {
+        ssize_t n = write(STDOUT_FILENO, str, len);
+        writes++;
+        if (n <= 0)
+            break;
+        str += n;
+        len -= n;
+    }
+
+    return writes;
+}
+
+/// @brief Write a string to the terminal, as a whole
+static void draw(const char* str)
+{
+    draw_bytes(str, strlen(str));
+}
+
+/// @brief Thread that draws the animations: a frame of the spinner on every tick
+/// of the timer, and what the requests changed since the last wake up
+static void* render_handler(void* arg)
+{
+    static const char* frames[] = { "\b|", "\b/", "\b-", "\b\\" };
+    bool spinning = false;
+    int frame = 0;
+    int countdown_drawn = 0;
+
+    while (1) {
+        struct pollfd fds[] = {
+            { .fd = event_fd, .events = POLLIN },
+            { .fd = timer_fd, .events = POLLIN },
+        };
+
+        if (poll(fds, 2, -1) < 0)
+            continue;
+
+        uint64_t count;
+        bool tick = read(timer_fd, &count, sizeof(count)) == sizeof(count);
+        if (read(event_fd, &count, sizeof(count)) < 0)
+            count = 0;
+
+        int request = atomic_load(&posted);
+        bool wanted = atomic_load(&spinner_wanted);
+
+        if (wanted != spinning) {
+            struct itimerspec spec = { { 0, 0 }, { 0, 0 } };
+            if (wanted)
+                spec.it_interval.tv_nsec = spec.it_value.tv_nsec = SPINNER_FRAME_MS * 1000000L;
+            timerfd_settime(timer_fd, 0, &spec, NULL);
+
+            spinning = wanted;
+            frame = 0;
+            draw(spinning ? frames[frame] : "\b \b");
+        } else if (spinning && tick) {
+            frame = (frame + 1) % 4;
+            draw(frames[frame]);
+        }
+
+        int countdown = atomic_load(&countdown_posted);
+        if (countdown != countdown_drawn) {
+            countdown_drawn = countdown;
+
+            int remaining = atomic_load(&countdown_value);
+            int timeout = atomic_load(&countdown_timeout);
+            int padding = max(0, digits(timeout) + (timeout % 10 != 0) - digits(remaining));
+            char line[COUNTDOWN_LEN];
+
+            snprintf(line, sizeof(line), "\x1b[s\r%*s(%d)\x1b[u", padding, "", remaining);
+            draw(line);
+        }
+
+        atomic_store(&handled, request);
+        futex_wake(&handled, INT_MAX);
+    }
+
+    return NULL;
+}
@@ -0,0 +1,20 @@
+/************************************
+ * VR487434 - Lorenzo Di Berardino
+ * VR486588 - Filippo Milani
+ * 09/05/2024
+ ************************************/
+
+#ifndef RENDER_H
+#define RENDER_H
+
+#include <stdio.h>
+
+void start_loading_spinner();
+void stop_loading_spinner();
+void show_countdown(int, int);
+FILE* begin_frame();
+void end_frame();
+void invalidate_frame();
+void print_render_stats();
+
+#endif
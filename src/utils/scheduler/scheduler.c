@@ -0,0 +1,91 @@
+/************************************
+ * VR487434 - Lorenzo Di Berardino
+ * VR486588 - Filippo Milani
+ * 09/05/2024
+ ************************************/
+
+#include "scheduler.h"
+#include "../data.h"
+
+#include <stdlib.h>
+
+/// @brief Initialize an empty deque
+/// @param deque The deque
+/// @param capacity The most items it will ever hold: every session is in at most
+/// one deque at a time, so the number of slots is enough
+void init_deque(work_deque_t* deque, int capacity)
+{
+    long long size = 1;
+    while (size < capacity)
+        size <<= 1;
+
+    if ((deque->buffer = calloc(size, sizeof(atomic_int))) == NULL)
+        errexit(INITIALIZATION_ERROR);
+
+    deque->mask = size - 1;
+    atomic_store(&deque->top, 0);
+    atomic_store(&deque->bottom, 0);
+}
+
+void dispose_deque(work_deque_t* deque)
+{
+    free(deque->buffer);
+    deque->buffer = NULL;
+}
+
+/// @brief Push an item at the bottom of the deque (owner only)
+void push_work(work_deque_t* deque, int item)
+{
+    long long bottom = atomic_load_explicit(&deque->bottom, memory_order_relaxed);
+
+    atomic_store_explicit(&deque->buffer[bottom & deque->mask], item, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    atomic_store_explicit(&deque->bottom, bottom + 1, memory_order_relaxed);
+}
+
+/// @brief Pop the newest item from the bottom of the deque (owner only)
+/// @return The item, or NO_WORK if the deque is empty
+int pop_work(work_deque_t* deque)
+{
+    long long bottom = atomic_load_explicit(&deque->bottom, memory_order_relaxed) - 1;
+    atomic_store_explicit(&deque->bottom, bottom, memory_order_relaxed);
+    atomic_thread_fence(memory_order_seq_cst);
+    long long top = atomic_load_explicit(&deque->top, memory_order_relaxed);
+
+    if (top > bottom) {
+        atomic_store_explicit(&deque->bottom, bottom + 1, memory_order_relaxed);
+        return NO_WORK;
+    }
+
+    int item = atomic_load_explicit(&deque->buffer[bottom & deque->mask], memory_order_relaxed);
+
+    // The last item may be stolen at the same time: the top decides
+    if (top == bottom) {
+        if (!atomic_compare_exchange_strong_explicit(&deque->top, &top, top + 1,
+                memory_order_seq_cst, memory_order_relaxed))
+            item = NO_WORK;
+
+        atomic_store_explicit(&deque->bottom, bottom + 1, memory_order_relaxed);
+    }
+
+    return item;
+}
+
+/// @brief Steal the oldest item from the top of the deque (any thread)
+/// @return The item, or NO_WORK if the deque is empty or another thief won
+int steal_work(work_deque_t* deque)
+{
+    long long top = atomic_load_explicit(&deque->top, memory_order_acquire);
+    atomic_thread_fence(memory_order_seq_cst);
+    long long bottom = atomic_load_explicit(&deque->bottom, memory_order_acquire);
+
+    if (top >= bottom)
+        return NO_WORK;
+
+    int item = atomic_load_explicit(&deque->buffer[top & deque->mask], memory_order_relaxed);
+    if (!atomic_compare_exchange_strong_explicit(&deque->top, &top, top + 1,
+            memory_order_seq_cst, memory_order_relaxed))
+        return NO_WORK;
+
+    return item;
+}
@@ -0,0 +1,28 @@
+/************************************
+ * VR487434 - Lorenzo Di Berardino
+ * VR486588 - Filippo Milani
+ * 09/05/2024
+ ************************************/
+
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include <stdatomic.h>
+#include "../globals.h"
+
+// Work-stealing deque of a worker: the owner pushes and pops at the bottom, the
+// thieves steal from the top. The owner and the thieves touch separate lines
+typedef struct {
+    _Alignas(CACHE_LINE_SIZE) atomic_llong top;
+    _Alignas(CACHE_LINE_SIZE) atomic_llong bottom;
+    atomic_int* buffer;
+    long long mask;
+} work_deque_t;
+
+void init_deque(work_deque_t*, int);
+void dispose_deque(work_deque_t*);
+void push_work(work_deque_t*, int);
+int pop_work(work_deque_t*);
+int steal_work(work_deque_t*);
+
+#endif
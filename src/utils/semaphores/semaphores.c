@@ -4,14 +4,17 @@
  * 09/05/2024
  ************************************/
 
-#include "semaphore.h"
+#include "semaphores.h"
 #include "../data.h"
 #include "../globals.h"
 
 #include <errno.h>
+#include <linux/futex.h>
 #include <sys/ipc.h>
 #include <sys/sem.h>
+#include <sys/syscall.h>
 #include <sys/types.h>
+#include <time.h>
 
 #ifndef SEMUN_H
 #define SEMUN_H
@@ -22,9 +25,15 @@ union semun {
 };
 #endif
 
-int get_semaphores(int n_sems)
+int get_semaphores(int key, int n_sems)
 {
-    int sem_id = semget(SEM_ID, n_sems, IPC_CREAT | PERM);
+    int sem_id = semget(key, n_sems, IPC_CREAT | PERM);
+
+    // A set left by a crashed server may be smaller than needed: replace it
+    if (sem_id < 0 && errno == EINVAL && (sem_id = semget(key, 0, PERM)) >= 0) {
+        semctl(sem_id, 0, IPC_RMID);
+        sem_id = semget(key, n_sems, IPC_CREAT | PERM);
+    }
     if (sem_id < 0) {
 #if DEBUG
         errexit(SEMAPHORE_INITIALIZATION_ERROR);
@@ -40,6 +49,61 @@ int get_semaphores(int n_sems)
     return sem_id;
 }
 
+/// @brief Create a new semaphore set not bound to any key, so that it never
+/// collides with other servers; its id has to be published to the clients
+int get_private_semaphores(int n_sems)
+{
+    int sem_id = semget(IPC_PRIVATE, n_sems, IPC_CREAT | PERM);
+    if (sem_id < 0) {
+#if DEBUG
+        errexit(SEMAPHORE_ALLOCATION_ERROR);
+#else
+        exit(EXIT_FAILURE);
+#endif
+    }
+
+#if DEBUG
+    printf(SEMAPHORE_OBTAINED_SUCCESS, sem_id);
+#endif
+
+    return sem_id;
+}
+
+/// @brief Check that the semaphore set of a crashed server can be taken over as
+/// it is, with the posts it holds
+/// @param sem_id The semaphore set, as published by the crashed server
+/// @param n_sems The number of semaphores needed
+/// @return True if the set still exists, with that number of semaphores
+bool adopt_semaphores(int sem_id, int n_sems)
+{
+    struct semid_ds ds;
+    union semun arg;
+    arg.buf = &ds;
+
+    if (sem_id < 0 || semctl(sem_id, 0, IPC_STAT, arg) < 0 || ds.sem_nsems != (unsigned long)n_sems)
+        return false;
+
+#if DEBUG
+    printf(SEMAPHORE_OBTAINED_SUCCESS, sem_id);
+#endif
+
+    return true;
+}
+
+/// @brief Get the value of a semaphore of a set
+/// @return The value, or -1 on error
+int get_semaphore_value(int sem_id, int sem_num)
+{
+    return semctl(sem_id, sem_num, GETVAL);
+}
+
+/// @brief Count the processes waiting for a semaphore of a set to be posted
+/// @return The number of processes, or -1 on error
+int count_semaphore_waiters(int sem_id, int sem_num)
+{
+    return semctl(sem_id, sem_num, GETNCNT);
+}
+
 void set_semaphore(int sem_id, int sem_num, int value)
 {
     if (semctl(sem_id, sem_num, SETVAL, value) < 0) {
@@ -73,6 +137,23 @@ void set_semaphores(int sem_id, int n_sems, short unsigned* values)
 #endif
 }
 
+/// @brief Set to zero a range of semaphores of a set, leaving the others untouched
+/// @param sem_id The semaphore set
+/// @param first The first semaphore of the range
+/// @param n_sems The number of semaphores of the range
+void clear_semaphores(int sem_id, int first, int n_sems)
+{
+    for (int i = first; i < first + n_sems; i++) {
+        if (semctl(sem_id, i, SETVAL, 0) < 0) {
+#if DEBUG
+            errexit(SEMAPHORE_INITIALIZATION_ERROR);
+#else
+            exit(EXIT_FAILURE);
+#endif
+        }
+    }
+}
+
 void dispose_semaphore(int sem_id)
 {
     if (semctl(sem_id, 0, IPC_RMID) < 0) {
@@ -105,6 +186,18 @@ void wait_semaphore(int sem_id, int sem_num, int value)
     }
 }
 
+/// @brief Take a semaphore only if it can be taken right away
+/// @return True if it has been taken
+bool try_wait_semaphore(int sem_id, int sem_num, int value)
+{
+    if (value > 0)
+        value *= -1;
+
+    struct sembuf sops = { sem_num, value, IPC_NOWAIT };
+
+    return semop(sem_id, &sops, 1) == 0;
+}
+
 void signal_semaphore(int sem_id, int sem_num, int value)
 {
     struct sembuf sops = { sem_num, value, 0 };
@@ -117,4 +210,71 @@ void signal_semaphore(int sem_id, int sem_num, int value)
         exit(EXIT_FAILURE);
 #endif
     }
-}
\ No newline at end of file
+}
+
+/// @brief Wait on a futex word in shared memory while it holds the expected value
+/// @param word The futex word
+/// @param expected The value the word is expected to hold
+/// @param timeout The maximum (relative) time to wait, or NULL to wait forever
+/// @return 0 when woken up, -1 otherwise (EAGAIN if the word had already changed)
+int futex_wait(atomic_int* word, int expected, const struct timespec* timeout)
+{
+    return syscall(SYS_futex, word, FUTEX_WAIT, expected, timeout, NULL, 0);
+}
+
+/// @brief Wake up the processes waiting on a futex word in shared memory
+/// @param word The futex word
+/// @param n The maximum number of waiters to wake up
+/// @return The number of waiters woken up
+int futex_wake(atomic_int* word, int n)
+{
+    return syscall(SYS_futex, word, FUTEX_WAKE, n, NULL, NULL, 0);
+}
+
+/// @brief Wait on several futex words in shared memory, while all of them hold
+/// their expected value (without the vectorized wait of the kernel, the words are
+/// polled every FUTEX_POLL_MS instead)
+/// @param words The futex words
+/// @param expected The values the words are expected to hold
+/// @param n The number of words, at most FUTEX_WAITV_MAX
+/// @param timeout The maximum (relative) time to wait
+/// @return The index of the word woken up, -1 otherwise (EAGAIN if a word had
+/// already changed, ETIMEDOUT if the time is over)
+int futex_wait_any(atomic_int** words, const int* expected, int n, const struct timespec* timeout)
+{
+    struct futex_waitv waiters[FUTEX_WAITV_MAX];
+    struct timespec deadline;
+
+    // Nothing to wait for but the time
+    if (n == 0) {
+        nanosleep(timeout, NULL);
+        errno = ETIMEDOUT;
+        return -1;
+    }
+
+    for (int i = 0; i < n; i++) {
+        waiters[i] = (struct futex_waitv) {
+            .val = (unsigned)expected[i],
+            .uaddr = (uintptr_t)words[i],
+            .flags = FUTEX_32,
+        };
+    }
+
+    // The timeout of the vectorized wait is absolute
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    deadline.tv_sec += timeout->tv_sec;
+    deadline.tv_nsec += timeout->tv_nsec;
+    if (deadline.tv_nsec >= 1000000000L) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000L;
+    }
+
+    int woken = syscall(SYS_futex_waitv, waiters, n, 0, &deadline, CLOCK_MONOTONIC);
+    if (woken >= 0 || errno != ENOSYS)
+        return woken;
+
+    struct timespec poll = { 0, FUTEX_POLL_MS * 1000000L };
+    nanosleep(timeout->tv_sec > 0 || timeout->tv_nsec > poll.tv_nsec ? &poll : timeout, NULL);
+    errno = ETIMEDOUT;
+    return -1;
+}
@@ -7,11 +7,24 @@
 #ifndef SEMAPHORES_H
 #define SEMAPHORES_H
 
-int get_semaphores(int);
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <time.h>
+
+int get_semaphores(int, int);
+int get_private_semaphores(int);
+bool adopt_semaphores(int, int);
+int get_semaphore_value(int, int);
+int count_semaphore_waiters(int, int);
 void set_semaphore(int, int, int);
 void set_semaphores(int, int, short unsigned*);
+void clear_semaphores(int, int, int);
 void dispose_semaphore(int);
 void wait_semaphore(int, int, int);
+bool try_wait_semaphore(int, int, int);
 void signal_semaphore(int, int, int);
+int futex_wait(atomic_int*, int, const struct timespec*);
+int futex_wake(atomic_int*, int);
+int futex_wait_any(atomic_int**, const int*, int, const struct timespec*);
 
 #endif
\ No newline at end of file
@@ -4,20 +4,388 @@
  * 09/05/2024
  ************************************/
 
+#define _GNU_SOURCE
+
 #include "shared_memory.h"
 #include "../data.h"
 
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stddef.h>
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <sys/ipc.h>
+#include <sys/mman.h>
 #include <sys/shm.h>
-#include <signal.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
 
-int get_and_init_shared_memory(int size, int id)
+// Backend currently in use by this process
+static int backend = DEFAULT_IPC_BACKEND;
+static bool huge_pages = false;
+
+// Shard of the IPC namespace used by this process
+static int shard = 0;
+
+// A process that only reads the lobby (a spectator) finds and attaches it read only
+static bool read_only = false;
+
+// Size of the mapping of the POSIX backends (needed to unmap it)
+static size_t mapped_size = 0;
+
+// memfd hand-off to the clients
+static int handoff_socket = -1;
+static int handoff_fd = -1;
+static pthread_t handoff_tid = 0;
+
+static void get_posix_name(char* name)
+{
+    snprintf(name, IPC_NAME_MAX_LEN, SHM_NAME_FORMAT, getuid(), shard);
+}
+
+/// @brief Build the abstract unix socket address the memfd is handed over
+static socklen_t get_handoff_address(struct sockaddr_un* addr)
+{
+    memset(addr, 0, sizeof(*addr));
+    addr->sun_family = AF_UNIX;
+
+    // Abstract namespace: the first byte of the path is '\0'
+    int len = snprintf(addr->sun_path + 1, sizeof(addr->sun_path) - 1, MEMFD_SOCKET_NAME_FORMAT, getuid(), shard);
+
+    return offsetof(struct sockaddr_un, sun_path) + 1 + len;
+}
+
+/// @brief Round the size up to a multiple of the page size in use
+static size_t round_size(size_t size, size_t page)
+{
+    return (size + page - 1) / page * page;
+}
+
+// --------- BACKEND SELECTION ---------
+
+/// @brief Set the shard of the IPC namespace: the names and the keys of the
+/// shared memory are derived from it
+void set_shared_memory_shard(int new_shard)
+{
+    shard = new_shard;
+}
+
+int get_shared_memory_shard()
+{
+    return shard;
+}
+
+/// @brief Find and attach the shared memory read only from now on: the
+/// descriptors are opened O_RDONLY, and the mappings cannot be written
+void set_shared_memory_read_only()
+{
+    read_only = true;
+}
+
+/// @brief Set the backend used to create and attach the shared memory
+/// @param new_backend One of the IPC_BACKEND_* values
+/// @param use_huge_pages True to back the POSIX backends with huge pages
+void set_shared_memory_backend(int new_backend, bool use_huge_pages)
+{
+    backend = new_backend;
+    huge_pages = use_huge_pages && new_backend != IPC_BACKEND_SYSV;
+}
+
+int get_shared_memory_backend()
+{
+    return backend;
+}
+
+bool are_huge_pages_enabled()
+{
+    return huge_pages;
+}
+
+/// @brief Get the size of the pages backing the shared memory
+size_t get_shared_memory_page_size()
+{
+    return huge_pages ? HUGE_PAGE_SIZE : (size_t)sysconf(_SC_PAGESIZE);
+}
+
+/// @brief Parse the name of a backend
+/// @param name The name to parse
+/// @return The backend, or -1 if the name is not valid
+int parse_shared_memory_backend(const char* name)
+{
+    if (strcmp(name, IPC_BACKEND_SYSV_NAME) == 0)
+        return IPC_BACKEND_SYSV;
+    if (strcmp(name, IPC_BACKEND_POSIX_NAME) == 0)
+        return IPC_BACKEND_POSIX;
+    if (strcmp(name, IPC_BACKEND_MEMFD_NAME) == 0)
+        return IPC_BACKEND_MEMFD;
+
+    return -1;
+}
+
+const char* get_shared_memory_backend_name(int backend)
+{
+    switch (backend) {
+    case IPC_BACKEND_POSIX:
+        return IPC_BACKEND_POSIX_NAME;
+    case IPC_BACKEND_MEMFD:
+        return IPC_BACKEND_MEMFD_NAME;
+    default:
+        return IPC_BACKEND_SYSV_NAME;
+    }
+}
+
+/// @brief Open the shared memory behind a descriptor again, read only
+static int reopen_read_only(int fd)
+{
+    char path[IPC_NAME_MAX_LEN];
+    snprintf(path, sizeof(path), "/proc/self/fd/%d", fd);
+
+    return open(path, O_RDONLY | O_CLOEXEC);
+}
+
+// --------- MEMFD HAND-OFF ---------
+
+/// @brief Check if the process at the other end of a connected unix socket
+/// belongs to the same user as this one. The hand-off socket is abstract, so
+/// it has no permissions: anyone could connect to it, or listen on it first
+static bool is_peer_same_user(int socket_fd)
+{
+    struct ucred cred;
+    socklen_t len = sizeof(cred);
+
+    return getsockopt(socket_fd, SOL_SOCKET, SO_PEERCRED, &cred, &len) == 0 && cred.uid == getuid();
+}
+
+/// @brief Thread that hands the memfd over to every client of the same user
+/// that connects
+static void* handoff_handler(void* arg)
+{
+    while (1) {
+        int client = accept(handoff_socket, NULL, NULL);
+        if (client < 0) {
+            if (errno == EINTR)
+                continue;
+            break;
+        }
+
+        if (is_peer_same_user(client))
+            send_shared_memory_fd(client, handoff_fd);
+        close(client);
+    }
+
+    return NULL;
+}
+
+/// @brief Start the thread serving the memfd on the listening socket
+static void run_handoff()
+{
+    // The signals are handled by the main thread only
+    sigset_t set, old_set;
+    sigfillset(&set);
+    pthread_sigmask(SIG_SETMASK, &set, &old_set);
+    pthread_create(&handoff_tid, NULL, handoff_handler, NULL);
+    pthread_sigmask(SIG_SETMASK, &old_set, NULL);
+}
+
+/// @brief Start serving the memfd on the abstract unix socket
+static void start_handoff(int fd)
+{
+    struct sockaddr_un addr;
+    socklen_t len = get_handoff_address(&addr);
+
+    handoff_fd = fd;
+    handoff_socket = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (handoff_socket < 0
+        || bind(handoff_socket, (struct sockaddr*)&addr, len) < 0
+        || listen(handoff_socket, SOMAXCONN) < 0)
+        errexit(SHARED_MEMORY_HANDOFF_ERROR);
+
+    run_handoff();
+}
+
+static void stop_handoff()
+{
+    if (handoff_tid != 0) {
+        pthread_cancel(handoff_tid);
+        pthread_join(handoff_tid, NULL);
+        handoff_tid = 0;
+    }
+
+    if (handoff_socket >= 0) {
+        close(handoff_socket);
+        handoff_socket = -1;
+    }
+}
+
+/// @brief Send a shared memory descriptor over a unix socket
+/// @param socket_fd The connected socket
+/// @param fd The descriptor to send
+/// @return 0 on success, -1 otherwise
+int send_shared_memory_fd(int socket_fd, int fd)
+{
+    char data = 0;
+    struct iovec iov = { &data, sizeof(data) };
+    union {
+        char buf[CMSG_SPACE(sizeof(int))];
+        struct cmsghdr align;
+    } control;
+
+    struct msghdr msg = { 0 };
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buf;
+    msg.msg_controllen = sizeof(control.buf);
+
+    struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+
+    return sendmsg(socket_fd, &msg, MSG_NOSIGNAL) < 0 ? -1 : 0;
+}
+
+/// @brief Receive a shared memory descriptor from a unix socket
+/// @param socket_fd The connected socket
+/// @return The received descriptor, or -1 on failure
+int receive_shared_memory_fd(int socket_fd)
+{
+    char data;
+    struct iovec iov = { &data, sizeof(data) };
+    union {
+        char buf[CMSG_SPACE(sizeof(int))];
+        struct cmsghdr align;
+    } control;
+
+    struct msghdr msg = { 0 };
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buf;
+    msg.msg_controllen = sizeof(control.buf);
+
+    if (recvmsg(socket_fd, &msg, MSG_CMSG_CLOEXEC) <= 0)
+        return -1;
+
+    struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+    if (cmsg == NULL || cmsg->cmsg_type != SCM_RIGHTS)
+        return -1;
+
+    int fd;
+    memcpy(&fd, CMSG_DATA(cmsg), sizeof(int));
+
+    return fd;
+}
+
+/// @brief Ask the running server for its memfd. A socket bound by a process of
+/// another user is not a server of this user: nothing is taken from it
+/// @return The descriptor, or -1 if no server hands one over
+static int request_memfd()
 {
-    int shm_id = shmget(id, size, IPC_CREAT | PERM);
-    if (shm_id < 0)
+    struct sockaddr_un addr;
+    socklen_t len = get_handoff_address(&addr);
+
+    int socket_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (socket_fd < 0)
+        return -1;
+
+    int fd = -1;
+    if (connect(socket_fd, (struct sockaddr*)&addr, len) == 0 && is_peer_same_user(socket_fd))
+        fd = receive_shared_memory_fd(socket_fd);
+
+    close(socket_fd);
+
+    return fd;
+}
+
+// --------- POSIX BACKENDS ---------
+
+/// @brief Check if the shared memory behind a descriptor belongs to a running server
+static bool is_posix_server_alive(int fd)
+{
+    struct stat st;
+    if (fstat(fd, &st) < 0 || st.st_size < (off_t)LOBBY_HEADER_SIZE)
+        return false;
+
+    tris_lobby_t* probe = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    if (probe == MAP_FAILED)
+        return false;
+
+    bool alive = probe->server_pid != 0 && kill(probe->server_pid, 0) == 0;
+    munmap(probe, st.st_size);
+
+    return alive;
+}
+
+static int create_posix_shared_memory(int size)
+{
+    char name[IPC_NAME_MAX_LEN];
+    get_posix_name(name);
+
+    int fd = shm_open(name, O_CREAT | O_RDWR, PERM);
+    if (fd < 0 || ftruncate(fd, round_size(size, sysconf(_SC_PAGESIZE))) < 0)
+        errexit(SHARED_MEMORY_ALLOCATION_ERROR);
+
+    return fd;
+}
+
+static int create_memfd_shared_memory(int size)
+{
+    int fd;
+
+    if (huge_pages) {
+        // hugetlbfs needs a size multiple of the huge page size, and the mapping
+        // fails only at mmap time if no huge page is reserved: try it right away
+        size_t huge_size = round_size(size, HUGE_PAGE_SIZE);
+
+        if ((fd = memfd_create(MEMFD_NAME, MFD_HUGETLB)) >= 0) {
+            void* probe = MAP_FAILED;
+
+            if (ftruncate(fd, huge_size) == 0)
+                probe = mmap(NULL, huge_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+
+            if (probe != MAP_FAILED) {
+                munmap(probe, huge_size);
+                return fd;
+            }
+
+            close(fd);
+        }
+
+        // Fall back to regular pages (transparent huge pages are still advised at attach)
+        printf(HUGE_PAGES_FALLBACK_MESSAGE);
+    }
+
+    fd = memfd_create(MEMFD_NAME, 0);
+    if (fd < 0 || ftruncate(fd, round_size(size, sysconf(_SC_PAGESIZE))) < 0)
         errexit(SHARED_MEMORY_ALLOCATION_ERROR);
 
+    return fd;
+}
+
+// --------- SHARED MEMORY ---------
+
+int get_and_init_shared_memory(int size, int id)
+{
+    int shm_id;
+
+    switch (backend) {
+    case IPC_BACKEND_POSIX:
+        shm_id = create_posix_shared_memory(size);
+        break;
+    case IPC_BACKEND_MEMFD:
+        shm_id = create_memfd_shared_memory(size);
+        start_handoff(shm_id);
+        break;
+    default:
+        shm_id = shmget(id, size, IPC_CREAT | PERM);
+        if (shm_id < 0)
+            errexit(SHARED_MEMORY_ALLOCATION_ERROR);
+    }
+
 #if DEBUG
     printf(SHARED_MEMORY_OBTAINED_SUCCESS, shm_id);
 #endif
@@ -32,19 +400,127 @@ int get_shared_memory(int size, int id)
     return shm_id;
 }
 
+/// @brief Look for the shared memory of a running server, whatever its backend.
+/// The backend of this process is set to the one of the server found
+/// @param size The size of the shared memory
+/// @param id The key of the SysV shared memory
+/// @return The id of the shared memory, or -1 if no server is running
+int find_shared_memory(int size, int id)
+{
+    char name[IPC_NAME_MAX_LEN];
+    get_posix_name(name);
+
+    // POSIX shared memory, if its server is still alive
+    int fd = shm_open(name, (read_only ? O_RDONLY : O_RDWR) | O_CLOEXEC, PERM);
+    if (fd >= 0) {
+        if (is_posix_server_alive(fd)) {
+            backend = IPC_BACKEND_POSIX;
+            return fd;
+        }
+
+        close(fd);
+    }
+
+    // memfd handed over by the server (the socket only exists while the server is alive)
+    if ((fd = request_memfd()) >= 0) {
+        backend = IPC_BACKEND_MEMFD;
+        if (!read_only)
+            return fd;
+
+        // The memfd is handed over writable: only a read only copy is kept
+        int read_only_fd = reopen_read_only(fd);
+        close(fd);
+        return read_only_fd;
+    }
+
+    backend = IPC_BACKEND_SYSV;
+    return get_shared_memory(size, id);
+}
+
 void dispose_shared_memory(int shm_id)
 {
-    if (shmctl(shm_id, IPC_RMID, NULL) < 0)
-        errexit(SHARED_MEMORY_DEALLOCATION_ERROR);
+    char name[IPC_NAME_MAX_LEN];
+
+    switch (backend) {
+    case IPC_BACKEND_POSIX:
+        get_posix_name(name);
+        if (shm_unlink(name) < 0)
+            errexit(SHARED_MEMORY_DEALLOCATION_ERROR);
+        close(shm_id);
+        break;
+    case IPC_BACKEND_MEMFD:
+        stop_handoff();
+        close(shm_id);
+        break;
+    default:
+        if (shmctl(shm_id, IPC_RMID, NULL) < 0)
+            errexit(SHARED_MEMORY_DEALLOCATION_ERROR);
+    }
 
 #if DEBUG
     printf("\n" SHARED_MEMORY_DEALLOCATION_SUCCESS);
 #endif
 }
 
+/// @brief Keep the descriptors of the shared memory open across the exec of a
+/// new image of the server: the memfd or the POSIX shared memory, and the socket
+/// the memfd is handed over on (the clients that connect meanwhile are queued)
+/// @param shm_id The id of the shared memory
+/// @return The socket of the memfd hand-off, or -1 if the backend has none
+int keep_shared_memory_on_exec(int shm_id)
+{
+    if (backend == IPC_BACKEND_SYSV)
+        return -1;
+
+    if (fcntl(shm_id, F_SETFD, 0) < 0 || (handoff_socket >= 0 && fcntl(handoff_socket, F_SETFD, 0) < 0))
+        errexit(SHARED_MEMORY_HANDOFF_ERROR);
+
+    return handoff_socket;
+}
+
+/// @brief Take over the shared memory kept open by the previous image of the
+/// server, and hand the memfd over again on the socket it listened on
+/// @param shm_id The id of the shared memory
+/// @param socket_fd The socket of the memfd hand-off, or -1
+void adopt_shared_memory(int shm_id, int socket_fd)
+{
+    if (backend == IPC_BACKEND_SYSV)
+        return;
+
+    if (fcntl(shm_id, F_SETFD, FD_CLOEXEC) < 0)
+        errexit(SHARED_MEMORY_STATUS_ERROR);
+
+    if (backend != IPC_BACKEND_MEMFD)
+        return;
+
+    if (socket_fd < 0 || fcntl(socket_fd, F_SETFD, FD_CLOEXEC) < 0)
+        errexit(SHARED_MEMORY_HANDOFF_ERROR);
+
+    handoff_fd = shm_id;
+    handoff_socket = socket_fd;
+    run_handoff();
+}
+
 void* attach_shared_memory(int shm_id)
 {
-    void* addr = shmat(shm_id, NULL, 0);
+    void* addr;
+
+    if (backend == IPC_BACKEND_SYSV) {
+        addr = shmat(shm_id, NULL, read_only ? SHM_RDONLY : 0);
+    } else {
+        struct stat st;
+        if (fstat(shm_id, &st) < 0)
+            errexit(SHARED_MEMORY_STATUS_ERROR);
+
+        mapped_size = st.st_size;
+        addr = mmap(NULL, mapped_size, read_only ? PROT_READ : PROT_READ | PROT_WRITE, MAP_SHARED, shm_id, 0);
+        if (addr == MAP_FAILED)
+            addr = (void*)-1;
+        else if (huge_pages)
+            // Only a hint: effective if shmem THP is enabled on this host
+            madvise(addr, mapped_size, MADV_HUGEPAGE);
+    }
+
     if (addr == (void*)-1)
         errexit(SHARED_MEMORY_ATTACH_ERROR);
 
@@ -55,28 +531,94 @@ void* attach_shared_memory(int shm_id)
     return addr;
 }
 
+/// @brief Open the shared memory again, read only, to hand it over to a process
+/// that must not write to it
+/// @param shm_id The id of the shared memory
+/// @return The descriptor, or -1 if the backend has none (SysV)
+int open_read_only_shared_memory(int shm_id)
+{
+    if (backend == IPC_BACKEND_SYSV)
+        return -1;
+
+    return reopen_read_only(shm_id);
+}
+
 void detach_shared_memory(void* addr)
 {
-    if (shmdt(addr) < 0)
+    int ret = backend == IPC_BACKEND_SYSV ? shmdt(addr) : munmap(addr, mapped_size);
+
+    if (ret < 0)
         errexit(SHARED_MEMORY_DETACH_ERROR);
 }
 
-bool is_another_server_running(int* game_id, tris_game_t** game)
+/// @brief Check if a server of any backend is running. The shared memory left by a
+/// crashed server of the same backend is handed back, if large enough
+/// @param lobby_id Where to store the id of the shared memory to reuse
+/// @param lobby Where to store the shared memory to reuse
+/// @param size The size needed by this server
+/// @return True if another server is running
+bool is_another_server_running(int* lobby_id, tris_lobby_t** lobby, size_t size)
 {
+    char name[IPC_NAME_MAX_LEN];
+    get_posix_name(name);
+
+    // A server of any backend is running if its memfd is handed over...
+    int fd = request_memfd();
+    if (fd >= 0) {
+        close(fd);
+        return true;
+    }
+
+    // ...or if its POSIX shared memory has a live server pid
+    if ((fd = shm_open(name, O_RDWR | O_CLOEXEC, PERM)) >= 0) {
+        if (is_posix_server_alive(fd)) {
+            close(fd);
+            return true;
+        }
+
+        // Reuse the memory left by a crashed server of the same backend
+        if (backend == IPC_BACKEND_POSIX && ftruncate(fd, round_size(size, sysconf(_SC_PAGESIZE))) == 0) {
+            *lobby_id = fd;
+            *lobby = (tris_lobby_t*)attach_shared_memory(fd);
+            return false;
+        }
+
+        close(fd);
+    }
+
     // check if there are attached processes by trying to attach to the
     // shared memory if the shared memory is obtainable without creating it
     // (only the first server is capable of this)
-    *game_id = get_shared_memory(0, GAME_ID);
+    int sysv_id = get_shared_memory(0, SHARD_KEY(GAME_ID, shard));
 
     // if the shared memory does not exist, no server is running
-    if (*game_id < 0)
+    if (sysv_id < 0)
         return false;
 
     // if the shared memory exists, check if the set pid corresponds to a running process
-    *game = (tris_game_t*)attach_shared_memory(*game_id);
+    tris_lobby_t* sysv_lobby = (tris_lobby_t*)shmat(sysv_id, NULL, 0);
+    if (sysv_lobby == (void*)-1)
+        return false;
+
+    if (sysv_lobby->server_pid == 0 || kill(sysv_lobby->server_pid, 0) < 0) {
+        struct shmid_ds ds;
+        bool large_enough = shmctl(sysv_id, IPC_STAT, &ds) == 0 && ds.shm_segsz >= size;
+
+        // Reuse the memory left by a crashed server of the same backend;
+        // a segment too small for this arena is removed, to be created again
+        if (backend == IPC_BACKEND_SYSV && large_enough) {
+            *lobby_id = sysv_id;
+            *lobby = sysv_lobby;
+        } else {
+            if (backend == IPC_BACKEND_SYSV)
+                shmctl(sysv_id, IPC_RMID, NULL);
+            shmdt(sysv_lobby);
+        }
 
-    if (kill((*game)->pids[SERVER], 0) < 0)
         return false;
+    }
+
+    shmdt(sysv_lobby);
 
     return true;
-}
\ No newline at end of file
+}
@@ -10,11 +10,26 @@
 #include <stdbool.h>
 #include "../globals.h"
 
+void set_shared_memory_shard(int);
+int get_shared_memory_shard();
+void set_shared_memory_read_only();
+void set_shared_memory_backend(int, bool);
+int get_shared_memory_backend();
+bool are_huge_pages_enabled();
+size_t get_shared_memory_page_size();
+int parse_shared_memory_backend(const char*);
+const char* get_shared_memory_backend_name(int);
+int send_shared_memory_fd(int, int);
+int receive_shared_memory_fd(int);
 int get_and_init_shared_memory(int, int);
 int get_shared_memory(int, int);
+int find_shared_memory(int, int);
 void dispose_shared_memory(int);
+int keep_shared_memory_on_exec(int);
+void adopt_shared_memory(int, int);
 void* attach_shared_memory(int);
+int open_read_only_shared_memory(int);
 void detach_shared_memory(void*);
-bool is_another_server_running(int*, tris_game_t**);
+bool is_another_server_running(int*, tris_lobby_t**, size_t);
 
-#endif
\ No newline at end of file
+#endif